@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+/*
+ * keep clients from starving the main loop - and thereby the player.
+ */
+
+#include <time.h>
+#include <syslog.h>
+#include <glib.h>
+
+#include <config.h>
+#include "opt.h"
+#include "budget.h"
+
+/* CPU time of all commands */
+static t_bucket cpu;
+static int cpu_init = 0;
+static int overload = 0;
+
+/* usec - not affected by changes to the wall clock */
+static gint64 bucket_now( void )
+{
+	struct timespec ts;
+
+	if( clock_gettime( CLOCK_MONOTONIC, &ts ))
+		return 0;
+
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+void bucket_init( t_bucket *b, double rate, double burst )
+{
+	b->rate = rate;
+	b->burst = burst;
+	b->tokens = burst;
+	b->last = bucket_now();
+}
+
+double bucket_level( t_bucket *b )
+{
+	gint64 now = bucket_now();
+
+	/* rate 0: unlimited */
+	if( b->rate <= 0 )
+		return b->burst;
+
+	if( now > b->last )
+		b->tokens += (double)(now - b->last) * b->rate
+			/ G_USEC_PER_SEC;
+	if( b->tokens > b->burst )
+		b->tokens = b->burst;
+	b->last = now;
+
+	return b->tokens;
+}
+
+void bucket_charge( t_bucket *b, double n )
+{
+	bucket_level( b );
+	b->tokens -= n;
+}
+
+int bucket_wait( t_bucket *b, double n )
+{
+	double missing = n - bucket_level( b );
+
+	if( missing <= 0 || b->rate <= 0 )
+		return 0;
+
+	return missing * 1000 / b->rate + 1;
+}
+
+double budget_cputime( void )
+{
+	struct timespec ts;
+
+	if( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ))
+		return 0;
+
+	return (double)ts.tv_sec * 1000 + (double)ts.tv_nsec / 1000000;
+}
+
+static t_bucket *budget_bucket( void )
+{
+	if( ! cpu_init ){
+		bucket_init( &cpu, opt_overload_cpu, opt_overload_burst );
+		cpu_init++;
+	}
+
+	return &cpu;
+}
+
+void budget_cpu( double msec )
+{
+	bucket_charge( budget_bucket(), msec );
+}
+
+int budget_overload( void )
+{
+	int now = bucket_level( budget_bucket() ) < 0;
+
+	if( now != overload ){
+		syslog( LOG_NOTICE, "overload %s", now ? "begins" : "ends" );
+		overload = now;
+	}
+
+	return overload;
+}
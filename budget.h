@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include <glib.h>
+
+/* token bucket: refills by rate per second up to burst */
+typedef struct {
+	double tokens;
+	double rate;
+	double burst;
+	gint64 last;	/* usec */
+} t_bucket;
+
+void bucket_init( t_bucket *b, double rate, double burst );
+/* refill and return available tokens - negative while in debt */
+double bucket_level( t_bucket *b );
+/* take n tokens, going into debt is allowed */
+void bucket_charge( t_bucket *b, double n );
+/* msec until n tokens are available */
+int bucket_wait( t_bucket *b, double n );
+
+/* CPU time used by the calling thread in msec */
+double budget_cputime( void );
+/* account CPU time spent in a command */
+void budget_cpu( double msec );
+/* commands used up their share of CPU time */
+int budget_overload( void );
+
+#endif
@@ -33,6 +33,7 @@
 #include <glib.h>
 
 #include <config.h>
+#include "slab.h"
 #include "client.h"
 
 
@@ -44,6 +45,7 @@ t_client_func client_func_disconnect = NULL;
 static GIOChannel *lchan = NULL;
 static it_client *clients = NULL;
 static int maxid = 0;
+static int maxline = 0;
 
 
 /* add new element to tail */
@@ -166,6 +168,64 @@ void it_client_done( it_client *it )
 }
 
 
+/*
+ * make room for more input. Processed lines are only dropped when free
+ * space at the end runs short. The buffer is taken from the slab pool
+ * and grows as needed to hold a line of maxline bytes.
+ */
+static int client_room( t_client *c )
+{
+	char *tmp;
+	int size;
+
+	if( c->isize - c->ilen > c->isize / 4 )
+		return 0;
+
+	if( c->ihead ){
+		c->ilen -= c->ihead;
+		c->iscan -= c->ihead;
+		memmove( c->ibuf, c->ibuf + c->ihead, c->ilen );
+		c->ihead = 0;
+		c->iline = -1;
+
+		if( c->isize - c->ilen > c->isize / 4 )
+			return 0;
+	}
+
+	if( c->isize >= maxline + CLIENT_BUFLEN )
+		return c->ilen < c->isize ? 0 : -1;
+
+	size = c->isize ? c->isize * 2 : CLIENT_BUFLEN;
+	if( NULL == (tmp = slab_get( &size )))
+		return c->ilen < c->isize ? 0 : -1;
+
+	if( c->ilen )
+		memcpy( tmp, c->ibuf, c->ilen );
+	slab_put( c->ibuf, c->isize );
+	c->ibuf = tmp;
+	c->isize = size;
+
+	return 0;
+}
+
+/*
+ * return the input buffer to the pool once all of it is processed. Idle
+ * clients don't hold one.
+ */
+static void client_idle( t_client *c )
+{
+	if( ! c->ibuf || c->ihead < c->ilen )
+		return;
+
+	slab_put( c->ibuf, c->isize );
+	c->ibuf = NULL;
+	c->isize = 0;
+	c->ihead = 0;
+	c->ilen = 0;
+	c->iscan = 0;
+	c->iline = -1;
+}
+
 /*
  * get new input
  */
@@ -181,19 +241,25 @@ static gboolean client_read( GIOChannel *source,
 	//syslog(LOG_DEBUG,"client(%d): read", c->id );
 	if( cond & G_IO_IN ){
 		sock = g_io_channel_unix_get_fd(source);
+		if( client_room( c )){
+			syslog( LOG_WARNING, "client(%d): input buffer full",
+					c->id );
+			goto err;
+		}
+
 		/* TODO: use g_io_channel_foo instead of recv() */
 		if( 0 >= (len = recv( sock,
 				c->ibuf + c->ilen,
-				CLIENT_BUFLEN - c->ilen, 0))){
+				c->isize - c->ilen, 0))){
 			goto err;
 		}
 
 		c->ilen += len;
-		c->ibuf[c->ilen] = 0;
 
 		if( c->ifunc )
 			(*(t_client_func)c->ifunc)(c);
 
+		client_idle(c);
 		client_delref(c);
 		return TRUE;
 	}
@@ -237,11 +303,23 @@ static gboolean client_accept( GIOChannel *source,
 
 	c->id = ++maxid;
 	c->user = NULL;
+	c->ibuf = NULL;
+	c->isize = 0;
+	c->ihead = 0;
 	c->ilen = 0;
+	c->iscan = 0;
+	c->iline = -1;
+	c->iterm = 0;
 	c->pstate = p_open;
+	c->zone = 0;
+	c->cpu = 0;
 	c->pdata = NULL;
 	c->_refs = 0;
 	c->ifunc = NULL;
+	c->chan = NULL;
+	c->watch = 0;
+	c->resume = 0;
+	c->closed = 0;
 	c->del = 0;
 
 	if( -1 == it_client_add(clients, c ) ){
@@ -254,7 +332,8 @@ static gboolean client_accept( GIOChannel *source,
 		syslog(LOG_ERR, "g_io_chan: %m");
 		return TRUE;
 	}
-	g_io_add_watch(cchan, G_IO_IN | G_IO_HUP | G_IO_ERR,
+	c->chan = cchan;
+	c->watch = g_io_add_watch(cchan, G_IO_IN | G_IO_HUP | G_IO_ERR,
 			client_read, c );
 
 
@@ -290,7 +369,8 @@ void client_delref( t_client *c )
 	if( c->_refs > 0 )
 		return;
 
-	syslog(LOG_DEBUG,"client(%d): free", c->id );
+	syslog(LOG_DEBUG,"client(%d): free, buffers: %d used, %d pooled",
+			c->id, slab_used(), slab_pooled() );
 	c->del++;
 
 	if( client_func_disconnect ){
@@ -298,9 +378,12 @@ void client_delref( t_client *c )
 	}
 
 	g_source_remove_by_user_data(c);
+	if( c->chan )
+		g_io_channel_unref(c->chan);
 	shutdown(c->sock, 2);
 	close(c->sock);
 	user_free(c->user);
+	slab_put(c->ibuf, c->isize);
 	free(c->pdata);
 	free(c);
 }
@@ -310,6 +393,14 @@ void client_close( t_client *c )
 {
 	t_client *i;
 	syslog(LOG_DEBUG,"client(%d): close", c->id );
+
+	c->closed++;
+	if( c->resume ){
+		g_source_remove(c->resume);
+		c->resume = 0;
+		client_delref(c);
+	}
+
 	for( i = it_client_begin(clients); i; i = it_client_next(clients) ){
 		if( i == c ){
 			it_client_del(clients);
@@ -320,6 +411,44 @@ void client_close( t_client *c )
 	}
 }
 
+static gboolean client_resume( gpointer data )
+{
+	t_client *c = (t_client*)data;
+
+	c->resume = 0;
+	c->watch = g_io_add_watch(c->chan, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			client_read, c );
+
+	if( c->ifunc )
+		(*(t_client_func)c->ifunc)(c);
+
+	client_idle(c);
+	client_delref(c);
+	return FALSE;
+}
+
+/*
+ * stop reading from the client for a while. Unprocessed input stays in
+ * the buffer - ifunc is called again afterwards. msec 0 just yields to
+ * the main loop.
+ */
+void client_defer( t_client *c, int msec )
+{
+	if( c->resume || c->closed )
+		return;
+
+	if( c->watch ){
+		g_source_remove(c->watch);
+		c->watch = 0;
+	}
+
+	client_addref(c);
+	if( msec > 0 )
+		c->resume = g_timeout_add( msec, client_resume, c );
+	else
+		c->resume = g_idle_add( client_resume, c );
+}
+
 /*
  * write a message to a client
  * shouldn't block - untested.
@@ -344,53 +473,85 @@ int client_send( t_client *c, const char *buf )
 }
 
 /*
- * find first complete line and return a newly allocated copy
+ * memory held by a client
+ */
+int client_mem( t_client *c )
+{
+	return sizeof(t_client) + c->isize;
+}
+
+/*
+ * find first complete line and return it
  * removes this line from the clients buffer
  *
- * you must free() the line yourself
+ * The line is terminated in place and stays valid until the next input
+ * is read - don't free() it.
  * invoke this repeatedly, untill it returns NULL
  */
 char *client_getline( t_client *c )
 {
 	char *s;
 	char *n;
-	char *line;
 
 	if( c->del )
 		return NULL;
 
+	c->iline = -1;
+
 	/* skip leading linebreaks */
-	s = c->ibuf;
-	while( *s && ( *s == '\n' || *s == '\r')){
-		s++;
+	while( c->ihead < c->ilen && ( c->ibuf[c->ihead] == '\n'
+				|| c->ibuf[c->ihead] == '\r' )){
+		c->ihead++;
 	}
-
-	/* find next linebreak */
-	if( NULL == (n = strpbrk( s, "\n\r" ))){
-		// TODO: handle too long lines more gracefully
-		if( c->ilen >= CLIENT_BUFLEN ){
-			syslog( LOG_WARNING,
-					"line too long, disconnecting client");
-			client_send(c, "ERROR: line too long\n");
-			client_close(c);
-		}
-
+	if( c->iscan < c->ihead )
+		c->iscan = c->ihead;
+
+	/* find next linebreak, continue where the last search stopped */
+	s = c->ibuf + c->ihead;
+	n = memchr( c->ibuf + c->iscan, '\n', c->ilen - c->iscan );
+	if( n == NULL )
+		c->iscan = c->ilen;
+
+	if( (n ? n - s : c->ilen - c->ihead) > maxline ){
+		syslog( LOG_WARNING, "line too long, disconnecting client");
+		client_send(c, "ERROR: line too long\n");
+		client_close(c);
+		c->ihead = c->iscan = c->ilen;
 		return NULL;
 	}
 
-	/* strip linebreaks */
-	do {
-		*n++ = 0;
-	} while( *n && ( *n == '\n' || *n == '\r'));
+	if( n == NULL )
+		return NULL;
+
+	c->iline = c->ihead;
+	c->iterm = n - c->ibuf;
+	c->ihead = c->iscan = c->iterm + 1;
+
+	/* strip linebreak */
+	*n = 0;
+	if( n > s && n[-1] == '\r' )
+		n[-1] = 0;
+
+	//syslog(LOG_DEBUG,"client(%d): line >%s<", c->id, s );
+	return s;
+}
 
+/*
+ * put the line returned by the last client_getline() back into the
+ * buffer. It's returned again on the next invocation.
+ */
+void client_ungetline( t_client *c )
+{
+	if( c->iline < 0 )
+		return;
 
-	/* copy line to new string and remove it from buffer */
-	line = strdup( s );
-	c->ilen -= n - c->ibuf;
-	memmove( c->ibuf, n, c->ilen );
+	c->ibuf[c->iterm] = '\n';
+	if( c->iterm > c->iline && c->ibuf[c->iterm-1] == 0 )
+		c->ibuf[c->iterm-1] = '\r';
 
-	//syslog(LOG_DEBUG,"client(%d): line >%s<", c->id, line );
-	return line;
+	c->ihead = c->iline;
+	c->iscan = c->iterm;
+	c->iline = -1;
 }
 
 
@@ -415,13 +576,14 @@ void clients_done( void )
  * initialize structures
  * open listen lsocket
  */
-int clients_init( int port )
+int clients_init( int port, int linelen )
 {
 	int lsocket;
 	struct protoent *prot;
 	struct sockaddr_in sin;
 	int reuse;
 
+	maxline = linelen;
 	if( NULL == (clients = it_client_new(NULL, NULL, NULL)))
 		return -1;
 
@@ -481,6 +643,18 @@ static int check_minperm( t_client *c, void *data )
 	return ( c->user ? c->user->right : r_any ) >= *(t_rights*)data;
 }
 
+typedef struct {
+	t_rights minperm;
+	int zone;
+} t_check_zone;
+
+static int check_zone( t_client *c, void *data )
+{
+	t_check_zone *z = (t_check_zone*)data;
+
+	return c->zone == z->zone && check_minperm( c, &z->minperm );
+}
+
 static int check_uid( t_client *c, void *data )
 {
 	int *uid = (int*)data;
@@ -509,6 +683,15 @@ int client_bcast_perm( const char *buf, t_rights minperm )
 	return client_bcast( buf, check_minperm, &minperm );
 }
 
+int client_bcast_zone( const char *buf, t_rights minperm, int zone )
+{
+	t_check_zone z;
+
+	z.minperm = minperm;
+	z.zone = zone;
+	return client_bcast( buf, check_zone, &z );
+}
+
 it_client *clients_list( void )
 {
 	return it_client_new( clients, NULL, NULL );
@@ -11,10 +11,13 @@
 #define _CLIENT_H
 
 #include <netinet/in.h>
+#include <glib.h>
 #include <commondb/user.h>
+#include "budget.h"
 
 #define CLIENT_BACKLOG 10
-#define CLIENT_BUFLEN 10240
+/* initial size of the input buffer */
+#define CLIENT_BUFLEN 512
 
 
 // TODO: move protocol stuff to proto module
@@ -30,11 +33,31 @@ typedef struct _t_client {
 	int id;
 	t_user *user;
 	struct sockaddr_in sin;
-	char ibuf[CLIENT_BUFLEN+1];
+	/* input, unprocessed data between ihead and ilen */
+	char *ibuf;
+	int isize;
+	int ihead;
 	int ilen;
+	/* no linebreak before iscan */
+	int iscan;
+	/* last line returned, for client_ungetline() */
+	int iline;
+	int iterm;
 	t_protstate pstate;
+	/* selected playback zone */
+	int zone;
+	/* rate limits for commands and reply lines */
+	t_bucket bcmd;
+	t_bucket brow;
+	/* CPU time spent in commands, msec */
+	double cpu;
 	void *pdata;
 	void *ifunc;
+	GIOChannel *chan;
+	guint watch;
+	/* source to resume reading */
+	guint resume;
+	int closed;
 	int _refs;
 	int del;
 } t_client;
@@ -51,12 +74,13 @@ extern t_client_func client_func_connect;
 extern t_client_func client_func_disconnect;
 
 
-int clients_init( int port );
+int clients_init( int port, int maxline );
 void clients_done( void );
 
 typedef int (*t_client_want_func)( t_client *client, void *data );
 int client_bcast( const char *buf, t_client_want_func func, void *data );
 int client_bcast_perm( const char *buf, t_rights minperm );
+int client_bcast_zone( const char *buf, t_rights minperm, int zone );
 
 t_client *it_client_begin( it_client *it );
 t_client *it_client_cur( it_client *it );
@@ -67,7 +91,11 @@ it_client *clients_list( void );
 
 int client_send( t_client *c, const char *buf );
 char *client_getline( t_client *c );
+void client_ungetline( t_client *c );
+int client_mem( t_client *c );
 void client_close( t_client *c );
+/* stop reading input and call ifunc again after msec */
+void client_defer( t_client *c, int msec );
 
 void client_addref( t_client *c );
 void client_delref( t_client *c );
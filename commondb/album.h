@@ -20,6 +20,7 @@ typedef struct _t_album {
 	t_artist *artist;
 	double rgain;
 	double rgainpeak;
+	int _arena;
 } t_album;
 
 #define it_album it_db
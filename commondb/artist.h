@@ -15,6 +15,7 @@
 typedef struct _t_artist {
 	int id;
 	char *artist;
+	int _arena;
 } t_artist;
 
 #define it_artist it_db
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _COMMONDB_AVAIL_H
+#define _COMMONDB_AVAIL_H
+
+/*
+ * background scanner for track file availability
+ */
+int avail_init( void );
+void avail_done( void );
+
+/* 1: available (or not scanned, yet), 0: unavailable, -1: no scanner */
+int avail_track( int id );
+
+#endif
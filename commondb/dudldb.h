@@ -9,6 +9,13 @@ typedef void (*db_opened_cb)( void );
 int db_init( db_opened_cb );
 void db_done( void );
 
+/*
+ * modifications made by other instances sharing the DB. arg is a
+ * listener specific detail or NULL.
+ */
+typedef void (*db_notify_cb)( const char *arg );
+void db_listen( const char *what, db_notify_cb cb );
+
 /*
  * t_db: placeholder for row structures
  */
@@ -19,9 +26,10 @@ typedef void t_db;
  *
  * owns the PQResult and frees it in it_db_done().
  *
- * parses each row and returns it in a newly allocated struct. i.e. it
- * holds no further reference to this struct after creation. The caller
- * has to free the returned row structures he requested.
+ * parses each row into a struct allocated from a per iterator arena.
+ * These rows stay valid until it_db_done() releases them all at once.
+ * Calling the *_free() function on them is harmless, but does nothing.
+ * Use track_use() to keep a track beyond the iterator's lifetime.
  *
  */
 typedef void it_db;
@@ -32,7 +40,7 @@ t_db *it_db_begin( it_db *i );
 t_db *it_db_cur( it_db *i );
 /* proceeds to next row, parses + allocates it */
 t_db *it_db_next( it_db *i );
-/* frees iterator data + PQresult (no other data is held) */
+/* frees iterator data, PQresult and all rows returned so far */
 void it_db_done( it_db *i );
 
 #endif
@@ -19,8 +19,12 @@ typedef struct _t_history {
 	t_track *track;
 	time_t played;
 	t_user *user;
+	int _arena;
 } t_history;
 
+int history_init( void );
+void history_done( void );
+
 int history_add( t_track *t, int uid, int completed );
 
 #define it_history it_db
@@ -20,21 +20,39 @@ typedef struct _t_queue {
 	t_user *user;
 	time_t queued;
 	int _refs;
+	int _arena;
 } t_queue;
 
 typedef void (*t_queue_func_clear)( void );
 typedef void (*t_queue_func_fetch)( t_queue *q );
+typedef void (*t_queue_func_addlist)( int num );
 
 extern t_queue_func_clear queue_func_clear;
 extern t_queue_func_fetch queue_func_add;
 extern t_queue_func_fetch queue_func_del;
 extern t_queue_func_fetch queue_func_fetch;
+/* called once for tracks queued by one of the queue_add* bulk functions */
+extern t_queue_func_addlist queue_func_addlist;
 
-#define it_queue it_db
-#define it_queue_begin(x)	((t_queue*)it_db_begin(x))
-#define it_queue_cur(x)		((t_queue*)it_db_cur(x))
-#define it_queue_next(x)	((t_queue*)it_db_next(x))
-#define it_queue_done(x)	it_db_done(x)
+/*
+ * it_queue: iterates over a snapshot of the in-memory queue. Returned
+ * entries have to be freed with queue_free().
+ */
+typedef struct _it_queue {
+	t_queue **queue;
+	int num;
+	int cur;
+} it_queue;
+
+t_queue *it_queue_begin( it_queue *it );
+t_queue *it_queue_cur( it_queue *it );
+t_queue *it_queue_next( it_queue *it );
+void it_queue_done( it_queue *it );
+
+/* (re-)load in-memory queue from DB */
+int queue_init( void );
+/* queue was modified by another instance */
+void queue_notified( const char *arg );
 
 
 t_queue *queue_fetch( void );
@@ -45,6 +63,9 @@ t_track *queue_track( t_queue *q );
 
 t_queue *queue_get( int id );
 int queue_add( int trackid, int uid );
+int queue_addlist( const int *ids, int num, int uid, int *first );
+int queue_addalbum( int albumid, int uid );
+int queue_addfilter( expr *filter, int uid );
 int queue_del( int queueid, int uid );
 int queue_clear( void );
 int queue_sum( void );
@@ -18,10 +18,16 @@ typedef void (*t_random_func)( void );
 int random_init( void );
 
 int random_setfilter( expr *filt );
+/* tell other instances about the current filter */
+int random_sharefilter( void );
+/* filter was changed by another instance */
+void random_notified( const char *arg );
 int random_filterstat( void );
 expr *random_filter( void );
 it_track *random_top( int num );
 t_track *random_fetch( void );
+/* path of the track random_fetch() is going to return */
+int random_peek( char *buf, int len );
 
 // TODO: cache_update is internal:
 int random_cache_update( int id, int lplay );
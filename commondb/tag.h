@@ -16,6 +16,7 @@ typedef struct {
 	int id;
 	char *name;
 	char *desc;
+	int _arena;
 } t_tag;
 
 typedef void (*t_tag_func)( t_tag *t );
@@ -40,6 +41,8 @@ int tag_add( const char *name );
 int tag_setname( int id, const char *name );
 int tag_setdesc( int id, const char *desc );
 int tag_del( int id );
+/* tag was modified by another instance */
+void tag_notified( const char *arg );
 
 it_tag *track_tags( int tid );
 int track_tagadd( int tid, int id );
@@ -38,6 +38,7 @@ typedef struct _t_track {
 	double rgainpeak;
 	char *fname;
 	int _refs;
+	int _arena;
 	unsigned int lastplay;
 } t_track;
 
@@ -35,6 +35,7 @@ typedef struct {
 #define it_user_next(x)		((t_user*)it_db_next(x))
 #define it_user_done(x)		it_db_done(x)
 
+t_user *user_use( t_user *u );
 void user_free( t_user *u );
 int user_add( const char *name, t_rights right, const char *pass );
 int user_del( int uid );
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _COMMONDB_ZONE_H
+#define _COMMONDB_ZONE_H
+
+/* max. number of playback zones */
+#define ZONE_MAX	8
+
+/*
+ * zone that player, queue and random functions work on. Set by whoever
+ * calls them: the protocol for the client's zone, the player for its
+ * own callbacks. Zone 0 always exists.
+ */
+extern int zone_cur;
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,9 +27,16 @@
 #include <config.h>
 #include "client.h"
 #include "proto.h"
+#include "commondb/avail.h"
+#include "commondb/history.h"
+#include "commondb/queue.h"
 #include "commondb/random.h"
 #include "commondb/sfilter.h"
+#include "commondb/tag.h"
+#include "commondb/zone.h"
 #include "player.h"
+#include "prefetch.h"
+#include "stream.h"
 #include "sleep.h"
 #include "opt.h"
 
@@ -55,18 +63,20 @@ static void sig_term( int sig )
 	g_main_loop_quit(gmain);
 }
 
+/* load the startup filter of zone_cur */
 static void load_filter( void )
 {
+	char *sfilter = opt_zone[zone_cur].sfilter;
 	int id;
 	t_sfilter *sf;
 	expr *e = NULL;
 	char *msg;
 	int pos;
 
-	if( ! opt_sfilter || ! *opt_sfilter )
+	if( ! sfilter || ! *sfilter )
 		goto done;
 
-	if( -1 == (id = sfilter_id( opt_sfilter )))
+	if( -1 == (id = sfilter_id( sfilter )))
 		goto done;
 
 	if( NULL == (sf = sfilter_get( id )))
@@ -90,26 +100,29 @@ done:
 
 static void db_connected( void )
 {
-	expr *oldfilter;
+	int zone = zone_cur;
 
 	syslog( LOG_DEBUG, "DB connection is up." );
 
-	oldfilter = expr_copy(random_filter());
-	random_init();
-	random_setfilter(oldfilter);
-	expr_free(oldfilter);
+	/* spooled modifications are already replayed. Resync with DB */
+	queue_init();
+	for( zone_cur = 0; zone_cur < opt_zones; ++zone_cur )
+		random_init();
+	zone_cur = zone;
 }
 
+/* write back the filter of zone_cur */
 static void save_filter( void )
 {
+	char *sfilter = opt_zone[zone_cur].sfilter;
 	char buf[4096];
 	expr *e;
 	int id;
 
-	if( ! opt_sfilter || ! *opt_sfilter )
+	if( ! sfilter || ! *sfilter )
 		return;
 
-	if( -1 == (id = sfilter_id( opt_sfilter )))
+	if( -1 == (id = sfilter_id( sfilter )))
 		return;
 
 	if( NULL == (e = random_filter()))
@@ -181,7 +194,7 @@ int main( int argc, char **argv )
 
 	gmain = g_main_loop_new(NULL,0);
 
-	if( clients_init( opt_port ) ){
+	if( clients_init( opt_port, opt_client_maxline ) ){
 		syslog( LOG_ERR, "clients_init(): %m" );
 		return 1;
 	}
@@ -195,22 +208,41 @@ int main( int argc, char **argv )
 		exit(1);
 	}
 
+	/* keep audio path from being paged out */
+	if( opt_mlock && mlockall( MCL_CURRENT | MCL_FUTURE ))
+		syslog( LOG_WARNING, "cannot lock memory: %m" );
+
 	syslog(LOG_INFO, "initializing" );
 
+	/* changes made by other instances on the same DB */
+	db_listen( "queue", queue_notified );
+	db_listen( "tag", tag_notified );
+	db_listen( "filter", random_notified );
+
 	db_init( db_connected );
 	// random_init(); // invoked from db_init()
-	player_init( gmain );
-	player_setcut( opt_cut );
-	player_setrgtype( opt_rgtype );
-	player_setrgpreamp( opt_rgpreamp );
-	player_setgap( opt_gap );
-	player_setrandom( opt_random );
+	history_init();
+	avail_init();
+	prefetch_init();
+	stream_init();
+	for( zone_cur = 0; zone_cur < opt_zones; ++zone_cur ){
+		player_init( gmain );
+		player_setcut( opt_cut );
+		player_setrgtype( opt_rgtype );
+		player_setrgpreamp( opt_rgpreamp );
+		player_setgap( opt_gap );
+		player_setrandom( opt_zone[zone_cur].random );
+	}
+	zone_cur = 0;
 	proto_init();
 
-	load_filter();
-	if( opt_start ){
-		player_start();
+	for( zone_cur = 0; zone_cur < opt_zones; ++zone_cur ){
+		load_filter();
+		if( opt_zone[zone_cur].start ){
+			player_start();
+		}
 	}
+	zone_cur = 0;
 
 	syslog(LOG_INFO, "waiting" );
 
@@ -218,9 +250,16 @@ int main( int argc, char **argv )
 
 	syslog(LOG_INFO, "terminating" );
 
-	save_filter();
-	player_done();
+	for( zone_cur = 0; zone_cur < opt_zones; ++zone_cur ){
+		save_filter();
+		player_done();
+	}
+	zone_cur = 0;
+	stream_done();
+	prefetch_done();
 	clients_done();
+	avail_done();
+	history_done();
 	db_done();
 	lockfile_remove(opt_pidfile);
 	return 0;
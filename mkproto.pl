@@ -23,6 +23,8 @@ sub p_idle { return "p_idle" };
 
 # TODO: cleanup codes
 # TODO: client stuff
+# heavy: searches and full listings - delayed by the client's reply line
+#	budget and rejected on overload
 my @cmds = (
 	{
 		name	=> "quit",
@@ -205,6 +207,42 @@ my @cmds = (
 		cargs	=> [qw( )],
 		cret	=> "sec",
 	},
+	{
+		name	=> "bufstat",
+		code	=> "249",
+		minpriv	=> r_guest,
+		context	=> p_idle,
+		sargs	=> [qw( )],
+		cargs	=> [qw( )],
+		cret	=> "bufstat",
+	},
+	{
+		name	=> "zonelist",
+		code	=> "241",
+		minpriv	=> r_guest,
+		context	=> p_idle,
+		sargs	=> [qw( )],
+		cargs	=> [qw( )],
+		cret	=> "it_zone",
+	},
+	{
+		name	=> "zone",
+		code	=> "246",
+		minpriv	=> r_guest,
+		context	=> p_idle,
+		sargs	=> [qw( )],
+		cargs	=> [qw( )],
+		cret	=> "zone",
+	},
+	{
+		name	=> "zoneset",
+		code	=> "246",
+		minpriv	=> r_guest,
+		context	=> p_idle,
+		sargs	=> [qw( name )],
+		cargs	=> [qw( name )],
+		cret	=> "succ",
+	},
 	{
 		name	=> "jump",
 		code	=> "248",
@@ -360,6 +398,7 @@ my @cmds = (
 		sargs	=> [qw( string )],
 		cargs	=> [qw( string )],
 		cret	=> "it_track",
+		heavy	=> 1,
 	},
 	{
 		name	=> "tracksearchf",
@@ -369,6 +408,7 @@ my @cmds = (
 		sargs	=> [qw( filter )],
 		cargs	=> [qw( filter )],
 		cret	=> "it_track",
+		heavy	=> 1,
 	},
 	{
 		name	=> "tracksalbum",
@@ -445,6 +485,7 @@ my @cmds = (
 		sargs	=> [qw( filter )],
 		cargs	=> [qw( filter )],
 		cret	=> "succ",
+		heavy	=> 1,
 	},
 	{
 		name	=> "filterstat",
@@ -475,6 +516,7 @@ my @cmds = (
 		sargs	=> [qw( num )],
 		cargs	=> [qw( num )],
 		cret	=> "it_history",
+		heavy	=> 1,
 	},
 	# TODO: historysearchf
 	{
@@ -513,9 +555,28 @@ my @cmds = (
 		code	=> "260",
 		minpriv	=> r_user,
 		context	=> p_idle,
+		sargs	=> [qw( idlist )],
+		cargs	=> [qw( idlist )],
+		cret	=> "id",
+	},
+	{
+		name	=> "queueaddalbum",
+		code	=> "266",
+		minpriv	=> r_user,
+		context	=> p_idle,
 		sargs	=> [qw( id )],
 		cargs	=> [qw( id )],
-		cret	=> "id",
+		cret	=> "int",
+	},
+	{
+		name	=> "queueaddfilter",
+		code	=> "267",
+		minpriv	=> r_user,
+		context	=> p_idle,
+		sargs	=> [qw( filter )],
+		cargs	=> [qw( filter )],
+		cret	=> "int",
+		heavy	=> 1,
 	},
 	# TODO: queueinsert
 	# TODO**: queuemove
@@ -670,6 +731,7 @@ my @cmds = (
 		sargs	=> [qw( )],
 		cargs	=> [qw( )],
 		cret	=> "it_album",
+		heavy	=> 1,
 	},
 	{
 		name	=> "albumsartist",
@@ -697,6 +759,7 @@ my @cmds = (
 		sargs	=> [qw( string )],
 		cargs	=> [qw( string )],
 		cret	=> "it_album",
+		heavy	=> 1,
 	},
 	{
 		name	=> "albumget",
@@ -746,6 +809,7 @@ my @cmds = (
 		sargs	=> [qw( )],
 		cargs	=> [qw( )],
 		cret	=> "it_artist",
+		heavy	=> 1,
 	},
 	{
 		name	=> "artistsearch",
@@ -755,6 +819,7 @@ my @cmds = (
 		sargs	=> [qw( string )],
 		cargs	=> [qw( string )],
 		cret	=> "it_artist",
+		heavy	=> 1,
 	},
 	{
 		name	=> "artiststag",
@@ -892,7 +957,7 @@ sub srv_argheadtpl {
 	my $arg = shift;
 
 	print "typedef void * t_arg_$arg;\n";
-	print "#define arg_$arg { \"$arg\", APARSE(val_$arg), /* TPL */ AFREE(NULL) }\n";
+	print "#define arg_$arg { \"$arg\", APARSE(val_$arg) }\n";
 	print "\n";
 }
 
@@ -917,7 +982,8 @@ sub srv_args {
 
 sub srv_cmdlist {
 	my $cmd = shift;
-	print "\t{ \"$cmd->{name}\", \"$cmd->{code}\", $cmd->{minpriv}, $cmd->{context}, cmd_$cmd->{name}, args_$cmd->{name} },\n";
+	my $heavy = $cmd->{heavy} || 0;
+	print "\t{ \"$cmd->{name}\", \"$cmd->{code}\", $cmd->{minpriv}, $cmd->{context}, cmd_$cmd->{name}, args_$cmd->{name}, $heavy },\n";
 }
 
 sub srv_cmdtpl {
@@ -960,6 +1026,68 @@ sub cmdlist {
 	print $cmd->{name}, "\n";
 }
 
+# FNV-1a - has to match proto_hash() in proto.c
+sub cmdhash {
+	my( $name, $seed ) = @_;
+
+	my $h = (2166136261 ^ $seed) & 0xffffffff;
+	foreach my $c ( unpack( "C*", $name ) ){
+		$h = (($h ^ $c) * 16777619) & 0xffffffff;
+	}
+	return $h;
+}
+
+# perfect hash of the command names, "hash and displace":
+# bucket = hash(name,0) % buckets, slot = hash(name,disp[bucket]) % size
+my $hash_buckets = 64;
+my $hash_size = 256;
+
+sub mkhash {
+	my( @bucket, @disp, @slot );
+
+	for( my $i = 0; $i <= $#cmds; ++$i ){
+		push @{$bucket[ &cmdhash( $cmds[$i]{name}, 0 ) % $hash_buckets ]}, $i;
+	}
+
+	@slot = (-1) x $hash_size;
+	@disp = (0) x $hash_buckets;
+
+	# fill the biggest buckets first
+	foreach my $b ( sort { scalar(@{$bucket[$b]||[]}) <=> scalar(@{$bucket[$a]||[]}) }
+			0 .. $hash_buckets -1 ){
+
+		next unless $bucket[$b];
+
+		DISP: for( my $d = 1; ; ++$d ){
+			die "no perfect hash found" if $d > 65535;
+
+			my %used;
+			foreach my $i ( @{$bucket[$b]} ){
+				my $s = &cmdhash( $cmds[$i]{name}, $d ) % $hash_size;
+				next DISP if $slot[$s] >= 0 || $used{$s}++;
+			}
+
+			foreach my $i ( @{$bucket[$b]} ){
+				$slot[ &cmdhash( $cmds[$i]{name}, $d ) % $hash_size ] = $i;
+			}
+			$disp[$b] = $d;
+			last;
+		}
+	}
+
+	return( \@disp, \@slot );
+}
+
+sub maxargs {
+	my $max = 0;
+
+	foreach my $cmd ( @cmds ){
+		my $num = scalar @{$cmd->{sargs}};
+		$max = $num if $num > $max;
+	}
+	return $max;
+}
+
 sub loop {
 	my $fmt = shift;
 
@@ -1006,6 +1134,11 @@ if( $what eq "srv-argheadtpl" ){
 	print "#include \"proto_helper.h\"\n";
 	print "#include \"proto_arg.h\"\n";
 	print "extern t_cmd proto_cmds[];\n";
+	print "#define PROTO_MAXARGS ", &maxargs, "\n";
+	print "#define PROTO_HASHBUCKETS $hash_buckets\n";
+	print "#define PROTO_HASHSIZE $hash_size\n";
+	print "extern const unsigned short proto_cmddisp[];\n";
+	print "extern const short proto_cmdslot[];\n";
 	&loop( \&srv_cmdhead);
 	print "#endif\n";
 
@@ -1021,7 +1154,21 @@ if( $what eq "srv-argheadtpl" ){
 	print "#include \"proto_cmd.h\"\n";
 	print "t_cmd proto_cmds[] = {\n";
 	&loop( \&srv_cmdlist);
-	print "\t{NULL, NULL, 0, 0, NULL, NULL},\n";
+	print "\t{NULL, NULL, 0, 0, NULL, NULL, 0},\n";
+	print "};\n";
+
+	my( $disp, $slot ) = &mkhash;
+	print "const unsigned short proto_cmddisp[] = {\n";
+	for( my $i = 0; $i < @$disp; $i += 8 ){
+		my $e = $i + 7 < $#$disp ? $i + 7 : $#$disp;
+		print "\t", join( ", ", @$disp[$i .. $e] ), ",\n";
+	}
+	print "};\n";
+	print "const short proto_cmdslot[] = {\n";
+	for( my $i = 0; $i < @$slot; $i += 8 ){
+		my $e = $i + 7 < $#$slot ? $i + 7 : $#$slot;
+		print "\t", join( ", ", @$slot[$i .. $e] ), ",\n";
+	}
 	print "};\n";
 
 
@@ -8,6 +8,7 @@
  */
 
 #include <glib.h>
+#include <stdio.h>
 #include <syslog.h>
 
 #include "opt.h"
@@ -21,10 +22,46 @@ int opt_cut = -1;
 double opt_rgpreamp = -1;
 t_replaygain opt_rgtype = rg_none;
 int opt_random = -1;
+char *opt_random_algo = NULL;
+int opt_random_percent = -1;
+int opt_random_max = -1;
+char *opt_random_scoretags = NULL;
+double opt_random_scorebase = -1;
+char *opt_random_shuffle = NULL;
+int opt_queue_fair = -1;
+int opt_sfilter_cache = -1;
+int opt_tag_index = -1;
+int opt_catalog_check = -1;
+int opt_client_maxline = -1;
+int opt_client_cmdrate = -1;
+int opt_client_cmdburst = -1;
+int opt_client_rowrate = -1;
+int opt_client_rowburst = -1;
+int opt_overload_cpu = -1;
+int opt_overload_burst = -1;
 int opt_start = -1;
 char *opt_sfilter = NULL;
 char *opt_failtag = NULL;
 char *opt_pipeline = NULL;
+char *opt_hist_journal = NULL;
+int opt_hist_flush = -1;
+int opt_avail_scan = -1;
+int opt_readahead = -1;
+int opt_prefetch = -1;
+char *opt_seekindex = NULL;
+int opt_rtprio = -1;
+char *opt_rtpolicy = NULL;
+int opt_mlock = -1;
+int opt_sink_buffer = -1;
+int opt_sink_latency = -1;
+int opt_stream_port = -1;
+char *opt_stream_encoder = NULL;
+char *opt_stream_type = NULL;
+int opt_stream_buffer = -1;
+int opt_stream_clients = -1;
+
+int opt_zones = 0;
+t_optzone opt_zone[ZONE_MAX];
 
 char *opt_db_host = NULL;
 char *opt_db_port = NULL;
@@ -32,17 +69,24 @@ char *opt_db_name = NULL;
 char *opt_db_user = NULL;
 char *opt_db_pass = NULL;
 
-static void def_string( char **dst, GKeyFile *kf, char *key, char *def )
+static void grp_string( char **dst, GKeyFile *kf, const char *group,
+		char *key, char *def )
 {
 	char *tmp;
 	GError *err = NULL;
 
 	*dst = def;
-	if( kf && NULL != (tmp = g_key_file_get_string( kf, "dudld", key, &err )))
+	if( kf && NULL != (tmp = g_key_file_get_string( kf, group, key, &err )))
 		*dst = tmp;
 }
 
-static void def_integer( int *dst, GKeyFile *kf, char *key, int def )
+static void def_string( char **dst, GKeyFile *kf, char *key, char *def )
+{
+	grp_string( dst, kf, "dudld", key, def );
+}
+
+static void grp_integer( int *dst, GKeyFile *kf, const char *group,
+		char *key, int def )
 {
 	int tmp;
 	GError *err = NULL;
@@ -51,7 +95,7 @@ static void def_integer( int *dst, GKeyFile *kf, char *key, int def )
 	if( ! kf )
 		return;
 
-	tmp = g_key_file_get_integer( kf, "dudld", key, &err );
+	tmp = g_key_file_get_integer( kf, group, key, &err );
 	if( err && err->code == G_KEY_FILE_ERROR_INVALID_VALUE )
 		syslog( LOG_ERR, "invalid data for %s: %s", key, err->message );
 
@@ -59,6 +103,11 @@ static void def_integer( int *dst, GKeyFile *kf, char *key, int def )
 		*dst = tmp;
 }
 
+static void def_integer( int *dst, GKeyFile *kf, char *key, int def )
+{
+	grp_integer( dst, kf, "dudld", key, def );
+}
+
 static void def_double( double *dst, GKeyFile *kf, char *key, double def )
 {
 	double tmp;
@@ -106,6 +155,54 @@ static void def_replaygain( t_replaygain *dst, GKeyFile *kf, char *key, t_replay
 	}
 }
 
+/*
+ * zone 0 is configured by the global settings. Further zones are listed
+ * in "zones" and take their settings from a [zone <name>] group.
+ */
+static void def_zones( GKeyFile *kf )
+{
+	char **names = NULL;
+	char group[256];
+	t_optzone *z;
+	int i;
+
+	z = &opt_zone[0];
+	def_string( &z->name, kf, "zone", "default" );
+	z->pipeline = opt_pipeline;
+	z->sfilter = opt_sfilter;
+	z->random = opt_random;
+	z->start = opt_start;
+	opt_zones = 1;
+
+	if( kf )
+		names = g_key_file_get_string_list( kf, "dudld", "zones",
+				NULL, NULL );
+	if( ! names )
+		return;
+
+	for( i = 0; names[i]; ++i ){
+		if( ! *g_strstrip(names[i]) )
+			continue;
+
+		if( opt_zones >= ZONE_MAX ){
+			syslog( LOG_ERR, "too many zones, ignoring %s",
+					names[i] );
+			continue;
+		}
+
+		z = &opt_zone[opt_zones++];
+		z->name = g_strdup( names[i] );
+
+		snprintf( group, sizeof(group), "zone %s", names[i] );
+		grp_string( &z->pipeline, kf, group, "pipeline",
+				opt_pipeline );
+		grp_string( &z->sfilter, kf, group, "sfilter", opt_sfilter );
+		grp_integer( &z->random, kf, group, "random", opt_random );
+		grp_integer( &z->start, kf, group, "start", opt_start );
+	}
+	g_strfreev( names );
+}
+
 void opt_read( char *fname )
 {
 	GKeyFile *keyfile;
@@ -124,15 +221,54 @@ void opt_read( char *fname )
 
 	def_integer( &opt_gap, keyfile, "gap", 0 );
 	def_integer( &opt_random, keyfile, "random", 1 );
+	def_string( &opt_random_algo, keyfile, "random_algo", "abs" );
+	def_integer( &opt_random_percent, keyfile, "random_percent", 33 );
+	def_integer( &opt_random_max, keyfile, "random_max", 0 );
+	def_string( &opt_random_scoretags, keyfile, "random_scoretags", "" );
+	def_double( &opt_random_scorebase, keyfile, "random_scorebase", 2 );
+	def_string( &opt_random_shuffle, keyfile, "random_shuffle", "/var/lib/dudld/shuffle" );
+	def_integer( &opt_queue_fair, keyfile, "queue_fair", 0 );
+	def_integer( &opt_sfilter_cache, keyfile, "sfilter_cache", 0 );
+	def_integer( &opt_tag_index, keyfile, "tag_index", 0 );
+	def_integer( &opt_catalog_check, keyfile, "catalog_check", 60 );
+	def_integer( &opt_client_maxline, keyfile, "client_maxline", 10240 );
+	def_integer( &opt_client_cmdrate, keyfile, "client_cmdrate", 20 );
+	def_integer( &opt_client_cmdburst, keyfile, "client_cmdburst", 100 );
+	def_integer( &opt_client_rowrate, keyfile, "client_rowrate", 5000 );
+	def_integer( &opt_client_rowburst, keyfile, "client_rowburst", 50000 );
+	def_integer( &opt_overload_cpu, keyfile, "overload_cpu", 500 );
+	def_integer( &opt_overload_burst, keyfile, "overload_burst", 5000 );
 	def_integer( &opt_cut, keyfile, "cut", 1 );
 	def_double( &opt_rgpreamp, keyfile, "rgpreamp", 7 );
 	def_integer( &opt_start, keyfile, "start", 0 );
 	def_string( &opt_sfilter, keyfile, "sfilter", "init" );
 	def_string( &opt_failtag, keyfile, "failtag", "failed" );
 	def_string( &opt_pipeline, keyfile, "pipeline", "autoaudiosink" );
+	def_integer( &opt_readahead, keyfile, "readahead", 4096 );
+	def_integer( &opt_prefetch, keyfile, "prefetch", 65536 );
+	def_string( &opt_seekindex, keyfile, "seekindex", "/var/cache/dudld/seek" );
+	def_integer( &opt_rtprio, keyfile, "rtprio", 0 );
+	def_string( &opt_rtpolicy, keyfile, "rtpolicy", "fifo" );
+	def_integer( &opt_mlock, keyfile, "mlock", 0 );
+	def_integer( &opt_sink_buffer, keyfile, "sink_buffer", 0 );
+	def_integer( &opt_sink_latency, keyfile, "sink_latency", 0 );
+	def_integer( &opt_stream_port, keyfile, "stream_port", 0 );
+	def_string( &opt_stream_encoder, keyfile, "stream_encoder", "audioconvert ! lame" );
+	def_string( &opt_stream_type, keyfile, "stream_type", "audio/mpeg" );
+	def_integer( &opt_stream_buffer, keyfile, "stream_buffer", 512 );
+	def_integer( &opt_stream_clients, keyfile, "stream_clients", 32 );
+	def_string( &opt_hist_journal, keyfile, "history_journal", "/var/lib/dudld/history" );
+	def_integer( &opt_hist_flush, keyfile, "history_flush", 10 );
+	if( opt_hist_flush < 1 ){
+		syslog( LOG_ERR, "invalid data for history_flush: using 1" );
+		opt_hist_flush = 1;
+	}
+	def_integer( &opt_avail_scan, keyfile, "avail_scan", 3600 );
 
 	def_replaygain( &opt_rgtype, keyfile, "rgtype", 3 );
 
+	def_zones( keyfile );
+
 	def_string( &opt_db_host, keyfile, "db_host", "" );
 	def_string( &opt_db_port, keyfile, "db_port", "" );
 	def_string( &opt_db_name, keyfile, "db_name", "dudl" );
@@ -11,6 +11,16 @@
 #define _OPT_H
 
 #include "commondb/track.h"
+#include "commondb/zone.h"
+
+/* per zone settings - zone 0 gets the global ones */
+typedef struct {
+	char *name;
+	char *pipeline;
+	char *sfilter;
+	int random;
+	int start;
+} t_optzone;
 
 extern int opt_port;
 extern char *opt_pidfile;
@@ -18,6 +28,23 @@ extern char *opt_path_tracks;
 
 extern int opt_gap;
 extern int opt_random;
+extern char *opt_random_algo;
+extern int opt_random_percent;
+extern int opt_random_max;
+extern char *opt_random_scoretags;
+extern double opt_random_scorebase;
+extern char *opt_random_shuffle;
+extern int opt_queue_fair;
+extern int opt_sfilter_cache;
+extern int opt_tag_index;
+extern int opt_catalog_check;
+extern int opt_client_maxline;
+extern int opt_client_cmdrate;
+extern int opt_client_cmdburst;
+extern int opt_client_rowrate;
+extern int opt_client_rowburst;
+extern int opt_overload_cpu;
+extern int opt_overload_burst;
 extern int opt_cut;
 extern t_replaygain opt_rgtype;
 extern double opt_rgpreamp;
@@ -25,6 +52,25 @@ extern int opt_start;
 extern char *opt_sfilter;
 extern char *opt_failtag;
 extern char *opt_pipeline;
+extern char *opt_hist_journal;
+extern int opt_hist_flush;
+extern int opt_avail_scan;
+extern int opt_readahead;
+extern int opt_prefetch;
+extern char *opt_seekindex;
+extern int opt_rtprio;
+extern char *opt_rtpolicy;
+extern int opt_mlock;
+extern int opt_sink_buffer;
+extern int opt_sink_latency;
+extern int opt_stream_port;
+extern char *opt_stream_encoder;
+extern char *opt_stream_type;
+extern int opt_stream_buffer;
+extern int opt_stream_clients;
+
+extern int opt_zones;
+extern t_optzone opt_zone[ZONE_MAX];
 
 extern char *opt_db_host;
 extern char *opt_db_port;
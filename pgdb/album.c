@@ -16,20 +16,41 @@
 #include <config.h>
 #include "album.h"
 #include "artist.h"
+#include "sfcache.h"
 
 
 
 
 
 
+enum {
+	ac_id,
+	ac_name,
+	ac_year,
+	ac_rgain,
+	ac_rgainpeak,
+	ac_max
+};
+
+static const char *album_cols[] = {
+	[ac_id]		= "album_id",
+	[ac_name]	= "album_name",
+	[ac_year]	= "album_publish_year",
+	[ac_rgain]	= "album_rgain",
+	[ac_rgainpeak]	= "album_rgain_peak",
+	[ac_max]	= NULL,
+};
+
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing album data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing album data: %s", album_cols[field] ); \
 		goto gofail; \
 	}
 
-t_album *album_convert( PGresult *res, int tup )
+t_album *album_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_album *t;
 	int f;
 
@@ -41,30 +62,62 @@ t_album *album_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (t = malloc(sizeof(t_album))))
+	if( NULL == (col = db_colmap( r, album_cols )))
+		return NULL;
+
+	if( NULL == (t = arena_alloc( r->arena, sizeof(t_album))))
 		return NULL;
 	memset( t, 0, sizeof(t_album));
 
+	t->_arena = NULL != r->arena;
+
 
-	GETFIELD(f,"album_id", clean1 );
+	GETFIELD(f,ac_id, clean1 );
 	t->id = pgint(res, tup, f );
 
-	GETFIELD(f,"album_name", clean1 );
-	if( NULL == (t->album = pgstring(res, tup, f)))
+	GETFIELD(f,ac_name, clean1 );
+	if( NULL == (t->album = pgastring(r->arena, res, tup, f)))
 		goto clean1;
 
-	GETFIELD(f,"album_publish_year", clean2 );
+	GETFIELD(f,ac_year, clean2 );
 	t->year = pgint(res, tup, f );
 
 	t->rgain = 0;
-	if( -1 != (f = PQfnumber( res, "album_rgain" )))
+	if( -1 != (f = col[ac_rgain]))
 		t->rgain = pgdouble(res, tup, f);
 
 	t->rgainpeak = 0;
-	if( -1 != (f = PQfnumber( res, "album_rgain_peak" )))
+	if( -1 != (f = col[ac_rgainpeak]))
 		t->rgainpeak = pgdouble(res, tup, f);
 
-	if( NULL == (t->artist = artist_convert_album( res, tup )))
+	if( NULL == (t->artist = artist_convert_album( r, tup )))
+		goto clean2;
+
+	return t;
+
+clean2:
+	arena_free(r->arena, t->album);
+
+clean1:
+	arena_free(r->arena, t);
+
+	return NULL;
+}
+
+t_album *album_dup( t_album *in )
+{
+	t_album *t;
+
+	if( NULL == (t = malloc(sizeof(t_album))))
+		return NULL;
+
+	*t = *in;
+	t->_arena = 0;
+
+	if( NULL == (t->album = strdup(in->album)))
+		goto clean1;
+
+	if( NULL == (t->artist = artist_dup(in->artist)))
 		goto clean2;
 
 	return t;
@@ -83,6 +136,9 @@ void album_free( t_album *t )
 	if( ! t )
 		return;
 
+	if( t->_arena )
+		return;
+
 	artist_free( t->artist );
 	free( t->album );
 	free( t );
@@ -108,6 +164,8 @@ int album_setname( int albumid, const char *name )
 
 	PQclear(res);
 
+	sfcache_invalidate();
+
 	return 0;
 }
 
@@ -125,6 +183,8 @@ int album_setartist( int albumid, int artistid )
 
 	PQclear(res);
 
+	sfcache_invalidate();
+
 	return 0;
 }
 
@@ -142,6 +202,8 @@ int album_setyear( int albumid, int year )
 
 	PQclear(res);
 
+	sfcache_invalidate();
+
 	return 0;
 }
 
@@ -157,7 +219,7 @@ t_album *album_get( int id )
 		return NULL;
 	}
 
-	t = album_convert( res, 0 );
+	t = album_convert( DBRES(res), 0 );
 	PQclear( res );
 
 	return t;
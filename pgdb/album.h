@@ -13,6 +13,7 @@
 #include <commondb/album.h>
 #include "dudldb.h"
 
-t_album *album_convert( PGresult *res, int tup );
+t_album *album_convert( t_dbres *r, int tup );
+t_album *album_dup( t_album *in );
 
 #endif
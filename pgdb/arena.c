@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+#include "arena.h"
+
+/* first chunk is small, following chunks double up to ARENA_CHUNKMAX */
+#define ARENA_CHUNKMIN	4096
+#define ARENA_CHUNKMAX	(1024*1024)
+
+/* alignment suitable for the row structs (doubles, 64bit ints, pointers) */
+#define ARENA_ALIGN	(2*sizeof(void*))
+#define ARENA_ROUND(x)	(((x) + ARENA_ALIGN -1) & ~(ARENA_ALIGN -1))
+
+typedef struct _t_arena_chunk {
+	struct _t_arena_chunk *next;
+	size_t size;
+	size_t used;
+} t_arena_chunk;
+
+#define CHUNK_HEAD	ARENA_ROUND(sizeof(t_arena_chunk))
+#define CHUNK_DATA(c)	((char*)(c) + CHUNK_HEAD)
+
+typedef struct _t_arena_clean {
+	struct _t_arena_clean *next;
+	t_arena_cleanup func;
+	void *data;
+} t_arena_clean;
+
+struct _t_arena {
+	t_arena_chunk *chunk;
+	t_arena_clean *clean;
+	size_t next;
+};
+
+t_arena *arena_new( void )
+{
+	t_arena *a;
+
+	if( NULL == (a = malloc(sizeof(t_arena))))
+		return NULL;
+
+	a->chunk = NULL;
+	a->clean = NULL;
+	a->next = ARENA_CHUNKMIN;
+
+	return a;
+}
+
+void arena_done( t_arena *a )
+{
+	t_arena_chunk *c, *n;
+	t_arena_clean *l;
+
+	if( ! a )
+		return;
+
+	for( l = a->clean; l; l = l->next )
+		(*l->func)( l->data );
+
+	for( c = a->chunk; c; c = n ){
+		n = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+static t_arena_chunk *arena_grow( t_arena *a, size_t len )
+{
+	t_arena_chunk *c;
+	size_t size = a->next;
+
+	if( size < len )
+		size = len;
+
+	if( NULL == (c = malloc( CHUNK_HEAD + size )))
+		return NULL;
+
+	c->size = size;
+	c->used = 0;
+
+	/* oversized requests get a chunk of their own - keep the current
+	 * chunk in front to use its remaining space */
+	if( len > a->next && a->chunk ){
+		c->next = a->chunk->next;
+		a->chunk->next = c;
+		return c;
+	}
+
+	c->next = a->chunk;
+	a->chunk = c;
+
+	if( a->next < ARENA_CHUNKMAX )
+		a->next *= 2;
+
+	return c;
+}
+
+void *arena_alloc( t_arena *a, size_t len )
+{
+	t_arena_chunk *c;
+	void *p;
+
+	if( ! a )
+		return malloc(len);
+
+	len = ARENA_ROUND(len);
+	c = a->chunk;
+	if( ! c || c->size - c->used < len ){
+		if( NULL == (c = arena_grow( a, len )))
+			return NULL;
+	}
+
+	p = CHUNK_DATA(c) + c->used;
+	c->used += len;
+
+	return p;
+}
+
+char *arena_strdup( t_arena *a, const char *in )
+{
+	size_t len;
+	char *s;
+
+	if( ! a )
+		return strdup(in);
+
+	len = strlen(in) +1;
+	if( NULL == (s = arena_alloc( a, len )))
+		return NULL;
+
+	memcpy( s, in, len );
+	return s;
+}
+
+void arena_free( t_arena *a, void *p )
+{
+	if( ! a )
+		free(p);
+}
+
+int arena_cleanup( t_arena *a, t_arena_cleanup func, void *data )
+{
+	t_arena_clean *l;
+
+	if( ! a )
+		return 0;
+
+	if( NULL == (l = arena_alloc( a, sizeof(t_arena_clean))))
+		return -1;
+
+	l->func = func;
+	l->data = data;
+	l->next = a->clean;
+	a->clean = l;
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PGDB_ARENA_H
+#define _PGDB_ARENA_H
+
+#include <stdlib.h>
+
+/*
+ * bump allocator for the rows converted from a single query result.
+ *
+ * Memory is handed out from large chunks and released all at once by
+ * arena_done(). There is no way to free a single allocation.
+ *
+ * All functions accept a NULL arena and fall back to plain
+ * malloc()/free() in that case. This allows the converters to serve both
+ * iterators (arena) and single row lookups (heap).
+ */
+
+typedef struct _t_arena t_arena;
+
+t_arena *arena_new( void );
+void arena_done( t_arena *a );
+
+void *arena_alloc( t_arena *a, size_t len );
+char *arena_strdup( t_arena *a, const char *in );
+
+/* free() p unless it was allocated from an arena */
+void arena_free( t_arena *a, void *p );
+
+/* run func(data) in arena_done(). Used for heap references (users, ...)
+ * held by arena rows. Does nothing without an arena - the caller keeps
+ * ownership in that case. */
+typedef void (*t_arena_cleanup)( void *data );
+int arena_cleanup( t_arena *a, t_arena_cleanup func, void *data );
+
+#endif
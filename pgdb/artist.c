@@ -15,34 +15,40 @@
 
 #include <config.h>
 #include "artist.h"
+#include "sfcache.h"
 
 
 
-typedef struct _t_artist_col {
-	char	*id;
-	char	*artist;
-} t_artist_col;
+enum {
+	ac_id,
+	ac_artist,
+	ac_max
+};
 
-static t_artist_col title_col = {
-	.id = "artist_id",
-	.artist = "artist_name",
+static const char *title_cols[] = {
+	[ac_id]		= "artist_id",
+	[ac_artist]	= "artist_name",
+	[ac_max]	= NULL,
 };
 
-static t_artist_col album_col = {
-	.id = "album_artist_id",
-	.artist = "album_artist_name",
+static const char *album_cols[] = {
+	[ac_id]		= "album_artist_id",
+	[ac_artist]	= "album_artist_name",
+	[ac_max]	= NULL,
 };
 
 
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing artist data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing artist data: %s", names[field] ); \
 		goto gofail; \
 	}
 
 
-static t_artist *artist_convert( PGresult *res, int tup, t_artist_col *col )
+static t_artist *artist_convert( t_dbres *r, int tup, const char **names )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_artist *t;
 	int f;
 
@@ -54,34 +60,57 @@ static t_artist *artist_convert( PGresult *res, int tup, t_artist_col *col )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (t = malloc(sizeof(t_artist))))
+	if( NULL == (col = db_colmap( r, names )))
+		return NULL;
+
+	if( NULL == (t = arena_alloc( r->arena, sizeof(t_artist))))
 		return NULL;
 	memset( t, 0, sizeof(t_artist));
 
+	t->_arena = NULL != r->arena;
+
 
-	GETFIELD(f, col->id, clean1 );
+	GETFIELD(f, ac_id, clean1 );
 	t->id = pgint(res, tup, f );
 
-	GETFIELD(f, col->artist, clean1 );
-	if( NULL == (t->artist = pgstring(res, tup, f)))
+	GETFIELD(f, ac_artist, clean1 );
+	if( NULL == (t->artist = pgastring(r->arena, res, tup, f)))
 		goto clean1;
 
 	return t;
 
 clean1:
-	free(t);
+	arena_free(r->arena, t);
 
 	return NULL;
 }
 
-t_artist *artist_convert_title( PGresult *res, int tup )
+t_artist *artist_convert_title( t_dbres *r, int tup )
 {
-	return artist_convert( res, tup, &title_col );
+	return artist_convert( r, tup, title_cols );
 }
 
-t_artist *artist_convert_album( PGresult *res, int tup )
+t_artist *artist_convert_album( t_dbres *r, int tup )
 {
-	return artist_convert( res, tup, &album_col );
+	return artist_convert( r, tup, album_cols );
+}
+
+t_artist *artist_dup( t_artist *in )
+{
+	t_artist *t;
+
+	if( NULL == (t = malloc(sizeof(t_artist))))
+		return NULL;
+
+	*t = *in;
+	t->_arena = 0;
+
+	if( NULL == (t->artist = strdup(in->artist))){
+		free(t);
+		return NULL;
+	}
+
+	return t;
 }
 
 void artist_free( t_artist *t )
@@ -89,6 +118,9 @@ void artist_free( t_artist *t )
 	if( ! t )
 		return;
 
+	if( t->_arena )
+		return;
+
 	free( t->artist );
 	free( t );
 }
@@ -113,6 +145,8 @@ int artist_setname( int artistid, const char *name )
 
 	PQclear(res);
 
+	sfcache_invalidate();
+
 	return 0;
 }
 
@@ -149,6 +183,8 @@ int artist_merge( int fromid, int toid )
 		goto clean2;
 
 
+	sfcache_invalidate();
+
 	return 0;
 
 clean1:
@@ -177,7 +213,7 @@ t_artist *artist_get( int id )
 		return NULL;
 	}
 
-	t = artist_convert( res, 0, &title_col );
+	t = artist_convert( DBRES(res), 0, title_cols );
 	PQclear( res );
 
 	return t;
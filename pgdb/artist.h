@@ -13,7 +13,8 @@
 #include <commondb/artist.h>
 #include "dudldb.h"
 
-t_artist *artist_convert_title( PGresult *res, int tup );
-t_artist *artist_convert_album( PGresult *res, int tup );
+t_artist *artist_convert_title( t_dbres *r, int tup );
+t_artist *artist_convert_album( t_dbres *r, int tup );
+t_artist *artist_dup( t_artist *in );
 
 #endif
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <config.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include <opt.h>
+#include <commondb/avail.h>
+#include "dudldb.h"
+
+/************************************************************
+ * availability scanner
+ *
+ * Opening a file on a stale network mount blocks for ages. So this is
+ * done by a thread in the background: it periodically tries to open
+ * all tracks and keeps a bitmap of the unavailable ones. Unavailable
+ * tracks are flagged in the DB in batches.
+ *
+ * The track directories are watched with inotify (if supported) to
+ * rescan early, when files appear or vanish. Network filesystems
+ * usually don't report remote changes, so we still need the periodic
+ * scans.
+ */
+
+/* max number of ids to flag with one UPDATE */
+#define AVAIL_BATCH	256
+
+/* ms to wait for inotify events to settle before rescanning */
+#define AVAIL_SETTLE	2000
+
+#define AVAIL_INOTIFY	( IN_CREATE | IN_DELETE | IN_MOVED_FROM \
+		| IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF )
+
+static GMutex *alock = NULL;
+static GThread *athread = NULL;
+static int astop[2] = { -1, -1 };
+
+/* bitmap of unavailable tracks, indexed by id. protected by alock */
+static guint32 *unavail = NULL;
+static int unavail_words = 0;
+
+/* only used by scanner thread */
+static PGconn *acon = NULL;
+static int ifd = -1;
+
+static int avail_set( int id, int bad )
+{
+	guint32 *tmp;
+	int word = id / 32;
+	int size;
+	int was;
+
+	g_mutex_lock(alock);
+	if( word >= unavail_words ){
+		if( ! bad ){
+			g_mutex_unlock(alock);
+			return 0;
+		}
+
+		size = word + 1024;
+		if( NULL == (tmp = realloc(unavail, size * sizeof(guint32)))){
+			g_mutex_unlock(alock);
+			syslog( LOG_ERR, "avail: out of memory" );
+			return 0;
+		}
+		memset( tmp + unavail_words, 0,
+				(size - unavail_words) * sizeof(guint32));
+		unavail = tmp;
+		unavail_words = size;
+	}
+
+	was = 0 != (unavail[word] & (1U << (id % 32)));
+	if( bad )
+		unavail[word] |= 1U << (id % 32);
+	else
+		unavail[word] &= ~(1U << (id % 32));
+	g_mutex_unlock(alock);
+
+	return was;
+}
+
+static int avail_connect( void )
+{
+	if( acon && PQstatus(acon) == CONNECTION_OK )
+		return 0;
+
+	if( acon )
+		PQfinish(acon);
+
+	acon = db_newconn();
+	if( ! acon || PQstatus(acon) != CONNECTION_OK ){
+		syslog( LOG_ERR, "avail: connect failed: %s",
+				PQerrorMessage(acon) );
+		PQfinish(acon);
+		acon = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* flag a batch of tracks as unavailable in the DB */
+static void avail_flag( const int *ids, int num )
+{
+	char buf[AVAIL_BATCH * 12 + 128];
+	PGresult *res;
+	int len;
+	int i;
+
+	if( num < 1 )
+		return;
+
+	len = sprintf( buf, "UPDATE stor_file SET available = false "
+			"WHERE id IN(" );
+	for( i = 0; i < num; ++i )
+		len += sprintf( buf + len, "%s%d", i ? "," : "", ids[i] );
+	sprintf( buf + len, ")" );
+
+	res = PQexec( acon, buf );
+	if( ! res || PQresultStatus(res) != PGRES_COMMAND_OK )
+		syslog( LOG_ERR, "avail: %s", PQerrorMessage(acon) );
+	PQclear(res);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void avail_watch( const char *path )
+{
+	char dir[MAXPATHLEN];
+	char *e;
+
+	if( ifd < 0 )
+		return;
+
+	strncpy( dir, path, MAXPATHLEN );
+	dir[MAXPATHLEN-1] = 0;
+	if( NULL == (e = strrchr( dir, '/' )))
+		return;
+	*e = 0;
+
+	/* re-adding an existing watch is cheap */
+	if( 0 <= inotify_add_watch( ifd, dir, AVAIL_INOTIFY ))
+		return;
+
+	/* missing directories are what we're looking for */
+	if( errno != ENOSPC && errno != ENOMEM ){
+		syslog( LOG_DEBUG, "avail: cannot watch %s: %m", dir );
+		return;
+	}
+
+	syslog( LOG_NOTICE, "avail: cannot watch %s: %m - "
+			"relying on periodic scans", dir );
+	close( ifd );
+	ifd = -1;
+}
+#else
+#define avail_watch(path)
+#endif
+
+static int avail_stopped( void )
+{
+	struct pollfd pfd = {
+		.fd = astop[0],
+		.events = POLLIN,
+	};
+
+	return 0 < poll( &pfd, 1, 0 );
+}
+
+static void avail_scan( void )
+{
+	char path[MAXPATHLEN];
+	char lastdir[MAXPATHLEN];
+	int bad[AVAIL_BATCH];
+	PGresult *res;
+	int nbad = 0;
+	int total = 0;
+	int num;
+	int i;
+	int fd;
+	char *fname;
+	char *e;
+
+	if( avail_connect() )
+		return;
+
+	/* ordered by filename to get one directory after the other */
+	res = PQexec( acon, "SELECT id, filename "
+			"FROM mserv_track "
+			"ORDER BY filename" );
+	if( ! res || PQresultStatus(res) != PGRES_TUPLES_OK ){
+		syslog( LOG_ERR, "avail: %s", PQerrorMessage(acon) );
+		PQclear(res);
+		return;
+	}
+
+	*lastdir = 0;
+	num = PQntuples(res);
+	for( i = 0; i < num && ! avail_stopped(); ++i ){
+		fname = PQgetvalue(res, i, 1);
+		snprintf( path, MAXPATHLEN, "%s/%s", opt_path_tracks, fname );
+
+		if( NULL != (e = strrchr( fname, '/' ))
+			&& ( (size_t)(e - fname) != strlen(lastdir)
+				|| strncmp( lastdir, fname, e - fname ))){
+
+			snprintf( lastdir, MAXPATHLEN, "%.*s",
+					(int)(e - fname), fname );
+			avail_watch( path );
+		}
+
+		if( 0 <= (fd = open( path, O_RDONLY ))){
+			close( fd );
+			avail_set( pgint(res, i, 0), 0 );
+			continue;
+		}
+
+		total++;
+
+		/* already flagged by a previous scan */
+		if( avail_set( pgint(res, i, 0), 1 ))
+			continue;
+
+		syslog( LOG_NOTICE, "track is unavailable: %d, %s",
+				pgint(res, i, 0), path );
+
+		bad[nbad++] = pgint(res, i, 0);
+		if( nbad == AVAIL_BATCH ){
+			avail_flag( bad, nbad );
+			nbad = 0;
+		}
+	}
+	avail_flag( bad, nbad );
+	PQclear(res);
+
+	syslog( LOG_DEBUG, "avail: checked %d tracks, %d unavailable",
+			i, total );
+}
+
+/*
+ * wait for next scan. returns 1 when asked to stop
+ */
+static int avail_wait( void )
+{
+	struct pollfd pfd[2];
+	char buf[4096];
+	int timeout = opt_avail_scan * 1000;
+	int n;
+
+	pfd[0].fd = astop[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ifd;
+	pfd[1].events = POLLIN;
+
+	while( 1 ){
+		pfd[0].revents = pfd[1].revents = 0;
+
+		n = poll( pfd, ifd < 0 ? 1 : 2, timeout );
+		if( n < 0 ){
+			if( errno == EINTR )
+				continue;
+
+			syslog( LOG_ERR, "avail: poll: %m" );
+			return 1;
+		}
+
+		if( n == 0 )
+			return 0;
+
+		if( pfd[0].revents )
+			return 1;
+
+		/* something changed - rescan, once it's quiet */
+		if( pfd[1].revents ){
+			if( 0 > read( ifd, buf, sizeof(buf) )
+				&& errno != EINTR && errno != EAGAIN ){
+
+				close( ifd );
+				ifd = -1;
+			}
+			timeout = AVAIL_SETTLE;
+		}
+	}
+}
+
+static gpointer avail_scanner( gpointer data )
+{
+	(void)data;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if( 0 > (ifd = inotify_init()))
+		syslog( LOG_NOTICE, "avail: inotify unavailable: %m" );
+#endif
+
+	do {
+		avail_scan();
+	} while( ! avail_wait() );
+
+	if( ifd >= 0 )
+		close( ifd );
+	ifd = -1;
+
+	if( acon )
+		PQfinish(acon);
+	acon = NULL;
+
+	return NULL;
+}
+
+int avail_init( void )
+{
+	GError *err = NULL;
+
+	if( opt_avail_scan <= 0 )
+		return 0;
+
+	if( pipe( astop ) ){
+		syslog( LOG_ERR, "avail: pipe: %m" );
+		goto clean1;
+	}
+
+	alock = g_mutex_new();
+
+	if( NULL == (athread = g_thread_create( avail_scanner, NULL,
+			TRUE, &err ))){
+
+		syslog( LOG_ERR, "cannot start availability scanner: %s",
+				err->message );
+		g_error_free(err);
+		goto clean2;
+	}
+
+	return 0;
+
+clean2:
+	g_mutex_free(alock);
+	alock = NULL;
+	close( astop[0] );
+	close( astop[1] );
+	astop[0] = astop[1] = -1;
+clean1:
+	syslog( LOG_NOTICE, "checking track availability before playing" );
+	return -1;
+}
+
+void avail_done( void )
+{
+	if( ! athread )
+		return;
+
+	if( 1 != write( astop[1], "", 1 ))
+		syslog( LOG_ERR, "avail: cannot stop scanner: %m" );
+
+	g_thread_join(athread);
+	athread = NULL;
+
+	close( astop[0] );
+	close( astop[1] );
+	astop[0] = astop[1] = -1;
+
+	g_mutex_free(alock);
+	alock = NULL;
+	free( unavail );
+	unavail = NULL;
+	unavail_words = 0;
+}
+
+int avail_track( int id )
+{
+	int r = 1;
+
+	if( ! athread )
+		return -1;
+
+	g_mutex_lock(alock);
+	if( id / 32 < unavail_words
+		&& (unavail[id / 32] & (1U << (id % 32))))
+		r = 0;
+	g_mutex_unlock(alock);
+
+	return r;
+}
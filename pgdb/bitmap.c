@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <config.h>
+#include "bitmap.h"
+
+#define KEY(id)		((unsigned int)(id) >> 16)
+#define LOW(id)		((unsigned int)(id) & 0xffff)
+#define BIT(low)	((guint64)1 << ((low) & 63))
+
+t_bitmap *bitmap_new( void )
+{
+	t_bitmap *b;
+
+	if( NULL == (b = malloc(sizeof(t_bitmap))))
+		return NULL;
+
+	memset( b, 0, sizeof(t_bitmap));
+	return b;
+}
+
+static void chunk_clear( t_bmchunk *c )
+{
+	free( c->array );
+	free( c->words );
+}
+
+void bitmap_free( t_bitmap *b )
+{
+	int i;
+
+	if( ! b )
+		return;
+
+	for( i = 0; i < b->chunks; ++i )
+		chunk_clear( &b->chunk[i] );
+	free( b->chunk );
+	free( b );
+}
+
+/* index of chunk or -(insert position) - 1 */
+static int chunk_find( t_bitmap *b, unsigned int key )
+{
+	int lo = 0;
+	int hi = b->chunks;
+	int mid;
+
+	while( lo < hi ){
+		mid = (lo + hi) / 2;
+		if( b->chunk[mid].key < key )
+			lo = mid + 1;
+		else if( b->chunk[mid].key > key )
+			hi = mid;
+		else
+			return mid;
+	}
+
+	return -lo - 1;
+}
+
+/* same for a position in the chunk's array */
+static int array_find( t_bmchunk *c, unsigned int low )
+{
+	int lo = 0;
+	int hi = c->num;
+	int mid;
+
+	while( lo < hi ){
+		mid = (lo + hi) / 2;
+		if( c->array[mid] < low )
+			lo = mid + 1;
+		else if( c->array[mid] > low )
+			hi = mid;
+		else
+			return mid;
+	}
+
+	return -lo - 1;
+}
+
+static int chunk_tobits( t_bmchunk *c )
+{
+	int i;
+
+	if( NULL == (c->words = calloc( BITMAP_WORDS, sizeof(guint64))))
+		return -1;
+
+	for( i = 0; i < c->num; ++i )
+		c->words[c->array[i] >> 6] |= BIT(c->array[i]);
+
+	free( c->array );
+	c->array = NULL;
+	c->size = 0;
+	return 0;
+}
+
+static int chunk_toarray( t_bmchunk *c )
+{
+	unsigned int low;
+	int n = 0;
+
+	if( NULL == (c->array = malloc( c->num * sizeof(unsigned short))))
+		return -1;
+
+	for( low = 0; low < 65536; ++low )
+		if( c->words[low >> 6] & BIT(low) )
+			c->array[n++] = low;
+
+	free( c->words );
+	c->words = NULL;
+	c->size = c->num;
+	return 0;
+}
+
+int bitmap_add( t_bitmap *b, int id )
+{
+	t_bmchunk *c;
+	t_bmchunk *tmp;
+	unsigned short *atmp;
+	unsigned int low = LOW(id);
+	int i;
+	int pos;
+
+	if( 0 > (i = chunk_find( b, KEY(id) ))){
+		i = -i - 1;
+		if( NULL == (tmp = realloc( b->chunk,
+				(b->chunks + 1) * sizeof(t_bmchunk))))
+			return -1;
+
+		b->chunk = tmp;
+		memmove( b->chunk + i + 1, b->chunk + i,
+				(b->chunks - i) * sizeof(t_bmchunk));
+		++b->chunks;
+
+		memset( &b->chunk[i], 0, sizeof(t_bmchunk));
+		b->chunk[i].key = KEY(id);
+	}
+	c = &b->chunk[i];
+
+	if( c->words ){
+		if( c->words[low >> 6] & BIT(low) )
+			return 0;
+
+		c->words[low >> 6] |= BIT(low);
+
+	} else {
+		if( 0 <= (pos = array_find( c, low )))
+			return 0;
+		pos = -pos - 1;
+
+		if( c->num >= BITMAP_ARRAYMAX ){
+			if( chunk_tobits( c ))
+				return -1;
+			c->words[low >> 6] |= BIT(low);
+
+		} else {
+			if( c->num >= c->size ){
+				if( NULL == (atmp = realloc( c->array,
+						(c->size * 2 + 4)
+						* sizeof(unsigned short))))
+					return -1;
+				c->array = atmp;
+				c->size = c->size * 2 + 4;
+			}
+
+			memmove( c->array + pos + 1, c->array + pos,
+				(c->num - pos) * sizeof(unsigned short));
+			c->array[pos] = low;
+		}
+	}
+
+	++c->num;
+	++b->num;
+	return 1;
+}
+
+int bitmap_del( t_bitmap *b, int id )
+{
+	t_bmchunk *c;
+	unsigned int low = LOW(id);
+	int i;
+	int pos;
+
+	if( 0 > (i = chunk_find( b, KEY(id) )))
+		return 0;
+	c = &b->chunk[i];
+
+	if( c->words ){
+		if( ! (c->words[low >> 6] & BIT(low)) )
+			return 0;
+
+		c->words[low >> 6] &= ~BIT(low);
+		--c->num;
+
+		/* keep it a bitset while it hovers around the limit */
+		if( c->num < BITMAP_ARRAYMAX / 2 && chunk_toarray( c ))
+			return -1;
+
+	} else {
+		if( 0 > (pos = array_find( c, low )))
+			return 0;
+
+		--c->num;
+		memmove( c->array + pos, c->array + pos + 1,
+				(c->num - pos) * sizeof(unsigned short));
+	}
+	--b->num;
+
+	if( ! c->num ){
+		chunk_clear( c );
+		--b->chunks;
+		memmove( b->chunk + i, b->chunk + i + 1,
+				(b->chunks - i) * sizeof(t_bmchunk));
+	}
+
+	return 1;
+}
+
+int bitmap_has( t_bitmap *b, int id )
+{
+	t_bmchunk *c;
+	unsigned int low = LOW(id);
+	int i;
+
+	if( 0 > (i = chunk_find( b, KEY(id) )))
+		return 0;
+	c = &b->chunk[i];
+
+	if( c->words )
+		return 0 != (c->words[low >> 6] & BIT(low));
+
+	return 0 <= array_find( c, low );
+}
+
+int *bitmap_ids( t_bitmap *b, int *num )
+{
+	t_bmchunk *c;
+	unsigned int low;
+	int *ids;
+	int n = 0;
+	int i;
+	int j;
+
+	if( NULL == (ids = malloc( (b->num + 1) * sizeof(int))))
+		return NULL;
+
+	for( i = 0; i < b->chunks; ++i ){
+		c = &b->chunk[i];
+
+		if( c->words ){
+			for( low = 0; low < 65536; ++low )
+				if( c->words[low >> 6] & BIT(low) )
+					ids[n++] = (c->key << 16) | low;
+		} else {
+			for( j = 0; j < c->num; ++j )
+				ids[n++] = (c->key << 16) | c->array[j];
+		}
+	}
+
+	*num = n;
+	return ids;
+}
+
+char *bitmap_fmt( t_bitmap *b )
+{
+	char *buf;
+	char *p;
+	int *ids;
+	int num;
+	int i;
+
+	if( NULL == (ids = bitmap_ids( b, &num )))
+		return NULL;
+
+	if( NULL == (buf = malloc( num * 12 + 1 ))){
+		free( ids );
+		return NULL;
+	}
+
+	*buf = 0;
+	for( p = buf, i = 0; i < num; ++i )
+		p += sprintf( p, i ? ",%d" : "%d", ids[i] );
+
+	free( ids );
+	return buf;
+}
+
+/************************************************************
+ * set operations
+ *
+ * Arrays are merged, anything involving a bitset is done on 64bit
+ * words. The word loops are kept simple enough for the compiler to
+ * vectorize them.
+ */
+
+typedef enum {
+	bo_and,
+	bo_or,
+	bo_andnot,
+} t_bmop;
+
+static int chunk_copy( t_bmchunk *dst, t_bmchunk *src )
+{
+	*dst = *src;
+	dst->array = NULL;
+	dst->words = NULL;
+
+	if( src->words ){
+		if( NULL == (dst->words = malloc( BITMAP_WORDS
+				* sizeof(guint64))))
+			return -1;
+		memcpy( dst->words, src->words, BITMAP_WORDS * sizeof(guint64));
+
+	} else {
+		dst->size = src->num;
+		if( NULL == (dst->array = malloc( (src->num + 1)
+				* sizeof(unsigned short))))
+			return -1;
+		memcpy( dst->array, src->array,
+				src->num * sizeof(unsigned short));
+	}
+
+	return 0;
+}
+
+/* bits of c, w must be zeroed */
+static void chunk_words( t_bmchunk *c, guint64 *w )
+{
+	int i;
+
+	for( i = 0; i < c->num; ++i )
+		w[c->array[i] >> 6] |= BIT(c->array[i]);
+}
+
+/* fill c from words - as array when it's sparse */
+static int chunk_fromwords( t_bmchunk *c, guint64 *w )
+{
+	int num = 0;
+	int i;
+
+	for( i = 0; i < BITMAP_WORDS; ++i )
+		num += __builtin_popcountll( w[i] );
+
+	c->num = num;
+	c->size = 0;
+	c->array = NULL;
+	c->words = NULL;
+	if( ! num )
+		return 0;
+
+	if( num > BITMAP_ARRAYMAX ){
+		if( NULL == (c->words = malloc( BITMAP_WORDS
+				* sizeof(guint64))))
+			return -1;
+		memcpy( c->words, w, BITMAP_WORDS * sizeof(guint64));
+		return 0;
+	}
+
+	if( NULL == (c->array = malloc( num * sizeof(unsigned short))))
+		return -1;
+	c->size = num;
+
+	num = 0;
+	for( i = 0; i < BITMAP_WORDS; ++i ){
+		guint64 x = w[i];
+
+		while( x ){
+			c->array[num++] = i * 64 + __builtin_ctzll( x );
+			x &= x - 1;
+		}
+	}
+
+	return 0;
+}
+
+/* both are arrays */
+static int chunk_merge( t_bmchunk *c, t_bmchunk *a, t_bmchunk *b,
+		t_bmop op, guint64 *w )
+{
+	unsigned short *out;
+	int i = 0;
+	int j = 0;
+	int n = 0;
+
+	if( NULL == (out = malloc( (a->num + b->num + 1)
+			* sizeof(unsigned short))))
+		return -1;
+
+	while( i < a->num && j < b->num ){
+		if( a->array[i] < b->array[j] ){
+			if( op != bo_and )
+				out[n++] = a->array[i];
+			++i;
+		} else if( a->array[i] > b->array[j] ){
+			if( op == bo_or )
+				out[n++] = b->array[j];
+			++j;
+		} else {
+			if( op != bo_andnot )
+				out[n++] = a->array[i];
+			++i;
+			++j;
+		}
+	}
+	if( op != bo_and )
+		while( i < a->num )
+			out[n++] = a->array[i++];
+	if( op == bo_or )
+		while( j < b->num )
+			out[n++] = b->array[j++];
+
+	c->key = a->key;
+	c->num = n;
+	c->size = n;
+	c->array = out;
+	c->words = NULL;
+
+	if( n > BITMAP_ARRAYMAX ){
+		memset( w, 0, BITMAP_WORDS * sizeof(guint64));
+		chunk_words( c, w );
+		free( out );
+		return chunk_fromwords( c, w );
+	}
+
+	return 0;
+}
+
+static int chunk_op( t_bmchunk *c, t_bmchunk *a, t_bmchunk *b,
+		t_bmop op, guint64 *w, guint64 *wb )
+{
+	guint64 *x;
+	guint64 *y;
+	int i;
+
+	if( ! a->words && ! b->words )
+		return chunk_merge( c, a, b, op, w );
+
+	if( a->words ){
+		x = a->words;
+	} else {
+		memset( wb, 0, BITMAP_WORDS * sizeof(guint64));
+		chunk_words( a, wb );
+		x = wb;
+	}
+
+	if( b->words ){
+		y = b->words;
+	} else {
+		memset( w, 0, BITMAP_WORDS * sizeof(guint64));
+		chunk_words( b, w );
+		y = w;
+	}
+
+	switch( op ){
+	  case bo_and:
+		for( i = 0; i < BITMAP_WORDS; ++i )
+			w[i] = x[i] & y[i];
+		break;
+
+	  case bo_or:
+		for( i = 0; i < BITMAP_WORDS; ++i )
+			w[i] = x[i] | y[i];
+		break;
+
+	  case bo_andnot:
+		for( i = 0; i < BITMAP_WORDS; ++i )
+			w[i] = x[i] & ~y[i];
+		break;
+	}
+
+	c->key = a->key;
+	return chunk_fromwords( c, w );
+}
+
+/* append chunk, takes ownership of its data */
+static int bitmap_append( t_bitmap *r, t_bmchunk *c )
+{
+	t_bmchunk *tmp;
+
+	if( ! c->num ){
+		chunk_clear( c );
+		return 0;
+	}
+
+	if( NULL == (tmp = realloc( r->chunk, (r->chunks + 1)
+			* sizeof(t_bmchunk)))){
+		chunk_clear( c );
+		return -1;
+	}
+
+	r->chunk = tmp;
+	r->chunk[r->chunks++] = *c;
+	r->num += c->num;
+	return 0;
+}
+
+static t_bitmap *bitmap_op( t_bitmap *a, t_bitmap *b, t_bmop op )
+{
+	guint64 w[BITMAP_WORDS];
+	guint64 wb[BITMAP_WORDS];
+	t_bitmap *r;
+	t_bmchunk c;
+	int i = 0;
+	int j = 0;
+
+	if( NULL == (r = bitmap_new()))
+		return NULL;
+
+	while( i < a->chunks || j < b->chunks ){
+		/* chunk only in a */
+		if( j >= b->chunks || ( i < a->chunks
+				&& a->chunk[i].key < b->chunk[j].key )){
+
+			if( op != bo_and && ( chunk_copy( &c, &a->chunk[i] )
+					|| bitmap_append( r, &c )))
+				goto clean1;
+			++i;
+
+		/* only in b */
+		} else if( i >= a->chunks
+				|| a->chunk[i].key > b->chunk[j].key ){
+
+			if( op == bo_or && ( chunk_copy( &c, &b->chunk[j] )
+					|| bitmap_append( r, &c )))
+				goto clean1;
+			++j;
+
+		} else {
+			if( chunk_op( &c, &a->chunk[i], &b->chunk[j], op,
+						w, wb )
+					|| bitmap_append( r, &c ))
+				goto clean1;
+			++i;
+			++j;
+		}
+	}
+
+	return r;
+
+clean1:
+	bitmap_free( r );
+	return NULL;
+}
+
+t_bitmap *bitmap_copy( t_bitmap *a )
+{
+	t_bitmap *r;
+	t_bmchunk c;
+	int i;
+
+	if( NULL == (r = bitmap_new()))
+		return NULL;
+
+	for( i = 0; i < a->chunks; ++i ){
+		if( chunk_copy( &c, &a->chunk[i] ) || bitmap_append( r, &c )){
+			bitmap_free( r );
+			return NULL;
+		}
+	}
+
+	return r;
+}
+
+t_bitmap *bitmap_and( t_bitmap *a, t_bitmap *b )
+{
+	return bitmap_op( a, b, bo_and );
+}
+
+t_bitmap *bitmap_or( t_bitmap *a, t_bitmap *b )
+{
+	return bitmap_op( a, b, bo_or );
+}
+
+t_bitmap *bitmap_andnot( t_bitmap *a, t_bitmap *b )
+{
+	return bitmap_op( a, b, bo_andnot );
+}
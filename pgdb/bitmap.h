@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PGDB_BITMAP_H
+#define _PGDB_BITMAP_H
+
+#include <glib.h>
+
+/*
+ * compressed set of track ids.
+ *
+ * ids are split into chunks of 65536. Each chunk holds its lower 16 bits
+ * either as sorted array (sparse) or as bitset (dense).
+ */
+
+/* chunks with more entries become a bitset */
+#define BITMAP_ARRAYMAX	4096
+#define BITMAP_WORDS	(65536 / 64)
+
+typedef struct {
+	unsigned int key;	/* upper 16 bits of the ids */
+	int num;
+	int size;		/* allocated array entries, 0: bitset */
+	unsigned short *array;
+	guint64 *words;
+} t_bmchunk;
+
+typedef struct {
+	t_bmchunk *chunk;	/* sorted by key */
+	int chunks;
+	int num;
+} t_bitmap;
+
+t_bitmap *bitmap_new( void );
+void bitmap_free( t_bitmap *b );
+
+/* returns 1 when the set changed, -1 on error */
+int bitmap_add( t_bitmap *b, int id );
+int bitmap_del( t_bitmap *b, int id );
+int bitmap_has( t_bitmap *b, int id );
+
+#define bitmap_num(b)	((b)->num)
+
+/* sorted ids - to free by caller */
+int *bitmap_ids( t_bitmap *b, int *num );
+/* comma separated ids - to free by caller */
+char *bitmap_fmt( t_bitmap *b );
+
+/* new bitmaps - NULL on error */
+t_bitmap *bitmap_copy( t_bitmap *a );
+t_bitmap *bitmap_and( t_bitmap *a, t_bitmap *b );
+t_bitmap *bitmap_or( t_bitmap *a, t_bitmap *b );
+t_bitmap *bitmap_andnot( t_bitmap *a, t_bitmap *b );
+
+#endif
@@ -13,18 +13,87 @@
 #include <syslog.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
 
 #include <config.h>
 #include <opt.h>
+#include <commondb/zone.h>
 #include "dudldb.h"
 
+int zone_cur = 0;
+
 static PGconn *dbcon = NULL;
 static db_opened_cb opened_cb = NULL;
 
+/* connections set up so far - prepared statements die with theirs */
+static unsigned int generation = 0;
+
+/* main thread only: */
+static int reconnecting = 0;
+static int closing = 0;
+
+/* seconds to wait before the next reconnect after a failed setup */
+static unsigned int setup_delay = 0;
+
+/* modifications queued while the DB is down */
+static char **spool = NULL;
+static int spooled = 0;
+static int spoolsize = 0;
+
+/*
+ * notifications from other instances on the same DB. They're passed
+ * to the listeners from the main loop - never from within a query.
+ */
+typedef struct {
+	const char *what;
+	db_notify_cb cb;
+} t_listener;
+
+static t_listener listeners[DB_LISTENMAX];
+static int nlisteners = 0;
+
+static char **pending = NULL;
+static int npending = 0;
+static int pending_id = 0;
+static int watch_id = 0;
+
+/* polling the catalog for modifications by other programs */
+static db_catalog_cb watchers[DB_WATCHMAX];
+static int nwatchers = 0;
+static int catalog_id = 0;
+
 #define BUFLENQUERY 2048
 
+/* max. seconds between reconnect attempts */
+#define DB_BACKOFFMAX	64
+
+/* max. number of queries to keep in the spool */
+#define DB_SPOOLMAX	4096
+
 #define DBVER 4
 
+/* channel for notifications between instances */
+#define DB_CHANNEL	"dudld"
+
+/* type OIDs of binary results we know to decode - see pg_type.h */
+#define PGOID_BOOL	16
+#define PGOID_NAME	19
+#define PGOID_INT8	20
+#define PGOID_INT2	21
+#define PGOID_INT4	23
+#define PGOID_TEXT	25
+#define PGOID_OID	26
+#define PGOID_FLOAT4	700
+#define PGOID_FLOAT8	701
+#define PGOID_BPCHAR	1042
+#define PGOID_VARCHAR	1043
+#define PGOID_NUMERIC	1700
+
+/* PQexecParams() resultFormat */
+#define PGFMT_TEXT	0
+#define PGFMT_BINARY	1
+
 static int addopt( char *buffer, const char *opt, const char *val )
 {
 	if( ! val || ! *val )
@@ -33,19 +102,13 @@ static int addopt( char *buffer, const char *opt, const char *val )
 	return sprintf( buffer, "%s='%s' ", opt, val );
 }
 
-static int db_conn( void )
+/*
+ * open an additional connection, e.g. for use in other threads
+ */
+PGconn *db_newconn( void )
 {
 	char buffer[1024];
 	int len = 0;
-	static int inprogress = 0;
-	PGresult *res;
-
-	/* avoid endless recursion in case callback function causes reconnect */
-	if( inprogress )
-		return 0;
-	inprogress++;
-
-	db_done();
 
 	*buffer = 0;
 
@@ -55,39 +118,282 @@ static int db_conn( void )
 	len += addopt( buffer +len, "user", opt_db_user );
 	len += addopt( buffer +len, "password", opt_db_pass );
 
-	dbcon = PQconnectdb( buffer );
-	if( NULL == dbcon || CONNECTION_OK != PQstatus(dbcon)){
-		syslog( LOG_ERR, "db_conn failed: %s", PQerrorMessage(dbcon));
-		goto clean1;
+	return PQconnectdb( buffer );
+}
+
+static void db_reconnect( void );
+static void db_lost( void );
+
+/*
+ * pass pending notifications to their listeners
+ */
+static gboolean db_dispatch( gpointer data )
+{
+	char **list = pending;
+	int num = npending;
+	char *arg;
+	int i, j;
+
+	(void)data;
+
+	/* listeners run queries - which might collect more */
+	pending = NULL;
+	npending = 0;
+	pending_id = 0;
+
+	for( i = 0; i < num; ++i ){
+		/* payload: <what>[ <arg>] */
+		if( NULL != (arg = strchr( list[i], ' ' )))
+			*arg++ = 0;
+
+		syslog( LOG_DEBUG, "db_dispatch: %s %s", list[i],
+				arg ? arg : "" );
+		for( j = 0; j < nlisteners; ++j ){
+			if( 0 == strcmp( listeners[j].what, list[i] ))
+				(*listeners[j].cb)( arg );
+		}
+		free( list[i] );
+	}
+	free( list );
+
+	return FALSE;
+}
+
+/*
+ * move notifications libpq received so far to the pending list.
+ * Our own are skipped.
+ */
+static void db_collect( void )
+{
+	PGnotify *n;
+	char **tmp;
+
+	while( NULL != (n = PQnotifies( dbcon ))){
+		if( n->be_pid != PQbackendPID( dbcon ) && n->extra
+			&& NULL != (tmp = realloc( pending,
+				(npending +1) * sizeof(char*)))){
+
+			pending = tmp;
+			if( NULL != (pending[npending] = strdup( n->extra )))
+				npending++;
+		}
+		PQfreemem( n );
+	}
+
+	if( npending && ! pending_id )
+		pending_id = g_idle_add( db_dispatch, NULL );
+}
+
+static gboolean db_input( GIOChannel *source, GIOCondition cond,
+		gpointer data )
+{
+	(void)source;
+	(void)cond;
+	(void)data;
+
+	if( ! dbcon )
+		return FALSE;
+
+	if( ! PQconsumeInput( dbcon )){
+		watch_id = 0;
+		db_lost();
+		return FALSE;
+	}
+
+	db_collect();
+	return TRUE;
+}
+
+/*
+ * subscribe to notifications on a fresh connection
+ */
+static void db_subscribe( void )
+{
+	GIOChannel *chan;
+	PGresult *res;
+
+	if( ! nlisteners )
+		return;
+
+	res = PQexec( dbcon, "LISTEN " DB_CHANNEL );
+	if( ! res || PGRES_COMMAND_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "db_subscribe: %s", db_errstr() );
+		PQclear(res);
+		return;
+	}
+	PQclear(res);
+
+	if( NULL == (chan = g_io_channel_unix_new( PQsocket(dbcon) ))){
+		syslog( LOG_ERR, "db_subscribe: cannot watch connection" );
+		return;
+	}
+	watch_id = g_io_add_watch( chan, G_IO_IN | G_IO_ERR | G_IO_HUP,
+			db_input, NULL );
+	g_io_channel_unref( chan );
+}
+
+/*
+ * tell other instances about a modification of shared data
+ */
+int db_notify( const char *what, const char *arg )
+{
+	PGresult *res;
+	char *payload;
+	char *esc;
+
+	if( ! dbcon )
+		return -1;
+
+	payload = g_strdup_printf( "%s%s%s", what, arg ? " " : "",
+			arg ? arg : "" );
+	esc = db_escape( payload );
+	g_free( payload );
+	if( ! esc )
+		return -1;
+
+	res = db_query( "NOTIFY " DB_CHANNEL ", '%s'", esc );
+	free( esc );
+	if( ! res || PGRES_COMMAND_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "db_notify: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	PQclear(res);
+	return 0;
+}
+
+void db_listen( const char *what, db_notify_cb cb )
+{
+	if( nlisteners >= DB_LISTENMAX ){
+		syslog( LOG_ERR, "db_listen: too many listeners" );
+		return;
+	}
+
+	listeners[nlisteners].what = what;
+	listeners[nlisteners].cb = cb;
+	nlisteners++;
+}
+
+int db_catalog( t_dbcatalog *c )
+{
+	PGresult *res;
+
+	res = db_query( "SELECT "
+			"(SELECT count(*) FROM mserv_track), "
+			"(SELECT COALESCE(max(id),0) FROM mserv_track), "
+			"(SELECT count(*) FROM mserv_tag), "
+			"(SELECT COALESCE(max(id),0) FROM mserv_tag), "
+			"(SELECT count(*) FROM mserv_filetag)" );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res)
+			|| PQntuples(res) < 1 ){
+		syslog( LOG_ERR, "db_catalog: %s", db_errstr() );
+		PQclear(res);
+		return -1;
 	}
 
-	if( NULL == (res = db_query( "SELECT ver "
+	c->tracks = pgint(res, 0, 0);
+	c->track_max = pgint(res, 0, 1);
+	c->tags = pgint(res, 0, 2);
+	c->tag_max = pgint(res, 0, 3);
+	c->filetags = pgint(res, 0, 4);
+	PQclear(res);
+	return 0;
+}
+
+static gboolean db_catalog_check( gpointer data )
+{
+	t_dbcatalog c;
+	int i;
+
+	(void)data;
+
+	if( ! nwatchers || ! db_isup() || db_catalog( &c ))
+		return TRUE;
+
+	for( i = 0; i < nwatchers; ++i )
+		(*watchers[i])( &c );
+
+	return TRUE;
+}
+
+void db_catalog_watch( db_catalog_cb cb )
+{
+	int i;
+
+	for( i = 0; i < nwatchers; ++i )
+		if( watchers[i] == cb )
+			return;
+
+	if( nwatchers >= DB_WATCHMAX ){
+		syslog( LOG_ERR, "db_catalog_watch: too many watchers" );
+		return;
+	}
+
+	watchers[nwatchers++] = cb;
+}
+
+/*
+ * replay spooled modifications in their original order
+ */
+static void db_replay( void )
+{
+	PGresult *res;
+	int i;
+
+	if( spooled )
+		syslog( LOG_INFO, "db_replay: %d spooled queries", spooled );
+
+	for( i = 0; i < spooled; ++i ){
+		syslog( LOG_DEBUG, "db_replay(%s)", spool[i] );
+		res = PQexec( dbcon, spool[i] );
+		if( ! res || PGRES_COMMAND_OK != PQresultStatus(res) )
+			syslog( LOG_ERR, "db_replay: %s", db_errstr() );
+		PQclear(res);
+		g_free( spool[i] );
+	}
+	spooled = 0;
+}
+
+/*
+ * check a fresh connection and make it the current one
+ */
+static int db_setup( PGconn *conn )
+{
+	PGresult *res;
+
+	dbcon = conn;
+
+	if( NULL == (res = PQexec( dbcon, "SELECT ver "
 			"FROM dbver "
 			"WHERE item = 'schema'")))
 		goto clean1;
 
 	if( PGRES_TUPLES_OK !=  PQresultStatus(res) ){
-		syslog( LOG_ERR, "db_conn(dbver): %s", db_errstr() );
+		syslog( LOG_ERR, "db_setup(dbver): %s", db_errstr() );
 		goto clean2;
 	}
 	if( PQntuples(res) != 1 ){
-		syslog( LOG_ERR, "db_conn(dbver): couldn't determine dbver, "
+		syslog( LOG_ERR, "db_setup(dbver): couldn't determine dbver, "
 				"found %d rows", PQntuples(res));
 		goto clean2;
 	}
 	syslog( LOG_DEBUG, "DB Version: %d", pgint(res,0,0));
 
 	if( pgint(res, 0, 0 ) != DBVER ){
-		syslog( LOG_ERR, "db_conn: invalid DB Version %d - need %d",
+		syslog( LOG_ERR, "db_setup: invalid DB Version %d - need %d",
 				pgint(res,0,0), DBVER);
 		goto clean2;
 	}
 	PQclear(res);
 
+	++generation;
+	db_replay();
+	db_subscribe();
+
 	if( opened_cb )
 		(*opened_cb)();
 
-	inprogress--;
 	return 0;
 
 clean2:
@@ -96,10 +402,110 @@ clean2:
 clean1:
 	PQfinish(dbcon);
 	dbcon = NULL;
-	inprogress--;
 	return 1;
 }
 
+/*
+ * reconnecting happens in a thread of its own. Connecting to an
+ * unreachable server blocks until the TCP timeout and we must not
+ * stall the main loop (and thereby the player) meanwhile.
+ *
+ * The thread only establishes the connection. It's handed to the main
+ * loop for the setup.
+ */
+
+static gboolean db_reconnected( gpointer data )
+{
+	PGconn *conn = (PGconn*)data;
+
+	reconnecting = 0;
+
+	if( closing ){
+		PQfinish( conn );
+		return FALSE;
+	}
+
+	syslog( LOG_NOTICE, "DB connection is back" );
+	if( 0 == db_setup( conn ) ){
+		setup_delay = 0;
+		return FALSE;
+	}
+
+	/* server is reachable but unusable - don't hammer it */
+	if( ! setup_delay )
+		setup_delay = 1;
+	else if( setup_delay < DB_BACKOFFMAX )
+		setup_delay *= 2;
+
+	db_reconnect();
+	return FALSE;
+}
+
+static gpointer db_reconnector( gpointer data )
+{
+	PGconn *conn;
+	unsigned int delay = GPOINTER_TO_INT(data);
+
+	if( delay ){
+		syslog( LOG_NOTICE, "db setup failed, retry in %us", delay );
+		sleep( delay );
+	} else
+		delay = 1;
+
+	while( 1 ){
+		conn = db_newconn();
+		if( conn && CONNECTION_OK == PQstatus(conn) )
+			break;
+
+		syslog( LOG_NOTICE, "db reconnect failed, retry in %us: %s",
+				delay, PQerrorMessage(conn));
+		PQfinish( conn );
+
+		sleep( delay );
+		if( delay < DB_BACKOFFMAX )
+			delay *= 2;
+	}
+
+	g_idle_add( db_reconnected, conn );
+	return NULL;
+}
+
+static void db_reconnect( void )
+{
+	GError *err = NULL;
+
+	if( reconnecting || closing )
+		return;
+
+	syslog( LOG_NOTICE, "no DB connection, reconnecting in background" );
+	if( NULL == g_thread_create( db_reconnector,
+			GINT_TO_POINTER(setup_delay), FALSE, &err )){
+		syslog( LOG_ERR, "db_reconnect: %s", err->message );
+		g_error_free( err );
+		return;
+	}
+
+	reconnecting++;
+}
+
+/*
+ * current connection was lost
+ */
+static void db_lost( void )
+{
+	syslog( LOG_ERR, "lost DB connection: %s", PQerrorMessage(dbcon));
+	if( watch_id )
+		g_source_remove( watch_id );
+	watch_id = 0;
+
+	if( catalog_id )
+		g_source_remove( catalog_id );
+	catalog_id = 0;
+	PQfinish( dbcon );
+	dbcon = NULL;
+	db_reconnect();
+}
+
 const char *db_errstr( void )
 {
 	if( ! dbcon )
@@ -109,40 +515,78 @@ const char *db_errstr( void )
 }
 
 /*
- * wrapper to reconnect to database, when connection was lost
+ * run query on current connection
+ */
+
+static PGresult *db_exec( const char *query, int fmt )
+{
+	if( fmt == PGFMT_TEXT )
+		return PQexec( dbcon, query );
+
+	return PQexecParams( dbcon, query, 0, NULL, NULL, NULL, NULL, fmt );
+}
+
+/*
+ * check the connection after a query and pick up notifications
  */
+static PGresult *db_checked( PGresult *res )
+{
+	if( PQstatus(dbcon) != CONNECTION_OK ){
+		PQclear( res );
+		db_lost();
+		return NULL;
+	}
 
-static PGresult *db_vquery( char *query, va_list ap )
+	if( watch_id )
+		db_collect();
+
+	return res;
+}
+
+/*
+ * fmt: PGFMT_BINARY requests all columns in binary format. This is
+ * supported for single statement queries, only.
+ */
+static PGresult *db_vquery( int fmt, char *query, va_list ap )
 {
 	char buf[BUFLENQUERY];
+	char *q = buf;
 	int n;
+	va_list aq;
 	PGresult *res = NULL;
 
+	va_copy( aq, ap );
 	n = vsnprintf( buf, BUFLENQUERY, query, ap );
-	if( n < 0 || n > BUFLENQUERY ){
-		syslog( LOG_ERR, "query buffer too small, "
-				"increase BUFLENQUERY" );
-		return NULL;
+	if( n < 0 ){
+		syslog( LOG_ERR, "db_vquery: failed to format query" );
+		goto clean1;
 	}
 
-	syslog( LOG_DEBUG, "db_vquery(%s)", buf );
-
-	/* we have a connecteio? try the query */
-	if( dbcon ){
-		res = PQexec( dbcon, buf );
+	/* long queries (id lists, ...) get a buffer of their own */
+	if( n >= BUFLENQUERY ){
+		if( NULL == (q = malloc(n+1))){
+			syslog( LOG_ERR, "db_vquery: out of memory" );
+			goto clean1;
+		}
+		vsnprintf( q, n+1, query, aq );
 	}
 
-	if( PQstatus(dbcon) == CONNECTION_OK )
-		return res;
+	syslog( LOG_DEBUG, "db_vquery(%s)", q );
 
-	/* reconnect and retry */
-	PQclear( res );
-	res = NULL;
+	/* connecting is left to the background */
+	if( ! dbcon ){
+		db_reconnect();
+		goto clean2;
+	}
 
-	if( db_conn() )
-		return NULL;
+	res = db_checked( db_exec( q, fmt ));
 
-	return PQexec( dbcon, buf );
+clean2:
+	if( q != buf )
+		free(q);
+clean1:
+	va_end( aq );
+	return res;
 }
 
 PGresult *db_query( char *query, ... )
@@ -151,23 +595,169 @@ PGresult *db_query( char *query, ... )
 	va_list ap;
 
 	va_start(ap,query);
-	res = db_vquery( query, ap );
+	res = db_vquery( PGFMT_TEXT, query, ap );
 	va_end( ap );
 
 	return res;
 }
 
+/*
+ * run a modification. While the DB is down it is queued and replayed
+ * once the connection is back.
+ */
+int db_spool( char *query, ... )
+{
+	PGresult *res;
+	va_list ap;
+	char **tmp;
+
+	if( dbcon ){
+		va_start(ap,query);
+		res = db_vquery( PGFMT_TEXT, query, ap );
+		va_end( ap );
+
+		if( res && PGRES_COMMAND_OK == PQresultStatus(res) ){
+			PQclear(res);
+			return 0;
+		}
+		PQclear(res);
+
+		/* a plain error - no use in trying this again */
+		if( dbcon ){
+			syslog( LOG_ERR, "db_spool: %s", db_errstr() );
+			return -1;
+		}
+	}
+
+	if( spooled >= DB_SPOOLMAX ){
+		syslog( LOG_ERR, "db_spool: spool is full, dropping query" );
+		return -1;
+	}
+
+	if( spooled >= spoolsize ){
+		if( NULL == (tmp = realloc(spool,
+				(spoolsize + 64) * sizeof(char*)))){
+			syslog( LOG_ERR, "db_spool: out of memory" );
+			return -1;
+		}
+		spool = tmp;
+		spoolsize += 64;
+	}
+
+	va_start(ap,query);
+	spool[spooled] = g_strdup_vprintf( query, ap );
+	va_end( ap );
+
+	syslog( LOG_DEBUG, "db_spool(%s)", spool[spooled] );
+	spooled++;
+	return 0;
+}
+
+/*
+ * feed buf to a "COPY ... FROM STDIN" query
+ */
+int db_copyin( const char *buf, int len, char *query, ... )
+{
+	PGresult *res;
+	va_list ap;
+	int r = 0;
+
+	va_start(ap,query);
+	res = db_vquery( PGFMT_TEXT, query, ap );
+	va_end( ap );
+
+	if( ! res || PGRES_COPY_IN != PQresultStatus(res) ){
+		syslog( LOG_ERR, "db_copyin: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+	PQclear(res);
+
+	if( 1 != PQputCopyData( dbcon, buf, len )
+		|| 1 != PQputCopyEnd( dbcon, NULL )){
+
+		syslog( LOG_ERR, "db_copyin: %s", db_errstr() );
+		r = -1;
+	}
+
+	while( NULL != (res = PQgetResult( dbcon ))){
+		if( PQresultStatus(res) != PGRES_COMMAND_OK ){
+			syslog( LOG_ERR, "db_copyin: %s", db_errstr() );
+			r = -1;
+		}
+		PQclear(res);
+	}
+
+	return r;
+}
+
+int db_isup( void )
+{
+	return dbcon != NULL;
+}
+
+unsigned int db_generation( void )
+{
+	return generation;
+}
+
+int db_prepare( const char *name, const char *query, int nparams )
+{
+	PGresult *res;
+
+	syslog( LOG_DEBUG, "db_prepare(%s: %s)", name, query );
+
+	if( ! dbcon ){
+		db_reconnect();
+		return -1;
+	}
+
+	res = db_checked( PQprepare( dbcon, name, query, nparams, NULL ));
+	if( ! res || PGRES_COMMAND_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "db_prepare: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	PQclear(res);
+	return 0;
+}
+
+static _it_db *db_itnew( db_convert func, PGresult *res )
+{
+	_it_db *it;
+
+	if( NULL == (it = malloc(sizeof(_it_db)))){
+		PQclear(res);
+		return NULL;
+	}
+
+	if( NULL == (it->r.arena = arena_new())){
+		free(it);
+		PQclear(res);
+		return NULL;
+	}
+
+	it->r.res = res;
+	it->r.maps = 0;
+	it->conv = func;
+	it->tuple = 0;
+
+	return it;
+}
+
 _it_db *db_iterate( db_convert func, char *query, ... )
 {
 	va_list ap;
 	PGresult *res = NULL;
-	_it_db *it;
 
 	if( NULL == func )
 		return NULL;
 
+	/* rows are decoded by the pg*() functions, which handle the
+	 * binary format without any text parsing */
 	va_start(ap,query);
-	res = db_vquery( query, ap );
+	res = db_vquery( PGFMT_BINARY, query, ap );
 	va_end( ap );
 
 	if( res == NULL || PQresultStatus(res) != PGRES_TUPLES_OK ){
@@ -176,16 +766,33 @@ _it_db *db_iterate( db_convert func, char *query, ... )
 		return NULL;
 	}
 
-	if( NULL == (it = malloc(sizeof(_it_db)))){
-		PQclear(res);
+	return db_itnew( func, res );
+}
+
+_it_db *db_iterate_prepared( db_convert func, const char *name,
+		int nparams, const char * const *params )
+{
+	PGresult *res;
+
+	if( NULL == func )
+		return NULL;
+
+	syslog( LOG_DEBUG, "db_iterate_prepared(%s)", name );
+
+	if( ! dbcon ){
+		db_reconnect();
 		return NULL;
 	}
 
-	it->res = res;
-	it->conv = func;
-	it->tuple = 0;
+	res = db_checked( PQexecPrepared( dbcon, name, nparams, params,
+			NULL, NULL, PGFMT_BINARY ));
+	if( res == NULL || PQresultStatus(res) != PGRES_TUPLES_OK ){
+		syslog( LOG_ERR, "statement %s failed: %s", name, db_errstr());
+		PQclear(res);
+		return NULL;
+	}
 
-	return it;
+	return db_itnew( func, res );
 }
 
 char *db_escape( const char *in )
@@ -244,42 +851,210 @@ int db_table_exists( char *table )
 	return found;
 }
 
+const int *db_colmap( t_dbres *r, const char **names )
+{
+	t_dbcolmap *m;
+	int i;
+
+	for( i = 0; i < r->maps; ++i ){
+		if( r->map[i].names == names )
+			return r->map[i].col;
+	}
+
+	if( r->maps >= DB_MAXMAPS ){
+		syslog( LOG_ERR, "db_colmap: too many maps, increase DB_MAXMAPS" );
+		return NULL;
+	}
+
+	m = &r->map[r->maps];
+	for( i = 0; names[i]; ++i ){
+		if( i >= DB_MAXCOLS ){
+			syslog( LOG_ERR, "db_colmap: too many columns, "
+					"increase DB_MAXCOLS" );
+			return NULL;
+		}
+		m->col[i] = PQfnumber( r->res, names[i] );
+	}
+
+	m->names = names;
+	r->maps++;
+
+	return m->col;
+}
+
+/*
+ * decoding of field values.
+ *
+ * Iterators request binary results. These come in network byte order
+ * and are decoded according to the column's type. Results of db_query()
+ * are still text and parsed as before.
+ */
+
+#define PGBIN(res,tup,field)	(PQfformat(res,field) == PGFMT_BINARY)
+
+static guint64 pgbin_uint( PGresult *res, int tup, int field, int size )
+{
+	const unsigned char *v;
+	guint64 val = 0;
+	int i;
+
+	if( PQgetlength( res, tup, field ) < size )
+		return 0;
+
+	v = (const unsigned char *)PQgetvalue( res, tup, field );
+	for( i = 0; i < size; ++i )
+		val = (val << 8) | v[i];
+
+	return val;
+}
+
+static double pgbin_numeric( PGresult *res, int tup, int field )
+{
+	const unsigned char *v;
+	int ndigits, weight, sign, i;
+	double val = 0;
+
+	if( PQgetlength( res, tup, field ) < 8 )
+		return 0;
+
+	v = (const unsigned char *)PQgetvalue( res, tup, field );
+	ndigits = (v[0] << 8) | v[1];
+	weight = (gint16)((v[2] << 8) | v[3]);
+	sign = (v[4] << 8) | v[5];
+
+	if( PQgetlength( res, tup, field ) < 8 + 2 * ndigits )
+		return 0;
+
+	/* base 10000 digits, first one has the given weight */
+	for( i = 0; i < ndigits; ++i )
+		val = val * 10000 + ((v[8+2*i] << 8) | v[9+2*i]);
+
+	for( i = weight - ndigits +1; i > 0; --i )
+		val *= 10000;
+	for( ; i < 0; ++i )
+		val /= 10000;
+
+	if( sign == 0x4000 )
+		return -val;
+	if( sign == 0xC000 )
+		return NAN;
+	return val;
+}
+
+static gint64 pgbin_int64( PGresult *res, int tup, int field )
+{
+	switch( PQftype( res, field ) ){
+	  case PGOID_BOOL:
+		return pgbin_uint( res, tup, field, 1 );
+	  case PGOID_INT2:
+		return (gint16)pgbin_uint( res, tup, field, 2 );
+	  case PGOID_INT4:
+		return (gint32)pgbin_uint( res, tup, field, 4 );
+	  case PGOID_OID:
+		return (guint32)pgbin_uint( res, tup, field, 4 );
+	  case PGOID_INT8:
+		return (gint64)pgbin_uint( res, tup, field, 8 );
+	  case PGOID_FLOAT4:
+	  case PGOID_FLOAT8:
+	  case PGOID_NUMERIC:
+		return pgdouble( res, tup, field );
+	  case PGOID_TEXT:
+	  case PGOID_VARCHAR:
+	  case PGOID_BPCHAR:
+	  case PGOID_NAME:
+		return g_ascii_strtoll(PQgetvalue( res, tup, field ), NULL, 10);
+	}
+
+	syslog( LOG_ERR, "pgint: cannot decode type %u of column %s",
+			PQftype( res, field ), PQfname( res, field ));
+	return 0;
+}
+
 int pgint( PGresult *res, int tup, int field )
 {
+	if( PGBIN(res,tup,field) )
+		return pgbin_int64( res, tup, field );
+
 	return strtol(PQgetvalue( res, tup, field ), NULL, 10);
 }
 
 unsigned int pguint( PGresult *res, int tup, int field )
 {
+	if( PGBIN(res,tup,field) )
+		return pgbin_int64( res, tup, field );
+
 	return strtoul(PQgetvalue( res, tup, field ), NULL, 10);
 }
 
 gint64 pgint64( PGresult *res, int tup, int field )
 {
+	if( PGBIN(res,tup,field) )
+		return pgbin_int64( res, tup, field );
+
 	return g_ascii_strtoll(PQgetvalue( res, tup, field ), NULL, 10);
 }
 
 guint64 pguint64( PGresult *res, int tup, int field )
 {
+	if( PGBIN(res,tup,field) )
+		return pgbin_int64( res, tup, field );
+
 	return g_ascii_strtoull(PQgetvalue( res, tup, field ), NULL, 10);
 }
 
 double pgdouble( PGresult *res, int tup, int field )
 {
-	return strtod(PQgetvalue( res, tup, field ), NULL);
+	union {
+		guint32 i;
+		float f;
+	} f4;
+	union {
+		guint64 i;
+		double f;
+	} f8;
+
+	if( ! PGBIN(res,tup,field) )
+		return strtod(PQgetvalue( res, tup, field ), NULL);
+
+	switch( PQftype( res, field ) ){
+	  case PGOID_FLOAT4:
+		f4.i = pgbin_uint( res, tup, field, 4 );
+		return f4.f;
+	  case PGOID_FLOAT8:
+		f8.i = pgbin_uint( res, tup, field, 8 );
+		return f8.f;
+	  case PGOID_NUMERIC:
+		return pgbin_numeric( res, tup, field );
+	  case PGOID_TEXT:
+	  case PGOID_VARCHAR:
+	  case PGOID_BPCHAR:
+	  case PGOID_NAME:
+		return strtod(PQgetvalue( res, tup, field ), NULL);
+	}
+
+	return pgbin_int64( res, tup, field );
 }
 
 int pgbool( PGresult *res, int tup, int field )
 {
-	return 0 != strcmp(PQgetvalue( res, tup, field ),"t");
+	if( PGBIN(res,tup,field) )
+		return 0 != pgbin_int64( res, tup, field );
+
+	return 0 == strcmp(PQgetvalue( res, tup, field ),"t");
 
 }
 
 char *pgstring( PGresult *res, int tup, int field )
+{
+	return pgastring( NULL, res, tup, field );
+}
+
+char *pgastring( t_arena *a, PGresult *res, int tup, int field )
 {
 	char *c, *e;
 
-	if( NULL == (c = strdup(PQgetvalue( res, tup, field ))))
+	/* binary text values are passed as is, libpq terminates them */
+	if( NULL == (c = arena_strdup( a, PQgetvalue( res, tup, field ))))
 		return NULL;
 
 	e = c + strlen(c);
@@ -296,12 +1071,37 @@ char *pgstring( PGresult *res, int tup, int field )
  */
 int db_init( db_opened_cb cbfunc )
 {
+	PGconn *conn;
+
 	opened_cb = cbfunc;
-	return db_conn();
+
+	if( opt_catalog_check > 0 )
+		catalog_id = g_timeout_add( opt_catalog_check * 1000,
+				db_catalog_check, NULL );
+
+	conn = db_newconn();
+	if( conn && CONNECTION_OK == PQstatus(conn) ){
+		if( 0 == db_setup( conn ))
+			return 0;
+
+	} else {
+		syslog( LOG_ERR, "db_init failed: %s", PQerrorMessage(conn));
+		PQfinish( conn );
+	}
+
+	/* keep trying in background */
+	db_reconnect();
+	return 1;
 }
 
 void db_done( void )
 {
+	closing++;
+
+	if( watch_id )
+		g_source_remove( watch_id );
+	watch_id = 0;
+
 	if( dbcon )
 		PQfinish( dbcon );
 	dbcon = NULL;
@@ -324,7 +1124,7 @@ it_db *it_db_cur( it_db *i )
 	if( ! i )
 		return NULL;
 
-	return (*ITDB(i)->conv)( ITDB(i)->res, ITDB(i)->tuple);
+	return (*ITDB(i)->conv)( &ITDB(i)->r, ITDB(i)->tuple);
 }
 
 it_db *it_db_next( it_db *i )
@@ -341,6 +1141,7 @@ void it_db_done( it_db *i )
 	if( ! i )
 		return;
 
-	PQclear( ITDB(i)->res );
+	arena_done( ITDB(i)->r.arena );
+	PQclear( ITDB(i)->r.res );
 	free( i );
 }
@@ -14,22 +14,95 @@
 #include <glib.h>
 
 #include <commondb/dudldb.h>
+#include "arena.h"
 
-typedef void *(*db_convert)( PGresult *res, int tup );
+/* max. number of db_listen() registrations */
+#define DB_LISTENMAX	8
 
+/* max. number of db_catalog_watch() registrations */
+#define DB_WATCHMAX	4
+
+/* limits for the per result column maps */
+#define DB_MAXMAPS	8
+#define DB_MAXCOLS	16
+
+/*
+ * column indexes of a converter's fields within a result. names is a
+ * NULL terminated list of column names and identifies the map.
+ */
+typedef struct {
+	const char **names;
+	int col[DB_MAXCOLS];
+} t_dbcolmap;
+
+/*
+ * result passed to the row converters. Rows are allocated from arena.
+ * Without an arena (single row lookups) they're malloc()ed.
+ *
+ * The column maps are resolved on first use and kept with the result,
+ * so iterators look up their column names only once.
+ */
 typedef struct {
 	PGresult *res;
+	t_arena *arena;
+	int maps;
+	t_dbcolmap map[DB_MAXMAPS];
+} t_dbres;
+
+/* converter argument for single row lookups: result rows go to the heap */
+#define DBRES(res)	(&(t_dbres){ .res = (res) })
+
+typedef void *(*db_convert)( t_dbres *r, int tup );
+
+typedef struct {
+	t_dbres r;
 	db_convert conv;
 	int tuple;
 } _it_db;
 
 const char *db_errstr( void );
 
+int db_notify( const char *what, const char *arg );
+
+/*
+ * summary of the track catalog. Other programs (importers, ...) don't
+ * tell about their modifications, so it's polled every catalog_check
+ * seconds and passed to the watchers. They compare it with what they
+ * have in memory.
+ */
+typedef struct {
+	int tracks;		/* rows of mserv_track */
+	int track_max;		/* highest track id */
+	int tags;		/* rows of mserv_tag */
+	int tag_max;		/* highest tag id */
+	int filetags;		/* rows of mserv_filetag */
+} t_dbcatalog;
+
+typedef void (*db_catalog_cb)( const t_dbcatalog *c );
+
+/* query summary now */
+int db_catalog( t_dbcatalog *c );
+/* registering the same callback again is harmless */
+void db_catalog_watch( db_catalog_cb cb );
+
+PGconn *db_newconn( void );
+
 PGresult *db_query( char *query, ... );
+int db_spool( char *query, ... );
+int db_copyin( const char *buf, int len, char *query, ... );
+int db_isup( void );
 _it_db *db_iterate( db_convert func, char *query, ... );
 
+/* changes with each new connection */
+unsigned int db_generation( void );
+int db_prepare( const char *name, const char *query, int nparams );
+_it_db *db_iterate_prepared( db_convert func, const char *name,
+		int nparams, const char * const *params );
+
 int db_table_exists( char *table );
 
+const int *db_colmap( t_dbres *r, const char **names );
+
 char *db_escape( const char *in );
 
 int pgint( PGresult *res, int tup, int field );
@@ -39,5 +112,6 @@ guint64 pguint64( PGresult *res, int tup, int field );
 double pgdouble( PGresult *res, int tup, int field );
 int pgbool( PGresult *res, int tup, int field );
 char *pgstring( PGresult *res, int tup, int field );
+char *pgastring( t_arena *a, PGresult *res, int tup, int field );
 
 #endif
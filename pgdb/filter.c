@@ -7,158 +7,681 @@
  *
  */
 
+/*
+ * filter compiler: turns an expr into a condition on "mserv_track t".
+ *
+ * The expr is normalized first: NOTs are pushed down to the tests,
+ * nested ANDs/ORs are flattened and the tag tests of each AND/OR are
+ * merged into a single semi-join. Cheap tests are put first.
+ *
+ * sql_iterate() passes all literals as parameters and keeps the prepared
+ * statements of recently used filters, keyed by the normalized filter.
+ * These look up tag names themselves, so they stay valid when tags are
+ * added or renamed.
+ */
+
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 #include <syslog.h>
 
 #include <config.h>
 #include "dudldb.h"
 #include "filter.h"
+#include "tagidx.h"
 
-// TODO: report errors
+/* prepared statements kept by sql_iterate() */
+#define SQL_CACHEMAX	16
 
-static int add_val( value ***vlist, size_t *num, value *add )
+/************************************************************
+ * growable string
+ */
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+	int err;
+} t_sqlbuf;
+
+static void sb_init( t_sqlbuf *b )
 {
-	value **tmp;
+	b->len = 0;
+	b->size = 256;
+	b->err = 0;
+	if( NULL == (b->buf = malloc( b->size )))
+		b->err++;
+	else
+		*b->buf = 0;
+}
 
-	if( NULL == (tmp = realloc(*vlist, (*num+1) * sizeof(value))))
-		return 1;
+static int sb_grow( t_sqlbuf *b, size_t need )
+{
+	char *tmp;
+	size_t size;
 
-	*vlist = tmp;
-	tmp[(*num)++] = add;
+	for( size = b->size; size - b->len <= need; size *= 2 )
+		;
+
+	if( NULL == (tmp = realloc( b->buf, size ))){
+		b->err++;
+		return -1;
+	}
 
+	b->buf = tmp;
+	b->size = size;
 	return 0;
 }
 
-#define SQL_LEN 1024
-static value **sql_tags2id( value **inval )
+static void sb_printf( t_sqlbuf *b, const char *fmt, ... )
 {
-	value **val;
-	value **idval = NULL;
-	size_t idnum = 0;
-	char sql[SQL_LEN] = "";
-	int used = 0;
-	char *esc;
+	va_list ap;
+	int n;
+
+	while( ! b->err ){
+		va_start( ap, fmt );
+		n = vsnprintf( b->buf + b->len, b->size - b->len, fmt, ap );
+		va_end( ap );
+
+		if( n < 0 ){
+			b->err++;
+			return;
+		}
+
+		if( (size_t)n < b->size - b->len ){
+			b->len += n;
+			return;
+		}
+
+		sb_grow( b, n );
+	}
+}
+
+/* expr_fmt() doesn't tell the length it needs on truncation */
+static void sb_expr( t_sqlbuf *b, expr *e )
+{
+	size_t n;
+
+	while( ! b->err ){
+		n = expr_fmt( b->buf + b->len, b->size - b->len, e );
+		if( n < b->size - b->len ){
+			b->len += n;
+			return;
+		}
+
+		sb_grow( b, b->size );
+	}
+}
+
+/************************************************************
+ * tag lookup
+ */
+
+static int cmp_int( const void *a, const void *b )
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+/* sort and remove duplicates, returns new number */
+static int uniq( int *ids, int num )
+{
+	int i;
+	int u;
+
+	qsort( ids, num, sizeof(int), cmp_int );
+	for( u = i = 0; i < num; ++i )
+		if( ! u || ids[i] != ids[u-1] )
+			ids[u++] = ids[i];
+
+	return u;
+}
+
+/*
+ * sorted ids of the tags referred to by name or id. Unknown tags are
+ * skipped. Returns the number of ids, -1 on error.
+ */
+static int tags2id( value **tags, int **ids )
+{
+	t_sqlbuf names;
 	PGresult *res;
+	value **v;
+	char *esc;
+	int *r;
+	int *tmp;
+	int num = 0;
+	int id;
 	int tup;
 
+	for( v = tags; *v; ++v )
+		;
 
-	/* add id values to result and build query to lookup strings */
-	for( val = inval; *val ; ++val ){
-		switch( (*val)->type ){
+	if( NULL == (r = malloc( (v - tags + 1) * sizeof(int))))
+		return -1;
+
+	sb_init( &names );
+	for( v = tags; *v; ++v ){
+		switch( (*v)->type ){
 		  case vt_num:
-			  if( add_val( &idval, &idnum, *val ))
-				  goto clean1;
-			  break;
+			r[num++] = (*v)->val.num;
+			break;
 
 		  case vt_string:
-			  syslog( LOG_DEBUG, "tag2id: %s", (*val)->val.string );
-			  if( used ){
-				  used += snprintf(sql+used, SQL_LEN-used, ",");
-			  	  if( used > SQL_LEN )
-					  goto clean1;
-			  }
-
-			  esc = db_escape((*val)->val.string);
-			  used += snprintf(sql+used, SQL_LEN-used,"'%s'",esc);
-			  free(esc);
-
-			  if( used > SQL_LEN )
-				  goto clean1;
-			  break;
+			/* known to the tag index. It might miss new ones */
+			if( 0 <= (id = tagidx_id( (*v)->val.string ))){
+				r[num++] = id;
+				break;
+			}
+
+			if( NULL == (esc = db_escape( (*v)->val.string ))){
+				names.err++;
+				break;
+			}
+			sb_printf( &names, "%s'%s'", names.len ? "," : "", esc );
+			free( esc );
+			break;
 
 		  case vt_list:
 		  case vt_none:
 		  case vt_max:
-			  // TODO: report error
-			  break;
+			break;
 		}
 	}
 
-	if( ! used ){
-		add_val(&idval, &idnum, NULL );
-		return idval;
-	}
+	if( names.err )
+		goto clean1;
+
+	if( names.len ){
+		syslog( LOG_DEBUG, "tags2id: %s", names.buf );
+		res = db_query( "SELECT id FROM mserv_tag WHERE name IN (%s)",
+				names.buf );
+		if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+			syslog( LOG_ERR, "tags2id: %s", db_errstr() );
+			PQclear(res);
+			goto clean1;
+		}
+
+		if( NULL == (tmp = realloc( r, (num + PQntuples(res) + 1)
+				* sizeof(int)))){
+			PQclear(res);
+			goto clean1;
+		}
+		r = tmp;
 
-	res = db_query( "SELECT id FROM mserv_tag WHERE name IN (%s)", sql );
-	if (!res || PQresultStatus(res) != PGRES_TUPLES_OK){
-		syslog( LOG_ERR, "sql_tags2id: %s", db_errstr() );
+		for( tup = 0; tup < PQntuples(res); ++tup )
+			r[num++] = pgint(res, tup, 0);
 		PQclear(res);
-		goto clean1;
 	}
+	free( names.buf );
+
+	*ids = r;
+	return uniq( r, num );
+
+clean1:
+	free( names.buf );
+	free( r );
+	return -1;
+}
 
-	for( tup = 0; tup < PQntuples(res); ++tup ){
-		value *v;
-		v = malloc(sizeof(value));
-		v->type = vt_num;
-		v->val.num = pgint(res,tup,0);
+/************************************************************
+ * normalization
+ */
 
-		if( add_val( &idval, &idnum, v ))
-			goto clean2;
+typedef enum {
+	fn_test,	/* any other test */
+	fn_any,		/* tagged with any of the tags */
+	fn_all,		/* tagged with all of the tags */
+	fn_and,
+	fn_or,
+} fntype;
+
+typedef struct s_fnode {
+	fntype type;
+	int neg;		/* fn_test, fn_any, fn_all */
+	valtest *test;		/* fn_test */
+	value **tags;		/* fn_any, fn_all: NULL terminated, not owned */
+	int num;		/* number of tags or sub */
+	struct s_fnode **sub;	/* fn_and, fn_or */
+	int cost;
+	int seq;
+} t_fnode;
+
+static void fn_free( t_fnode *n )
+{
+	int i;
 
+	if( ! n )
+		return;
+
+	if( n->sub ){
+		for( i = 0; i < n->num; ++i )
+			fn_free( n->sub[i] );
+		free( n->sub );
 	}
+	free( n->tags );
+	free( n );
+}
 
-	PQclear(res);
-	add_val( &idval, &idnum, NULL );
-	return idval;
+static t_fnode *fn_new( fntype type, int neg )
+{
+	t_fnode *n;
 
-clean2:
-	PQclear(res);
-clean1:
-	vallist_free(idval);
-	return NULL;
+	if( NULL == (n = malloc( sizeof(t_fnode))))
+		return NULL;
+
+	memset( n, 0, sizeof(t_fnode));
+	n->type = type;
+	n->neg = neg;
+	return n;
 }
 
-static char *sql_idlist( value **vlist )
+static int val_eq( value *a, value *b )
 {
-	value **val;
-	size_t sused = 0;
-	static char sbuf[SQL_LEN];
+	if( a->type != b->type )
+		return 0;
+
+	if( a->type == vt_string )
+		return 0 == strcmp( a->val.string, b->val.string );
+
+	return a->val.num == b->val.num;
+}
 
-	*sbuf = 0;
-	for( val = vlist; *val; ++val ){
-		if( val != vlist ){
-			sused += snprintf( sbuf+sused, SQL_LEN-sused, ",");
-			if( sused > SQL_LEN )
+/* add tag to a tag set */
+static int fn_addtag( t_fnode *n, value *v )
+{
+	value **tmp;
+	int i;
+
+	for( i = 0; i < n->num; ++i )
+		if( val_eq( n->tags[i], v ))
+			return 0;
+
+	if( NULL == (tmp = realloc( n->tags, (n->num + 2) * sizeof(value*))))
+		return -1;
+
+	n->tags = tmp;
+	n->tags[n->num++] = v;
+	n->tags[n->num] = NULL;
+	return 0;
+}
+
+/* add sub to AND/OR, sub is freed on failure */
+static int fn_add( t_fnode *n, t_fnode *sub )
+{
+	t_fnode **tmp;
+
+	if( NULL == (tmp = realloc( n->sub, (n->num + 1) * sizeof(t_fnode*)))){
+		fn_free( sub );
+		return -1;
+	}
+
+	n->sub = tmp;
+	sub->seq = n->num;
+	n->sub[n->num++] = sub;
+	return 0;
+}
+
+/*
+ * add sub to AND/OR and merge tag sets:
+ *   a | b    -> any(a,b)        !a & !b  -> !any(a,b)
+ *   a & b    -> all(a,b)        !a | !b  -> !all(a,b)
+ */
+static int fn_join( t_fnode *n, t_fnode *sub )
+{
+	t_fnode *s;
+	fntype want;
+	int i;
+	int j;
+
+	if( sub->type != fn_any )
+		return fn_add( n, sub );
+
+	if( (n->type == fn_or) != sub->neg )
+		want = fn_any;
+	else if( sub->num == 1 )
+		want = fn_all;
+	else
+		return fn_add( n, sub );
+
+	for( i = 0; i < n->num; ++i ){
+		s = n->sub[i];
+		if( s->type != want || s->neg != sub->neg )
+			continue;
+
+		for( j = 0; j < sub->num; ++j ){
+			if( fn_addtag( s, sub->tags[j] )){
+				fn_free( sub );
+				return -1;
+			}
+		}
+		fn_free( sub );
+		return 0;
+	}
+
+	sub->type = want;
+	return fn_add( n, sub );
+}
+
+static int is_tagset( valtest *vt )
+{
+	if( vt->field != vf_tag )
+		return 0;
+
+	if( vt->op == vo_eq )
+		return vt->val->type == vt_num || vt->val->type == vt_string;
+
+	return vt->op == vo_in && vt->val->type == vt_list;
+}
+
+static t_fnode *fn_norm( expr *e, int neg );
+
+/* add the operands of e, flatten those of the same type */
+static int fn_group( t_fnode *n, expr *e, int neg )
+{
+	t_fnode *sub;
+	expr *c;
+	int cneg;
+	int i;
+
+	for( i = 0; i < 2; ++i ){
+		c = e->data.expr[i];
+		for( cneg = neg; c->op == op_not; cneg = ! cneg )
+			c = c->data.expr[0];
+
+		if( (c->op == op_and || c->op == op_or )
+				&& ((c->op == op_and) != cneg)
+				== (n->type == fn_and) ){
+
+			if( fn_group( n, c, cneg ))
+				return -1;
+			continue;
+		}
+
+		if( NULL == (sub = fn_norm( c, cneg )))
+			return -1;
+
+		if( fn_join( n, sub ))
+			return -1;
+	}
+
+	return 0;
+}
+
+static t_fnode *fn_norm( expr *e, int neg )
+{
+	t_fnode *n;
+	t_fnode *sub;
+	value **v;
+
+	while( e->op == op_not ){
+		neg = ! neg;
+		e = e->data.expr[0];
+	}
+
+	switch( e->op ){
+	  case op_self:
+		if( ! is_tagset( e->data.val )){
+			if( NULL == (n = fn_new( fn_test, neg )))
 				return NULL;
+			n->test = e->data.val;
+			return n;
 		}
 
-		sused += snprintf( sbuf+sused, SQL_LEN-sused,
-				"%d", (*val)->val.num );
-		if( sused > SQL_LEN )
+		if( NULL == (n = fn_new( fn_any, neg )))
 			return NULL;
 
+		if( e->data.val->op == vo_eq ){
+			if( fn_addtag( n, e->data.val->val ))
+				goto clean1;
+			return n;
+		}
+
+		for( v = e->data.val->val->val.list; *v; ++v )
+			if( fn_addtag( n, *v ))
+				goto clean1;
+
+		return n;
+
+	  case op_and:
+	  case op_or:
+		if( NULL == (n = fn_new( (e->op == op_and) != neg
+				? fn_and : fn_or, 0 )))
+			return NULL;
+
+		if( fn_group( n, e, neg ))
+			goto clean1;
+
+		/* merged into a single tag set */
+		if( n->num == 1 ){
+			sub = n->sub[0];
+			n->num = 0;
+			fn_free( n );
+			return sub;
+		}
+		return n;
+
+	  case op_not:
+	  case op_none:
+	  case op_max:
+		break;
 	}
 
-	return sbuf;
+	return NULL;
 
+clean1:
+	fn_free( n );
+	return NULL;
 }
 
-static int sql_taglist( char *buf, size_t len, value **vlist )
+static int fn_cmp( const void *a, const void *b )
 {
-	value **idlist;
-	size_t used = 0;
-	char *lst;
+	const t_fnode *x = *(t_fnode * const *)a;
+	const t_fnode *y = *(t_fnode * const *)b;
 
-	if( NULL == ( idlist = sql_tags2id( vlist )))
-		return 0;
+	if( x->cost != y->cost )
+		return x->cost - y->cost;
 
-	if( NULL == (lst = sql_idlist(idlist)))
-		goto clean1;
+	return x->seq - y->seq;
+}
 
-	if( *lst == 0 )
-		goto clean1;
+/* rough cost of evaluating the node for one track */
+static int fn_cost( t_fnode *n )
+{
+	int i;
+
+	switch( n->type ){
+	  case fn_test:
+		if( n->test->field == vf_tag )
+			return 50;
+		if( n->test->op == vo_re )
+			return 10;
+		if( n->test->val->type == vt_string )
+			return 2;
+		return 1;
 
-	used = snprintf( buf, len,
-			"EXISTS( SELECT file_id "
-			"FROM mserv_filetag ft "
-			"WHERE "
-				"t.id = ft.file_id AND "
-				"ft.tag_id IN (%s))",
-				lst );
+	  case fn_any:
+		return 5;
 
-clean1:
-	vallist_free(idlist);
-	return used;
+	  case fn_all:
+		return 5 + n->num;
+
+	  case fn_and:
+	  case fn_or:
+		break;
+	}
+
+	for( n->cost = i = 0; i < n->num; ++i )
+		n->cost += n->sub[i]->cost = fn_cost( n->sub[i] );
+
+	qsort( n->sub, n->num, sizeof(t_fnode*), fn_cmp );
+	return n->cost;
+}
+
+static t_fnode *fn_compile( expr *e )
+{
+	t_fnode *n;
+
+	if( ! e || NULL == (n = fn_norm( e, 0 )))
+		return NULL;
+
+	n->cost = fn_cost( n );
+	return n;
+}
+
+/* canonical text of the normalized filter */
+static void fn_key( t_sqlbuf *b, t_fnode *n )
+{
+	value list = { .type = vt_list };
+	valtest vt = { .field = vf_tag, .op = vo_eq };
+	expr leaf = { .op = op_self, .data.val = &vt };
+	int i;
+
+	if( n->neg )
+		sb_printf( b, "!( " );
+
+	switch( n->type ){
+	  case fn_test:
+		leaf.data.val = n->test;
+		sb_expr( b, &leaf );
+		break;
+
+	  case fn_any:
+		if( n->num == 1 ){
+			vt.val = n->tags[0];
+		} else {
+			list.val.list = n->tags;
+			vt.op = vo_in;
+			vt.val = &list;
+		}
+		sb_expr( b, &leaf );
+		break;
+
+	  case fn_all:
+		for( i = 0; i < n->num; ++i ){
+			vt.val = n->tags[i];
+			sb_printf( b, i ? " )&( " : "( " );
+			sb_expr( b, &leaf );
+		}
+		sb_printf( b, " )" );
+		break;
+
+	  case fn_and:
+	  case fn_or:
+		for( i = 0; i < n->num; ++i ){
+			sb_printf( b, i ? " )%c( " : "( ",
+					n->type == fn_and ? '&' : '|' );
+			fn_key( b, n->sub[i] );
+		}
+		sb_printf( b, " )" );
+		break;
+	}
+
+	if( n->neg )
+		sb_printf( b, " )" );
+}
+
+/************************************************************
+ * SQL generation
+ */
+
+typedef struct {
+	t_sqlbuf sql;
+	int param;		/* pass literals as parameters */
+	char **params;
+	int nparams;
+} t_sqlgen;
+
+static void gen_init( t_sqlgen *g, int param )
+{
+	sb_init( &g->sql );
+	g->param = param;
+	g->params = NULL;
+	g->nparams = 0;
+}
+
+static void params_free( char **params, int nparams )
+{
+	while( nparams > 0 )
+		free( params[--nparams] );
+	free( params );
+}
+
+static void gen_clear( t_sqlgen *g )
+{
+	free( g->sql.buf );
+	params_free( g->params, g->nparams );
+}
+
+/* string literal */
+static void gen_lit( t_sqlgen *g, const char *val )
+{
+	char **tmp;
+	char *esc;
+
+	if( g->sql.err )
+		return;
+
+	if( ! g->param ){
+		if( NULL == (esc = db_escape( val ))){
+			g->sql.err++;
+			return;
+		}
+		sb_printf( &g->sql, "'%s'", esc );
+		free( esc );
+		return;
+	}
+
+	if( NULL == (tmp = realloc( g->params, (g->nparams + 1)
+			* sizeof(char*)))){
+		g->sql.err++;
+		return;
+	}
+	g->params = tmp;
+
+	if( NULL == (g->params[g->nparams] = strdup( val ))){
+		g->sql.err++;
+		return;
+	}
+
+	sb_printf( &g->sql, "$%d", ++g->nparams );
+}
+
+static void gen_num( t_sqlgen *g, const char *fmt, int num )
+{
+	char buf[16];
+
+	snprintf( buf, sizeof(buf), fmt, num );
+	if( g->param )
+		gen_lit( g, buf );
+	else
+		sb_printf( &g->sql, "%s", buf );
+}
+
+/* "IN (...)" resp. "= ANY(...)" for a list of ids */
+static void gen_idlist( t_sqlgen *g, int *ids, int num )
+{
+	t_sqlbuf lst;
+	int i;
+
+	/* array literal as parameter */
+	sb_init( &lst );
+	sb_printf( &lst, "%s", g->param ? "{" : "" );
+	for( i = 0; i < num; ++i )
+		sb_printf( &lst, i ? ",%d" : "%d", ids[i] );
+	sb_printf( &lst, "%s", g->param ? "}" : "" );
+
+	if( lst.err ){
+		g->sql.err++;
+
+	} else if( g->param ){
+		sb_printf( &g->sql, "= ANY(" );
+		gen_lit( g, lst.buf );
+		sb_printf( &g->sql, "::int[])" );
+
+	} else {
+		sb_printf( &g->sql, "IN (%s)", lst.buf );
+	}
+
+	free( lst.buf );
 }
 
 static char *oper_names[vo_max] = {
@@ -172,65 +695,43 @@ static char *oper_names[vo_max] = {
 	"~*",
 };
 
-static int sql_vt_num( char *buf, size_t len, valtest *vt, char *row )
-{
-	return snprintf( buf, len, "%s %s %d",
-			row, oper_names[vt->op], vt->val->val.num );
-}
-
-static int sql_vt_year( char *buf, size_t len, valtest *vt, char *row )
+static void sql_vt_num( t_sqlgen *g, valtest *vt, char *row )
 {
-	return snprintf( buf, len, "%s %s '%04d'",
-				  row, oper_names[vt->op], vt->val->val.num );
+	sb_printf( &g->sql, "%s %s ", row, oper_names[vt->op] );
+	gen_num( g, "%d", vt->val->val.num );
 }
 
-static int sql_vt_tag( char *buf, size_t len, valtest *vt, char *row )
+static void sql_vt_year( t_sqlgen *g, valtest *vt, char *row )
 {
-	value *vlist[2] = { vt->val, NULL };
+	char buf[16];
 
-	(void)row;
-	return sql_taglist( buf, len, vlist );
+	sb_printf( &g->sql, "%s %s ", row, oper_names[vt->op] );
+	snprintf( buf, sizeof(buf), "%04d", vt->val->val.num );
+	gen_lit( g, buf );
 }
 
-static int sql_vt_taglist( char *buf, size_t len, valtest *vt, char *row )
+static void sql_vt_tagre( t_sqlgen *g, valtest *vt, char *row )
 {
 	(void)row;
-	return sql_taglist( buf, len, vt->val->val.list );
-}
-
-static int sql_vt_tagre( char *buf, size_t len, valtest *vt, char *row )
-{
-	char *esc;
-	int used;
-
-	(void)row;
-	esc = db_escape(vt->val->val.string);
-	used = snprintf( buf, len,
-			"EXISTS( SELECT file_id "
+	sb_printf( &g->sql, "EXISTS( SELECT file_id "
 			"FROM mserv_filetag ft "
 				"INNER JOIN mserv_tag tag "
 				"ON ft.tag_id = tag.id "
 			"WHERE "
 				"t.id = ft.file_id AND "
-				"tag.name %s '%s')",
-			oper_names[vt->op], esc );
-	free(esc);
-	return used;
+				"tag.name %s ",
+			oper_names[vt->op] );
+	gen_lit( g, vt->val->val.string );
+	sb_printf( &g->sql, ")" );
 }
 
-static int sql_vt_string( char *buf, size_t len, valtest *vt, char *row )
+static void sql_vt_string( t_sqlgen *g, valtest *vt, char *row )
 {
-	char *esc;
-	int used;
-
-	esc = db_escape(vt->val->val.string); // TODO: lower?
-	used = snprintf( buf, len, "%s %s '%s'",
-			row, oper_names[vt->op], esc );
-	free(esc);
-	return used;
+	sb_printf( &g->sql, "%s %s ", row, oper_names[vt->op] ); // TODO: lower?
+	gen_lit( g, vt->val->val.string );
 }
 
-typedef int (*fmt_func)(char *buf, size_t len, valtest *vt, char *row );
+typedef void (*fmt_func)( t_sqlgen *g, valtest *vt, char *row );
 typedef struct {
 	valfield field;
 	valop op;
@@ -239,6 +740,7 @@ typedef struct {
 	char *row;
 } sql_valtestfmt_t;
 
+/* tag tests by name or id are handled as tag sets */
 static sql_valtestfmt_t sql_valtestfmt[] ={
 	{ vf_dur, vo_eq, vt_num, sql_vt_num, "dur" },
 	{ vf_dur, vo_lt, vt_num, sql_vt_num, "dur" },
@@ -258,10 +760,7 @@ static sql_valtestfmt_t sql_valtestfmt[] ={
 	{ vf_year, vo_gt, vt_num, sql_vt_year, "album_publish_year" },
 	{ vf_year, vo_ge, vt_num, sql_vt_year, "album_publish_year" },
 
-	{ vf_tag, vo_eq, vt_num, sql_vt_num, NULL},
-	{ vf_tag, vo_eq, vt_string, sql_vt_tag, NULL},
 	{ vf_tag, vo_re, vt_string, sql_vt_tagre, NULL},
-	{ vf_tag, vo_in, vt_list, sql_vt_taglist, NULL},
 
 	{ vf_title, vo_eq, vt_string, sql_vt_string, "lower(title)" },
 	{ vf_title, vo_re, vt_string, sql_vt_string, "title" },
@@ -285,77 +784,378 @@ static sql_valtestfmt_t sql_valtestfmt[] ={
 	{ vf_none, vo_none, vt_none, NULL, NULL },
 };
 
-static int sql_valtest( char *buf, size_t len, valtest *vt )
+static void gen_test( t_sqlgen *g, valtest *vt )
 {
 	sql_valtestfmt_t *fmt;
-	int found = 0;
 
 	for( fmt = sql_valtestfmt; fmt->field != vf_none; ++fmt ){
 		if( fmt->field == vt->field
 				&& fmt->op == vt->op
 				&& fmt->type == vt->val->type ){
 
-			found++;
-			break;
+			(*fmt->func)( g, vt, fmt->row );
+			return;
 		}
 	}
-	if( found ){
-		return (*fmt->func)(buf, len, vt, fmt->row );
+
+	syslog( LOG_NOTICE, "filter: unsupported test on field %d", vt->field );
+	g->sql.err++;
+}
+
+/* number of tags given by id resp. name */
+static int tags_count( value **tags, valtype type )
+{
+	int num = 0;
+
+	for( ; *tags; ++tags )
+		if( (*tags)->type == type )
+			++num;
+
+	return num;
+}
+
+/* array parameter with the ids resp. names of the tags */
+static void gen_tagarray( t_sqlgen *g, value **tags, valtype type )
+{
+	t_sqlbuf lst;
+	const char *s;
+	int num = 0;
+
+	sb_init( &lst );
+	sb_printf( &lst, "{" );
+	for( ; *tags; ++tags ){
+		if( (*tags)->type != type )
+			continue;
+
+		sb_printf( &lst, "%s", num++ ? "," : "" );
+		if( type == vt_num ){
+			sb_printf( &lst, "%d", (*tags)->val.num );
+			continue;
+		}
+
+		sb_printf( &lst, "\"" );
+		for( s = (*tags)->val.string; *s; ++s )
+			sb_printf( &lst, "%s%c", *s == '"' || *s == '\\'
+					? "\\" : "", *s );
+		sb_printf( &lst, "\"" );
 	}
+	sb_printf( &lst, "}" );
 
-	// TODO: report error
-	return 0;
+	if( lst.err )
+		g->sql.err++;
+	else
+		gen_lit( g, lst.buf );
+	sb_printf( &g->sql, type == vt_num ? "::int[]" : "::text[]" );
+
+	free( lst.buf );
 }
 
-int sql_expr( char *buf, size_t len, expr *e )
+/* ft.tag_id is one of the tags */
+static void gen_tagcond( t_sqlgen *g, value **tags, int ids, int names )
 {
-	size_t used = 0;
+	if( ids && names )
+		sb_printf( &g->sql, "( " );
 
-	switch( e->op ){
-	  case op_self:
-		  used += sql_valtest( buf+used, len-used, e->data.val );
-		  break;
+	if( ids ){
+		sb_printf( &g->sql, "ft.tag_id = ANY(" );
+		gen_tagarray( g, tags, vt_num );
+		sb_printf( &g->sql, ")" );
+	}
 
-	  case op_not:
-		  used += snprintf( buf+used, len-used, "NOT ( " );
-		  if( used > len ) return used;
-		  used += sql_expr( buf+used, len-used, *e->data.expr );
-		  if( used > len ) return used;
-		  used += snprintf( buf+used, len-used, " )" );
-		  break;
+	if( ids && names )
+		sb_printf( &g->sql, " OR " );
 
-	  case op_and:
-		  used += snprintf( buf+used, len-used, "( " );
-		  if( used > len ) return used;
-		  used += sql_expr( buf+used, len-used, e->data.expr[0] );
-		  if( used > len ) return used;
-		  used += snprintf( buf+used, len-used, " )AND( " );
-		  if( used > len ) return used;
-		  used += sql_expr( buf+used, len-used, e->data.expr[1] );
-		  if( used > len ) return used;
-		  used += snprintf( buf+used, len-used, " )" );
-		  break;
+	if( names ){
+		sb_printf( &g->sql, "ft.tag_id IN( SELECT id "
+				"FROM mserv_tag "
+				"WHERE name = ANY(" );
+		gen_tagarray( g, tags, vt_string );
+		sb_printf( &g->sql, ") )" );
+	}
 
-	  case op_or:
-		  used += snprintf( buf+used, len-used, "( " );
-		  if( used > len ) return used;
-		  used += sql_expr( buf+used, len-used, e->data.expr[0] );
-		  if( used > len ) return used;
-		  used += snprintf( buf+used, len-used, " )OR( " );
-		  if( used > len ) return used;
-		  used += sql_expr( buf+used, len-used, e->data.expr[1] );
-		  if( used > len ) return used;
-		  used += snprintf( buf+used, len-used, " )" );
-		  break;
+	if( ids && names )
+		sb_printf( &g->sql, " )" );
+}
 
-	  case op_none:
-	  case op_max:
-		  // TODO: report error
-		  break;
+/* tagged with all num tags given by id resp. name */
+static void gen_tagall( t_sqlgen *g, value **tags, valtype type, int num )
+{
+	sb_printf( &g->sql, "t.id IN( SELECT ft.file_id "
+			"FROM mserv_filetag ft " );
+
+	if( type == vt_num ){
+		sb_printf( &g->sql, "WHERE ft.tag_id = ANY(" );
+		gen_tagarray( g, tags, vt_num );
+		sb_printf( &g->sql, ") "
+				"GROUP BY ft.file_id "
+				"HAVING count(DISTINCT ft.tag_id) = %d)", num );
+		return;
+	}
+
+	sb_printf( &g->sql, "INNER JOIN mserv_tag tag "
+				"ON tag.id = ft.tag_id "
+			"WHERE tag.name = ANY(" );
+	gen_tagarray( g, tags, vt_string );
+	sb_printf( &g->sql, ") "
+			"GROUP BY ft.file_id "
+			"HAVING count(DISTINCT tag.name) = %d)", num );
+}
+
+/*
+ * tag set of a cached statement. Names are resolved by the statement,
+ * an id and a name might refer to the same tag.
+ */
+static void gen_tagparam( t_sqlgen *g, t_fnode *n )
+{
+	int ids = tags_count( n->tags, vt_num );
+	int names = tags_count( n->tags, vt_string );
+
+	if( ! ids && ! names ){
+		sb_printf( &g->sql, n->neg ? "TRUE" : "FALSE" );
+
+	} else if( n->type == fn_any || ids + names == 1 ){
+		sb_printf( &g->sql, "%sEXISTS( SELECT file_id "
+				"FROM mserv_filetag ft "
+				"WHERE "
+					"t.id = ft.file_id AND ",
+				n->neg ? "NOT " : "" );
+		gen_tagcond( g, n->tags, ids, names );
+		sb_printf( &g->sql, ")" );
+
+	} else {
+		sb_printf( &g->sql, "%s( ", n->neg ? "NOT " : "" );
+		if( ids )
+			gen_tagall( g, n->tags, vt_num, ids );
+		if( ids && names )
+			sb_printf( &g->sql, " AND " );
+		if( names )
+			gen_tagall( g, n->tags, vt_string, names );
+		sb_printf( &g->sql, " )" );
 	}
-	return used;
 }
 
+/* tag set of a one-shot query: tags are resolved to ids right away */
+static void gen_tags( t_sqlgen *g, t_fnode *n )
+{
+	value *one[2] = { NULL, NULL };
+	int *ids = NULL;
+	int *id;
+	int num = 0;
+	int i;
+
+	if( n->type == fn_any ){
+		num = tags2id( n->tags, &ids );
+
+	/* each tag must exist */
+	} else if( NULL != (ids = malloc( (n->num + 1) * sizeof(int)))){
+		for( i = 0; i < n->num; ++i ){
+			one[0] = n->tags[i];
+			if( 0 > (num = tags2id( one, &id )))
+				break;
+
+			if( num )
+				ids[i] = *id;
+			free( id );
+			if( ! num )
+				break;
+		}
+
+		if( num > 0 )
+			num = uniq( ids, n->num );
+	}
+
+	if( num < 0 || ! ids ){
+		g->sql.err++;
+		goto clean1;
+	}
+
+	if( num == 0 ){
+		sb_printf( &g->sql, n->neg ? "TRUE" : "FALSE" );
+
+	} else if( n->type == fn_any || num == 1 ){
+		sb_printf( &g->sql, "%sEXISTS( SELECT file_id "
+				"FROM mserv_filetag ft "
+				"WHERE "
+					"t.id = ft.file_id AND "
+					"ft.tag_id ",
+				n->neg ? "NOT " : "" );
+		gen_idlist( g, ids, num );
+		sb_printf( &g->sql, ")" );
+
+	} else {
+		sb_printf( &g->sql, "t.id %sIN( SELECT file_id "
+				"FROM mserv_filetag "
+				"WHERE tag_id ",
+				n->neg ? "NOT " : "" );
+		gen_idlist( g, ids, num );
+		sb_printf( &g->sql, " GROUP BY file_id "
+				"HAVING count(DISTINCT tag_id) = %d)", num );
+	}
+
+clean1:
+	free( ids );
+}
+
+static void gen_node( t_sqlgen *g, t_fnode *n )
+{
+	int i;
+
+	switch( n->type ){
+	  case fn_test:
+		if( n->neg )
+			sb_printf( &g->sql, "NOT " );
+		gen_test( g, n->test );
+		break;
+
+	  case fn_any:
+	  case fn_all:
+		if( g->param )
+			gen_tagparam( g, n );
+		else
+			gen_tags( g, n );
+		break;
+
+	  case fn_and:
+	  case fn_or:
+		for( i = 0; i < n->num; ++i ){
+			sb_printf( &g->sql, i ? " )%s( " : "( ",
+					n->type == fn_and ? "AND" : "OR" );
+			gen_node( g, n->sub[i] );
+		}
+		sb_printf( &g->sql, " )" );
+		break;
+	}
+}
+
+char *sql_where( expr *e )
+{
+	t_sqlgen g;
+	t_fnode *n;
 
+	if( NULL == (n = fn_compile( e )))
+		return NULL;
 
+	gen_init( &g, 0 );
+	gen_node( &g, n );
+	fn_free( n );
+
+	if( g.sql.err ){
+		gen_clear( &g );
+		return NULL;
+	}
+
+	return g.sql.buf;
+}
+
+/************************************************************
+ * prepared statements
+ */
+
+typedef struct {
+	char *key;		/* query and normalized filter */
+	char name[32];
+	char **params;
+	int nparams;
+	unsigned int used;
+} t_sqlcache;
+
+static t_sqlcache cache[SQL_CACHEMAX];
+static unsigned int cache_gen = 0;
+static unsigned int cache_tick = 0;
+static unsigned int cache_seq = 0;
+
+static void cache_drop( t_sqlcache *c, int dealloc )
+{
+	PGresult *res;
+
+	if( ! c->key )
+		return;
+
+	if( dealloc && db_isup() && cache_gen == db_generation() ){
+		res = db_query( "DEALLOCATE %s", c->name );
+		PQclear(res);
+	}
+
+	free( c->key );
+	params_free( c->params, c->nparams );
+	memset( c, 0, sizeof(t_sqlcache));
+}
+
+it_db *sql_iterate( db_convert func, expr *e, const char *head,
+		const char *tail )
+{
+	t_sqlbuf key;
+	t_sqlbuf query;
+	t_sqlgen g;
+	t_sqlcache *c = NULL;
+	t_fnode *n;
+	int i;
+
+	/* statements of a previous connection are gone */
+	if( cache_gen != db_generation() ){
+		for( i = 0; i < SQL_CACHEMAX; ++i )
+			cache_drop( &cache[i], 0 );
+		cache_gen = db_generation();
+	}
+
+	if( NULL == (n = fn_compile( e )))
+		return NULL;
+
+	sb_init( &key );
+	sb_printf( &key, "%s\n%s\n", head, tail );
+	fn_key( &key, n );
+	if( key.err )
+		goto clean1;
+
+	for( i = 0; i < SQL_CACHEMAX; ++i ){
+		if( cache[i].key && 0 == strcmp( cache[i].key, key.buf ))
+			goto found;
+
+		/* free or least recently used */
+		if( ! c || ( c->key && ( ! cache[i].key
+				|| cache[i].used < c->used )))
+			c = &cache[i];
+	}
+
+	gen_init( &g, 1 );
+	gen_node( &g, n );
+
+	sb_init( &query );
+	sb_printf( &query, "%s WHERE %s %s", head, g.sql.buf, tail );
+	if( g.sql.err || query.err )
+		goto clean2;
+
+	cache_drop( c, 1 );
+	snprintf( c->name, sizeof(c->name), "filter%u", ++cache_seq );
+	if( db_prepare( c->name, query.buf, g.nparams ))
+		goto clean2;
+
+	syslog( LOG_DEBUG, "filter %s: %s", c->name, key.buf );
+	c->key = key.buf;
+	c->params = g.params;
+	c->nparams = g.nparams;
+	free( query.buf );
+	free( g.sql.buf );
+	fn_free( n );
+
+	i = c - cache;
+	goto exec;
+
+found:
+	free( key.buf );
+	fn_free( n );
+
+exec:
+	cache[i].used = ++cache_tick;
+	return db_iterate_prepared( func, cache[i].name, cache[i].nparams,
+			(const char * const *)cache[i].params );
+
+clean2:
+	free( query.buf );
+	gen_clear( &g );
+clean1:
+	free( key.buf );
+	fn_free( n );
+	return NULL;
+}
 
@@ -13,7 +13,13 @@
 #include <stdlib.h>
 
 #include <commondb/parseexpr.h>
+#include "dudldb.h"
 
-int sql_expr( char *buf, size_t len, expr *e );
+/* condition on "mserv_track t" - to free by caller, NULL on error */
+char *sql_where( expr *e );
+
+/* iterate "<head> WHERE <condition> <tail>" as prepared statement */
+it_db *sql_iterate( db_convert func, expr *e, const char *head,
+		const char *tail );
 
 #endif
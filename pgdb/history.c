@@ -8,27 +8,377 @@
  */
 
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
 
 #include <config.h>
+#include <opt.h>
 #include <commondb/history.h>
 #include <commondb/random.h>
 #include "dudldb.h"
 #include "track.h"
 
-int history_add( t_track *track, int uid, int completed )
+/************************************************************
+ * write-behind journal
+ *
+ * history records are appended to the journal file and synced to disk.
+ * A background thread copies them to mserv_hist in batches using its own
+ * DB connection. The offset of the first unflushed record is kept in
+ * <journal>.off. Records already in mserv_hist are skipped, so replaying
+ * a partially flushed journal after a crash is harmless.
+ */
+
+/* max amount of journal data to COPY in one transaction */
+#define JOURNAL_BATCH	65536
+
+static GMutex *jlock = NULL;
+static GCond *jcond = NULL;
+static GThread *jthread = NULL;
+static int jstop = 0;
+static int jfd = -1;
+static char *joffname = NULL;
+/* only used by flusher thread */
+static off_t joff = 0;
+static PGconn *jcon = NULL;
+
+static int journal_append( int id, int uid, time_t added, int completed )
+{
+	char buf[128];
+	int len;
+	off_t end;
+	int r = 0;
+
+	/* COPY text format */
+	len = snprintf( buf, 128, "%ld\t%d\t%d\t%s\n",
+			(long)added, id, uid, completed ? "t" : "f" );
+
+	g_mutex_lock(jlock);
+	end = lseek( jfd, 0, SEEK_END );
+	if( len != write( jfd, buf, len )){
+		syslog( LOG_ERR, "journal_append: %m" );
+		/* drop partial record */
+		if( end >= 0 && ftruncate( jfd, end ))
+			syslog( LOG_ERR, "journal_append: %m" );
+		r = -1;
+
+	} else if( fdatasync( jfd )){
+		syslog( LOG_ERR, "journal_append: %m" );
+	}
+	g_mutex_unlock(jlock);
+
+	return r;
+}
+
+static int journal_saveoff( off_t off )
+{
+	char tmp[MAXPATHLEN];
+	FILE *fh;
+	int r = 0;
+
+	snprintf( tmp, MAXPATHLEN, "%s.tmp", joffname );
+	if( NULL == (fh = fopen( tmp, "w" ))){
+		syslog( LOG_ERR, "journal: cannot write %s: %m", tmp );
+		return -1;
+	}
+
+	fprintf( fh, "%lld\n", (long long)off );
+	if( fflush(fh) || fdatasync(fileno(fh)) )
+		r = -1;
+	if( fclose(fh) )
+		r = -1;
+
+	if( r || rename( tmp, joffname )){
+		syslog( LOG_ERR, "journal: cannot save offset: %m" );
+		return -1;
+	}
+
+	return 0;
+}
+
+static off_t journal_loadoff( void )
+{
+	FILE *fh;
+	long long off = 0;
+	struct stat st;
+
+	if( NULL == (fh = fopen( joffname, "r" )))
+		return 0;
+
+	if( 1 != fscanf( fh, "%lld", &off ))
+		off = 0;
+	fclose(fh);
+
+	/* journal was restarted, but offset wasn't saved */
+	if( fstat( jfd, &st ) || off > st.st_size || off < 0 )
+		off = 0;
+
+	return off;
+}
+
+static int journal_exec( const char *query, ExecStatusType want )
+{
+	PGresult *res;
+
+	res = PQexec( jcon, query );
+	if( ! res || PQresultStatus(res) != want ){
+		syslog( LOG_ERR, "journal: %s", PQerrorMessage(jcon) );
+		PQclear(res);
+		return -1;
+	}
+
+	PQclear(res);
+	return 0;
+}
+
+static int journal_connect( void )
+{
+	if( jcon && PQstatus(jcon) == CONNECTION_OK )
+		return 0;
+
+	if( jcon )
+		PQfinish(jcon);
+
+	jcon = db_newconn();
+	if( ! jcon || PQstatus(jcon) != CONNECTION_OK ){
+		syslog( LOG_ERR, "journal: connect failed: %s",
+				PQerrorMessage(jcon) );
+		goto clean1;
+	}
+
+	if( journal_exec( "CREATE TEMP TABLE hist_journal ("
+				"added integer, "
+				"file_id integer, "
+				"user_id integer, "
+				"completed boolean )",
+			PGRES_COMMAND_OK ))
+		goto clean1;
+
+	return 0;
+
+clean1:
+	PQfinish(jcon);
+	jcon = NULL;
+	return -1;
+}
+
+/* copy complete records from buf to mserv_hist */
+static int journal_copy( const char *buf, int len )
+{
+	PGresult *res;
+	int r;
+
+	if( journal_connect() )
+		return -1;
+
+	if( journal_exec( "BEGIN", PGRES_COMMAND_OK ))
+		return -1;
+
+	if( journal_exec( "DELETE FROM hist_journal", PGRES_COMMAND_OK ))
+		goto clean1;
+
+	if( journal_exec( "COPY hist_journal FROM STDIN", PGRES_COPY_IN ))
+		goto clean1;
+
+	if( 1 != PQputCopyData( jcon, buf, len )
+		|| 1 != PQputCopyEnd( jcon, NULL )){
+
+		syslog( LOG_ERR, "journal: %s", PQerrorMessage(jcon) );
+		goto clean1;
+	}
+
+	r = 0;
+	while( NULL != (res = PQgetResult( jcon ))){
+		if( PQresultStatus(res) != PGRES_COMMAND_OK ){
+			syslog( LOG_ERR, "journal: %s", PQerrorMessage(jcon) );
+			r = -1;
+		}
+		PQclear(res);
+	}
+	if( r )
+		goto clean1;
+
+	if( journal_exec( "INSERT INTO mserv_hist("
+				"file_id, user_id, added, completed) "
+			"SELECT "
+				"j.file_id, j.user_id, "
+				"unix2time(j.added), j.completed "
+			"FROM hist_journal j "
+			"WHERE NOT EXISTS ( "
+				"SELECT 1 FROM mserv_hist h "
+				"WHERE h.file_id = j.file_id "
+					"AND h.user_id = j.user_id "
+					"AND h.added = unix2time(j.added) )",
+			PGRES_COMMAND_OK ))
+		goto clean1;
+
+	if( journal_exec( "COMMIT", PGRES_COMMAND_OK ))
+		goto clean1;
+
+	return 0;
+
+clean1:
+	journal_exec( "ROLLBACK", PGRES_COMMAND_OK );
+	return -1;
+}
+
+/* send everything after joff to the DB */
+static void journal_flush( void )
+{
+	char buf[JOURNAL_BATCH];
+	ssize_t len;
+	char *e;
+
+	while( 1 ){
+		g_mutex_lock(jlock);
+		len = pread( jfd, buf, JOURNAL_BATCH, joff );
+
+		/* everything flushed, restart the journal. The offset is
+		 * saved first - a crash inbetween just causes a replay */
+		if( len == 0 && joff > 0 && 0 == journal_saveoff(0) ){
+			if( ftruncate( jfd, 0 ))
+				syslog( LOG_ERR, "journal: truncate: %m" );
+			joff = 0;
+		}
+		g_mutex_unlock(jlock);
+
+		if( len < 0 ){
+			syslog( LOG_ERR, "journal: read: %m" );
+			return;
+		}
+		if( len == 0 )
+			return;
+
+		/* only send complete records */
+		for( e = buf + len -1; e >= buf && *e != '\n'; --e )
+			;
+		if( e < buf )
+			return;
+		len = e - buf +1;
+
+		/* DB is unavailable - retry later */
+		if( journal_copy( buf, len ))
+			return;
+
+		joff += len;
+		journal_saveoff( joff );
+	}
+}
+
+static gpointer journal_flusher( gpointer data )
+{
+	GTimeVal tv;
+
+	(void)data;
+
+	g_mutex_lock(jlock);
+	while( ! jstop ){
+		g_get_current_time( &tv );
+		g_time_val_add( &tv, (long)opt_hist_flush * G_USEC_PER_SEC );
+		g_cond_timed_wait( jcond, jlock, &tv );
+
+		g_mutex_unlock(jlock);
+		journal_flush();
+		g_mutex_lock(jlock);
+	}
+	g_mutex_unlock(jlock);
+
+	if( jcon )
+		PQfinish(jcon);
+	jcon = NULL;
+
+	return NULL;
+}
+
+int history_init( void )
+{
+	GError *err = NULL;
+
+	if( ! opt_hist_journal || ! *opt_hist_journal )
+		return 0;
+
+	if( 0 > (jfd = open( opt_hist_journal,
+			O_RDWR | O_APPEND | O_CREAT, 0600 ))){
+
+		syslog( LOG_ERR, "cannot open history journal %s: %m",
+				opt_hist_journal );
+		goto clean1;
+	}
+
+	if( NULL == (joffname = malloc( strlen(opt_hist_journal) + 5 )))
+		goto clean2;
+	sprintf( joffname, "%s.off", opt_hist_journal );
+
+	joff = journal_loadoff();
+
+	jlock = g_mutex_new();
+	jcond = g_cond_new();
+	jstop = 0;
+
+	if( NULL == (jthread = g_thread_create( journal_flusher, NULL,
+			TRUE, &err ))){
+
+		syslog( LOG_ERR, "cannot start history flusher: %s",
+				err->message );
+		g_error_free(err);
+		goto clean3;
+	}
+
+	return 0;
+
+clean3:
+	g_cond_free(jcond);
+	g_mutex_free(jlock);
+	free(joffname);
+	joffname = NULL;
+clean2:
+	close(jfd);
+	jfd = -1;
+clean1:
+	syslog( LOG_NOTICE, "writing history directly to DB" );
+	return -1;
+}
+
+void history_done( void )
+{
+	if( ! jthread )
+		return;
+
+	g_mutex_lock(jlock);
+	jstop++;
+	g_cond_signal(jcond);
+	g_mutex_unlock(jlock);
+
+	g_thread_join(jthread);
+	jthread = NULL;
+
+	g_cond_free(jcond);
+	g_mutex_free(jlock);
+	close(jfd);
+	jfd = -1;
+	free(joffname);
+	joffname = NULL;
+}
+
+/************************************************************
+ * history access
+ */
+
+static int history_insert( int id, int uid, time_t added, int completed )
 {
 	PGresult *res;
-	time_t now;
 
-	now = time(NULL);
 	res = db_query( "INSERT INTO mserv_hist("
 			"file_id, user_id, added, completed) "
 			"VALUES( %d, %d, unix2time(%d), %s )",
-			track->id, uid, now, completed ? "true" : "false" );
+			id, uid, (int)added, completed ? "true" : "false" );
 	if( res == NULL || PQresultStatus(res) != PGRES_COMMAND_OK ){
 		syslog( LOG_ERR, "history_add: %s", db_errstr() );
 		PQclear(res);
@@ -36,6 +386,20 @@ int history_add( t_track *track, int uid, int completed )
 	}
 
 	PQclear(res);
+	return 0;
+}
+
+int history_add( t_track *track, int uid, int completed )
+{
+	time_t now;
+
+	now = time(NULL);
+
+	/* fall back to a direct insert, when the journal is unusable */
+	if( jfd < 0 || journal_append( track->id, uid, now, completed )){
+		if( history_insert( track->id, uid, now, completed ))
+			return 1;
+	}
 
 	random_cache_update( track->id, now );
 
@@ -47,19 +411,36 @@ void history_free( t_history *h)
 	if( !h )
 		return;
 
+	if( h->_arena )
+		return;
+
 	user_free(h->user);
 	track_free(h->track);
 	free(h);
 }
 
+enum {
+	hc_played,
+	hc_uid,
+	hc_max
+};
+
+static const char *history_cols[] = {
+	[hc_played]	= "played",
+	[hc_uid]	= "user_id",
+	[hc_max]	= NULL,
+};
+
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing history data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing history data: %s", history_cols[field] ); \
 		goto gofail; \
 	}
 
-static t_history *history_convert( PGresult *res, int tup )
+static t_history *history_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_history *h;
 	int f;
 
@@ -69,18 +450,27 @@ static t_history *history_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (h = malloc(sizeof(t_history))))
+	if( NULL == (col = db_colmap( r, history_cols )))
+		return NULL;
+
+	if( NULL == (h = arena_alloc( r->arena, sizeof(t_history))))
 		return NULL;
 	memset( h, 0, sizeof(t_history));
 
-	GETFIELD(f,"played", clean1 );
+	h->_arena = NULL != r->arena;
+
+	GETFIELD(f,hc_played, clean1 );
 	h->played = pgint(res, tup, f );
 
-	GETFIELD(f,"user_id", clean1 );
+	GETFIELD(f,hc_uid, clean1 );
 	if( NULL == ( h->user = user_get(pgint(res, tup, f))))
 		goto clean1;
 
-	if( NULL == ( h->track = track_convert( res, tup )))
+	if( NULL == ( h->track = track_convert( r, tup )))
+		goto clean2;
+
+	/* the user is shared with the heap, drop it with the arena */
+	if( arena_cleanup( r->arena, (t_arena_cleanup)user_free, h->user ))
 		goto clean2;
 
 	return h;
@@ -89,7 +479,7 @@ clean2:
 	user_free(h->user);
 
 clean1:
-	free(h);
+	arena_free(r->arena, h);
 
 	return NULL;
 }
@@ -97,8 +487,7 @@ clean1:
 
 t_track *history_track( t_history *h)
 {
-	track_use(h->track);
-	return h->track;
+	return track_use(h->track);
 }
 
 // TODO: use view
@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+#include "pick.h"
+
+static const char *pick_names[] = {
+	[pk_plain]	= "plain",
+	[pk_abs]	= "abs",
+	[pk_divi]	= "divi",
+	[pk_first]	= "first",
+	[pk_lastplay]	= "lastplay",
+	[pk_score]	= "score",
+	[pk_shuffle]	= "shuffle",
+};
+
+int pick_algo( const char *name )
+{
+	unsigned int i;
+
+	for( i = 0; i < sizeof(pick_names) / sizeof(char*); ++i ){
+		if( 0 == strcmp( name, pick_names[i] ))
+			return i;
+	}
+
+	return -1;
+}
+
+int pick_rank( t_pickalgo algo, int num )
+{
+	int pick;
+
+	switch( algo ){
+	  case pk_plain:
+		pick = (double)random() / RAND_MAX * num;
+		break;
+
+	  case pk_divi:
+		pick = ((double)random() * random())
+			/ ( (double)RAND_MAX * RAND_MAX)
+			* num;
+		break;
+
+	  case pk_first:
+		pick = 0;
+		break;
+
+	  default:
+		pick = (double)abs( (int)((double)random() + random() - RAND_MAX ))
+			/ RAND_MAX * num;
+		break;
+	}
+
+	if( pick >= num )
+		pick = num -1;
+
+	return pick;
+}
+
+/************************************************************
+ * Fenwick tree. a[] and m[] are 1-based internally.
+ */
+
+int fenwick_init( t_fenwick *f, int num )
+{
+	f->num = num;
+	if( NULL == (f->a = calloc( num + 1, sizeof(double))))
+		return -1;
+
+	if( NULL == (f->m = calloc( num + 1, sizeof(double)))){
+		free( f->a );
+		f->a = NULL;
+		return -1;
+	}
+
+	for( f->mask = 1; f->mask * 2 <= num; f->mask *= 2 )
+		;
+
+	return 0;
+}
+
+void fenwick_free( t_fenwick *f )
+{
+	free( f->a );
+	free( f->m );
+	f->a = NULL;
+	f->m = NULL;
+	f->num = 0;
+}
+
+void fenwick_add( t_fenwick *f, int i, double da, double dm )
+{
+	for( ++i; i <= f->num; i += i & -i ){
+		f->a[i] += da;
+		f->m[i] += dm;
+	}
+}
+
+double fenwick_total( t_fenwick *f, double delta )
+{
+	double sum = 0;
+	int i;
+
+	for( i = f->num; i > 0; i -= i & -i )
+		sum += f->a[i] + delta * f->m[i];
+
+	return sum;
+}
+
+int fenwick_find( t_fenwick *f, double delta, double u )
+{
+	int pos = 0;
+	int step;
+	double w;
+
+	for( step = f->mask; step && f->num; step /= 2 ){
+		if( pos + step > f->num )
+			continue;
+
+		w = f->a[pos + step] + delta * f->m[pos + step];
+		if( w <= u ){
+			pos += step;
+			u -= w;
+		}
+	}
+
+	/* rounding might point past the end */
+	if( pos >= f->num )
+		pos = f->num -1;
+
+	return pos;
+}
+
+/************************************************************
+ * candidate set
+ */
+
+/* scorebase ^ score */
+static double pickset_mult( t_pickset *s, const t_pickcand *c )
+{
+	double m = 1;
+	int i;
+
+	if( s->conf.algo != pk_score )
+		return 1;
+
+	for( i = c->score; i > 0; --i )
+		m *= s->conf.scorebase;
+	for( ; i < 0; ++i )
+		m /= s->conf.scorebase;
+
+	return m;
+}
+
+/* weight grows by the time since the last play */
+static void pickset_weigh( t_pickset *s, int slot, int sign )
+{
+	t_pickcand *c = &s->cand[slot];
+	double m = pickset_mult( s, c );
+
+	fenwick_add( &s->weight, slot,
+			sign * (double)(s->base - c->lplay) * m,
+			sign * m );
+}
+
+/* Fisher-Yates */
+static void pickset_shuffle( t_pickset *s )
+{
+	int last = s->num ? s->order[s->num-1] : 0;
+	int i, j, tmp;
+
+	for( i = s->num -1; i > 0; --i ){
+		j = random() % (i + 1);
+		tmp = s->order[i];
+		s->order[i] = s->order[j];
+		s->order[j] = tmp;
+	}
+
+	/* don't repeat the last track of the previous cycle right away */
+	if( s->num > 1 && s->order[0] == last ){
+		j = 1 + random() % (s->num - 1);
+		s->order[0] = s->order[j];
+		s->order[j] = last;
+	}
+
+	s->cursor = 0;
+	s->cycle++;
+}
+
+int pickset_init( t_pickset *s, const t_pickconf *conf,
+		t_pickcand *cand, int num, int now )
+{
+	int i;
+
+	memset( s, 0, sizeof(t_pickset) );
+	s->conf = *conf;
+	s->cand = cand;
+	s->num = num;
+
+	s->slot = g_hash_table_new_full( g_direct_hash, g_direct_equal,
+			NULL, NULL );
+	for( i = 0; i < num; ++i )
+		g_hash_table_insert( s->slot, GINT_TO_POINTER(cand[i].id),
+				GINT_TO_POINTER(i+1) );
+
+	if( ! PICK_WEIGHTED( conf->algo )){
+		if( NULL == (s->order = malloc( (num + 1) * sizeof(int))))
+			goto clean1;
+
+		/* cand is ordered by lplay */
+		for( i = 0; i < num; ++i )
+			s->order[i] = i;
+
+		if( conf->algo == pk_shuffle )
+			pickset_shuffle( s );
+
+		return 0;
+	}
+
+	if( fenwick_init( &s->weight, num ))
+		goto clean1;
+
+	s->base = now;
+	for( i = 0; i < num; ++i )
+		pickset_weigh( s, i, 1 );
+
+	return 0;
+
+clean1:
+	/* leave freeing cand to the caller */
+	s->cand = NULL;
+	s->num = 0;
+	pickset_clear( s );
+	return -1;
+}
+
+void pickset_clear( t_pickset *s )
+{
+	int i;
+
+	for( i = 0; i < s->num; ++i )
+		free( s->cand[i].fname );
+	free( s->cand );
+	s->cand = NULL;
+	s->num = 0;
+
+	if( s->slot )
+		g_hash_table_destroy( s->slot );
+	s->slot = NULL;
+
+	free( s->order );
+	s->order = NULL;
+
+	fenwick_free( &s->weight );
+}
+
+int pickset_slot( t_pickset *s, int id )
+{
+	if( ! s->slot )
+		return -1;
+
+	return GPOINTER_TO_INT(g_hash_table_lookup( s->slot,
+				GINT_TO_POINTER(id))) - 1;
+}
+
+void pickset_played( t_pickset *s, int slot, int lplay )
+{
+	int i;
+
+	/* it's the most recent one now */
+	if( PICK_RANKED( s->conf.algo ) && s->order ){
+		for( i = 0; i < s->num && s->order[i] != slot; ++i )
+			;
+		if( i < s->num ){
+			memmove( s->order + i, s->order + i + 1,
+				(s->num - i - 1) * sizeof(int));
+			s->order[s->num-1] = slot;
+		}
+	}
+
+	if( s->weight.num ){
+		pickset_weigh( s, slot, -1 );
+		s->cand[slot].lplay = lplay;
+		pickset_weigh( s, slot, 1 );
+	} else {
+		s->cand[slot].lplay = lplay;
+	}
+}
+
+/* number of least recently played tracks to pick from */
+static int pickset_range( t_pickset *s )
+{
+	int num;
+
+	num = s->num * s->conf.percent / 100;
+	if( s->conf.max > 0 && num > s->conf.max )
+		num = s->conf.max;
+
+	if( num < 1 )
+		num = 1;
+
+	return num;
+}
+
+int pickset_pick( t_pickset *s, int now )
+{
+	double delta;
+	double total;
+	double u;
+
+	if( s->num < 1 )
+		return -1;
+
+	if( s->conf.algo == pk_shuffle ){
+		if( s->cursor >= s->num )
+			pickset_shuffle( s );
+		return s->order[s->cursor++];
+	}
+
+	if( ! PICK_WEIGHTED( s->conf.algo ))
+		return s->order[pick_rank( s->conf.algo, pickset_range(s) )];
+
+	delta = now - s->base;
+	if( 0 >= (total = fenwick_total( &s->weight, delta )))
+		return 0;
+
+	u = (double)random() / ((double)RAND_MAX + 1) * total;
+	return fenwick_find( &s->weight, delta, u );
+}
+
+int pickset_resume( t_pickset *s, const int *ids, int num, int cursor )
+{
+	char *seen;
+	int *order;
+	int played = 0;
+	int n = 0;
+	int slot;
+	int i, j;
+
+	if( NULL == (seen = calloc( s->num + 1, 1 )))
+		return -1;
+
+	if( NULL == (order = malloc( (s->num + 1) * sizeof(int)))){
+		free( seen );
+		return -1;
+	}
+
+	/* keep the saved order of tracks still there */
+	for( i = 0; i < num; ++i ){
+		if( 0 > (slot = pickset_slot( s, ids[i] )) || seen[slot] )
+			continue;
+
+		seen[slot] = 1;
+		order[n++] = slot;
+		if( i < cursor )
+			++played;
+	}
+
+	/* inside-out Fisher-Yates for new ones, behind the cursor */
+	for( slot = 0; slot < s->num; ++slot ){
+		if( seen[slot] )
+			continue;
+
+		j = played + random() % (n - played + 1);
+		order[n++] = order[j];
+		order[j] = slot;
+	}
+
+	free( seen );
+	free( s->order );
+	s->order = order;
+	s->cursor = played;
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PGDB_PICK_H
+#define _PGDB_PICK_H
+
+#include <glib.h>
+
+/*
+ * algorithms for picking a random track. See test_random.c on how the
+ * rank based ones are distributed.
+ */
+typedef enum {
+	/* rank based: pick from the least recently played tracks */
+	pk_plain,	/* evenly */
+	pk_abs,		/* folded and shifted gaussian */
+	pk_divi,	/* more drastic */
+	pk_first,	/* always the least recently played one */
+
+	/* weighted: any track, the longer ago it was played the likelier */
+	pk_lastplay,	/* weight: seconds since last play */
+	pk_score,	/* same, times scorebase^score */
+
+	/* walk a permutation: no repeats until all tracks were played */
+	pk_shuffle,
+} t_pickalgo;
+
+#define PICK_RANKED(a)		((a) <= pk_first)
+#define PICK_WEIGHTED(a)	((a) == pk_lastplay || (a) == pk_score)
+
+/* returns algorithm by name or -1 */
+int pick_algo( const char *name );
+
+/* rank to pick for the rank based algorithms: 0..num-1 */
+int pick_rank( t_pickalgo algo, int num );
+
+
+/*
+ * Fenwick tree of weights that grow linearly with time:
+ *
+ *  weight(i) = a(i) + delta * m(i)
+ *
+ * delta is passed in by the caller for lookups. Updates and lookups
+ * are O(log n).
+ */
+typedef struct {
+	int num;
+	int mask;	/* highest power of 2 <= num */
+	double *a;
+	double *m;
+} t_fenwick;
+
+int fenwick_init( t_fenwick *f, int num );
+void fenwick_free( t_fenwick *f );
+void fenwick_add( t_fenwick *f, int i, double da, double dm );
+double fenwick_total( t_fenwick *f, double delta );
+/* index of the entry covering u - 0 <= u < total */
+int fenwick_find( t_fenwick *f, double delta, double u );
+
+
+/*
+ * in-memory candidates to pick from. Slots don't move until the set is
+ * rebuilt. Times are passed in to allow simulation (see test_random.c).
+ */
+typedef struct {
+	int id;
+	int lplay;
+	int score;
+	char *fname;
+} t_pickcand;
+
+typedef struct {
+	t_pickalgo algo;
+	int percent;		/* rank based: range in % of candidates */
+	int max;		/* rank based: max range, 0: unlimited */
+	double scorebase;	/* pk_score: weight factor per score point */
+} t_pickconf;
+
+typedef struct {
+	t_pickconf conf;
+
+	t_pickcand *cand;
+	int num;
+
+	/* id -> slot + 1 */
+	GHashTable *slot;
+
+	/* rank based algorithms: slots ordered by lplay
+	 * pk_shuffle: permutation of slots */
+	int *order;
+	/* pk_shuffle: next position in order */
+	int cursor;
+	/* pk_shuffle: bumped for each new permutation */
+	unsigned int cycle;
+
+	/* weighted algorithms: weights relative to base */
+	t_fenwick weight;
+	int base;
+} t_pickset;
+
+/* takes ownership of cand, which must be ordered by lplay */
+int pickset_init( t_pickset *s, const t_pickconf *conf,
+		t_pickcand *cand, int num, int now );
+void pickset_clear( t_pickset *s );
+/* returns slot of track id or -1 */
+int pickset_slot( t_pickset *s, int id );
+void pickset_played( t_pickset *s, int slot, int lplay );
+/*
+ * returns a random slot or -1 when empty. pk_shuffle: check cycle to
+ * find out if a new permutation was started.
+ */
+int pickset_pick( t_pickset *s, int now );
+/*
+ * pk_shuffle: continue a permutation of track ids saved earlier. Ids
+ * that are gone are dropped, new tracks are shuffled into the part not
+ * yet played.
+ */
+int pickset_resume( t_pickset *s, const int *ids, int num, int cursor );
+
+#endif
@@ -12,26 +12,90 @@
  * disabling queue processing */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 
 #include <config.h>
+#include <opt.h>
+#include <commondb/zone.h>
 #include "track.h"
+#include "filter.h"
 #include "queue.h"
 
 t_queue_func_clear queue_func_clear = NULL;
 t_queue_func_fetch queue_func_add = NULL;
 t_queue_func_fetch queue_func_del = NULL;
 t_queue_func_fetch queue_func_fetch = NULL;
+t_queue_func_addlist queue_func_addlist = NULL;
+
+enum {
+	qc_id,
+	qc_uid,
+	qc_queued,
+	qc_fileid,
+	qc_max
+};
+
+static const char *queue_cols[] = {
+	[qc_id]		= "qid",
+	[qc_uid]	= "user_id",
+	[qc_queued]	= "queued",
+	[qc_fileid]	= "file_id",
+	[qc_max]	= NULL,
+};
+
+/*
+ * in memory copy of mserv_queue, ordered by id.
+ *
+ * Modifications are written to the DB first and applied to the mirror
+ * when they succeeded. The mirror is reloaded when the DB connection is
+ * (re-)established.
+ *
+ * mserv_queue has no notion of zones. It only backs zone 0, the queues
+ * of other zones live in memory only. They still take their ids from
+ * mserv_queue_id_seq to keep them unique.
+ *
+ * With queue_fair the play order is derived from the mirror by start
+ * time fair queuing: each entry gets a virtual start tag. A user's
+ * first entry starts at max(user's finish, vtime), each further one
+ * where the previous finished. Entries are played by tag, then id.
+ */
+typedef struct {
+	int uid;
+	double finish;	/* virtual time the user's last track finished */
+} t_fairuser;
+
+typedef struct {
+	t_queue **q;
+	int num;
+	int size;
+	/* total duration of all queued tracks */
+	int sum;
+
+	/* fair queuing: tag of last fetched entry */
+	double vtime;
+	/* users served recently */
+	t_fairuser *fair;
+	int fair_num;
+} t_mirror;
+
+static t_mirror mirrors[ZONE_MAX];
+
+#define MIRROR	(&mirrors[zone_cur])
+
+static t_user *queue_user( int uid );
 
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing queue data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing queue data: %s", queue_cols[field] ); \
 		goto gofail; \
 	}
 
-static t_queue *queue_convert( PGresult *res, int tup )
+static t_queue *queue_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_queue *q;
 	int uid;
 	int f;
@@ -42,42 +106,56 @@ static t_queue *queue_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (q = malloc(sizeof(t_queue))))
+	if( NULL == (col = db_colmap( r, queue_cols )))
+		return NULL;
+
+	if( NULL == (q = arena_alloc( r->arena, sizeof(t_queue))))
 		return NULL;
 	memset(q, 0, sizeof(t_queue));
 
 	q->_refs = 1;
+	q->_arena = NULL != r->arena;
 
-	GETFIELD(f,"qid", clean1 );
+	GETFIELD(f,qc_id, clean1 );
 	q->id = pgint(res, tup, f);
 
-	GETFIELD(f,"user_id", clean1 );
+	GETFIELD(f,qc_uid, clean1 );
 	uid = pgint(res, tup, f);
 
-	GETFIELD(f,"queued", clean1 );
+	GETFIELD(f,qc_queued, clean1 );
 	q->queued = pgint(res, tup, f );
 
-	if( NULL == ( q->user = user_get(uid)))
+	if( NULL == ( q->user = queue_user(uid)))
 		goto clean1;
 
 	/* when there is a file_id, fetch this track seperately */
-	if( -1 != (f = PQfnumber(res,"file_id"))){
+	if( -1 != (f = col[qc_fileid])){
 		q->track = track_get(pgint(res,tup,f));
+		if( q->track && arena_cleanup( r->arena,
+				(t_arena_cleanup)track_free, q->track )){
+
+			track_free(q->track);
+			goto clean2;
+		}
 
 	/* otherwise try to get the data from current result */
 	} else {
-		q->track = track_convert( res, tup );
+		q->track = track_convert( r, tup );
 	}
 	if( NULL == q->track )
 		goto clean2;
 
+	/* the user is shared with the heap, drop it with the arena */
+	if( arena_cleanup( r->arena, (t_arena_cleanup)user_free, q->user ))
+		goto clean2;
+
 	return q;
 
 clean2:
 	user_free(q->user);
 
 clean1:
-	free(q);
+	arena_free(r->arena, q);
 
 	return NULL;
 }
@@ -87,6 +165,9 @@ void queue_free( t_queue *q )
 	if( ! q )
 		return;
 
+	if( q->_arena )
+		return;
+
 	if( -- q->_refs > 0 )
 		return;
 
@@ -108,63 +189,462 @@ t_track *queue_track( t_queue *q )
 	if( ! q )
 		return NULL;
 
-	track_use(q->track);
-	return q->track;
+	return track_use(q->track);
 }
 
-t_queue *queue_get( int id )
+/************************************************************
+ * mirror maintenance
+ */
+
+/* returns index of queue entry with given id or -1 */
+static int mirror_find( t_mirror *m, int qid )
+{
+	int lo = 0;
+	int hi = m->num;
+
+	while( lo < hi ){
+		int mid = (lo + hi) / 2;
+
+		if( m->q[mid]->id == qid )
+			return mid;
+
+		if( m->q[mid]->id < qid )
+			lo = mid +1;
+		else
+			hi = mid;
+	}
+
+	return -1;
+}
+
+/* takes over the reference to q */
+static int mirror_insert( t_mirror *m, t_queue *q )
+{
+	int i;
+
+	if( 0 <= mirror_find( m, q->id )){
+		queue_free(q);
+		return 0;
+	}
+
+	if( m->num >= m->size ){
+		t_queue **tmp;
+		int size = m->size ? m->size * 2 : 64;
+
+		if( NULL == (tmp = realloc(m->q, size * sizeof(t_queue*)))){
+			queue_free(q);
+			return -1;
+		}
+		m->q = tmp;
+		m->size = size;
+	}
+
+	/* new entries usually go to the end */
+	for( i = m->num; i > 0 && m->q[i-1]->id > q->id; --i )
+		m->q[i] = m->q[i-1];
+
+	m->q[i] = q;
+	m->num++;
+	m->sum += q->track->duration;
+
+	return 0;
+}
+
+/* returns the removed entry - caller has to free it */
+static t_queue *mirror_remove( t_mirror *m, int idx )
 {
-	PGresult *res;
 	t_queue *q;
 
+	q = m->q[idx];
+	m->num--;
+	memmove( m->q + idx, m->q + idx +1,
+			(m->num - idx) * sizeof(t_queue*) );
+	m->sum -= q->track->duration;
+
+	return q;
+}
+
+static void mirror_clear( t_mirror *m )
+{
+	while( m->num > 0 )
+		queue_free( mirror_remove( m, m->num -1 ));
+
+	m->sum = 0;
+}
+
+/************************************************************
+ * fair queuing
+ */
+
+/* entry in effective play order */
+typedef struct {
+	double tag;
+	int idx;
+} t_fairent;
+
+/* virtual time a track occupies: 1=per track, 2=by duration */
+static double fair_cost( t_queue *q )
+{
+	if( opt_queue_fair == 2 && q->track->duration > 0 )
+		return q->track->duration;
+
+	return 1;
+}
+
+static t_fairuser *fair_user( t_fairuser *users, int num, int uid )
+{
+	int i;
+
+	for( i = 0; i < num; ++i ){
+		if( users[i].uid == uid )
+			return &users[i];
+	}
+
+	return NULL;
+}
+
+static int fair_cmp( const void *a, const void *b )
+{
+	const t_fairent *x = a;
+	const t_fairent *y = b;
+
+	if( x->tag != y->tag )
+		return x->tag < y->tag ? -1 : 1;
+
+	return x->idx - y->idx;
+}
+
+/*
+ * returns mirror entries in play order - to free by caller
+ */
+static t_fairent *fair_order( t_mirror *m )
+{
+	t_fairent *ent;
+	t_fairuser *run;
+	t_fairuser *u;
+	t_fairuser *f;
+	int num = 0;
+	int i;
+
+	if( NULL == (ent = malloc( (m->num + 1) * sizeof(t_fairent))))
+		return NULL;
+
+	/* start tag of each user's next entry */
+	if( NULL == (run = malloc( (m->num + 1) * sizeof(t_fairuser)))){
+		free( ent );
+		return NULL;
+	}
+
+	for( i = 0; i < m->num; ++i ){
+		int uid = m->q[i]->user->id;
+
+		if( NULL == (u = fair_user( run, num, uid ))){
+			u = &run[num++];
+			u->uid = uid;
+			u->finish = m->vtime;
+
+			f = fair_user( m->fair, m->fair_num, uid );
+			if( f && f->finish > u->finish )
+				u->finish = f->finish;
+		}
+
+		ent[i].tag = u->finish;
+		ent[i].idx = i;
+		u->finish += fair_cost( m->q[i] );
+	}
+	free( run );
+
+	qsort( ent, m->num, sizeof(t_fairent), fair_cmp );
+	return ent;
+}
+
+/* account the entry with given tag as played */
+static void fair_served( t_mirror *m, t_queue *q, double tag )
+{
+	t_fairuser *u;
+	t_fairuser *tmp;
+	int i;
+
+	m->vtime = tag;
+
+	/* users that caught up start at vtime anyway */
+	for( i = 0; i < m->fair_num; ){
+		if( m->fair[i].finish <= m->vtime )
+			m->fair[i] = m->fair[--m->fair_num];
+		else
+			++i;
+	}
+
+	if( NULL == (u = fair_user( m->fair, m->fair_num, q->user->id ))){
+		if( NULL == (tmp = realloc( m->fair, (m->fair_num + 1)
+						* sizeof(t_fairuser))))
+			return;
+
+		m->fair = tmp;
+		u = &m->fair[m->fair_num++];
+		u->uid = q->user->id;
+	}
+
+	u->finish = tag + fair_cost( q );
+}
+
+/* nothing queued anymore: forget who was served */
+static void fair_reset( t_mirror *m )
+{
+	free( m->fair );
+	m->fair = NULL;
+	m->fair_num = 0;
+	m->vtime = 0;
+}
+
+/* queued tracks of one user share the user struct */
+static t_user *queue_user( int uid )
+{
+	t_mirror *m = MIRROR;
+	int i;
+
+	for( i = 0; i < m->num; ++i ){
+		if( m->q[i]->user->id == uid )
+			return user_use( m->q[i]->user );
+	}
+
+	return user_get(uid);
+}
+
+/* add all queue entries of a result to the mirror */
+static int mirror_loadres( t_mirror *m, PGresult *res )
+{
+	/* one for all rows to keep the column maps */
+	t_dbres r = { .res = res };
+	t_queue *q;
+	int num = 0;
+	int i;
+
+	for( i = 0; i < PQntuples(res); ++i ){
+		if( NULL == (q = queue_convert( &r, i )))
+			continue;
+
+		if( 0 == mirror_insert( m, q ))
+			num++;
+	}
+
+	return num;
+}
+
+/*
+ * read queue entries from DB into the mirror. where restricts the
+ * entries to load (may be NULL). Returns number of loaded entries.
+ */
+static int queue_load( const char *where )
+{
+	PGresult *res;
+	int num;
+
 	res = db_query( "SELECT "
-				"id AS qid,"
-				"file_id,"
-				"time2unix(added) as queued,"
-				"user_id "
-			"FROM mserv_queue "
-			"WHERE id = %d", id );
+				"q.id AS qid,"
+				"time2unix(q.added) as queued,"
+				"q.user_id, "
+				"t.* "
+			"FROM mserv_queue q "
+				"INNER JOIN mserv_track t "
+				"ON t.id = q.file_id "
+			"%s "
+			"ORDER BY q.id", where ? where : "" );
 	if( ! res || PQresultStatus(res) != PGRES_TUPLES_OK ){
-		syslog( LOG_ERR, "queue_get: %s", db_errstr() );
+		syslog( LOG_ERR, "queue_load: %s", db_errstr() );
 		PQclear(res);
-		return NULL;
+		return -1;
 	}
 
-	q = queue_convert( res, 0 );
+	num = mirror_loadres( &mirrors[0], res );
 	PQclear(res);
 
-	return q;
+	return num;
 }
 
-t_queue *queue_fetch( void )
+int queue_init( void )
 {
-	PGresult *res;
+	int zone = zone_cur;
+
+	/* only zone 0 is kept in the DB */
+	zone_cur = 0;
+	mirror_clear( MIRROR );
+
+	if( 0 > queue_load( NULL )){
+		zone_cur = zone;
+		return -1;
+	}
+
+	zone_cur = zone;
+	return 0;
+}
+
+/*
+ * another instance modified mserv_queue. Reload it and report the
+ * differences like local modifications.
+ */
+void queue_notified( const char *arg )
+{
+	t_mirror *m = &mirrors[0];
+	t_mirror old = *m;
 	t_queue *q;
+	int zone = zone_cur;
+	int i;
+
+	(void)arg;
+
+	zone_cur = 0;
+	memset( m, 0, sizeof(t_mirror) );
+	m->vtime = old.vtime;
+	m->fair = old.fair;
+	m->fair_num = old.fair_num;
+	if( 0 > queue_load( NULL )){
+		mirror_clear( m );
+		free( m->q );
+		*m = old;
+		zone_cur = zone;
+		return;
+	}
 
-	res = db_query( "SELECT "
+	for( i = 0; i < old.num; ++i ){
+		if( 0 <= mirror_find( m, old.q[i]->id ))
+			continue;
+
+		if( queue_func_del )
+			(*queue_func_del)( old.q[i] );
+	}
+
+	for( i = 0; i < m->num; ++i ){
+		q = m->q[i];
+		if( 0 <= mirror_find( &old, q->id ))
+			continue;
+
+		if( queue_func_add )
+			(*queue_func_add)( q );
+	}
+
+	mirror_clear( &old );
+	free( old.q );
+	zone_cur = zone;
+}
+
+/************************************************************
+ * queue access
+ */
+
+t_queue *queue_get( int id )
+{
+	t_mirror *m = MIRROR;
+	int i;
+
+	if( 0 > (i = mirror_find(m, id)))
+		return NULL;
+
+	queue_use( m->q[i] );
+	return m->q[i];
+}
+
+/*
+ * remove + return the entry picked by sel in one go. Other instances
+ * on the same DB might be fetching concurrently: don't wait for the
+ * entry they've locked.
+ */
+static PGresult *queue_dbfetch( const char *sel )
+{
+	PGresult *res;
+
+	res = db_query( "DELETE FROM mserv_queue "
+			"WHERE id = ( "
+				"SELECT id FROM mserv_queue "
+				"%s "
+				"LIMIT 1 "
+				"FOR UPDATE SKIP LOCKED ) "
+			"RETURNING "
 				"id AS qid,"
 				"file_id,"
 				"time2unix(added) as queued,"
-				"user_id "
-			"FROM mserv_queue "
-			"ORDER BY id "
-			"LIMIT 1" );
+				"user_id", sel );
 	if( ! res || PQresultStatus(res) != PGRES_TUPLES_OK ){
 		syslog( LOG_ERR, "queue_fetch: %s", db_errstr() );
 		PQclear(res);
 		return NULL;
 	}
 
-	q = queue_convert( res, 0 );
+	if( PQntuples(res) < 1 ){
+		PQclear(res);
+		return NULL;
+	}
+
+	return res;
+}
+
+t_queue *queue_fetch( void )
+{
+	t_mirror *m = MIRROR;
+	PGresult *res = NULL;
+	t_fairent *ent;
+	t_queue *q;
+	char sel[64];
+	double tag = 0;
+	int head = 0;
+	int fairid = 0;
+	int qid;
+	int i;
+
+	if( m->num < 1 && (zone_cur || ! db_isup()) )
+		return NULL;
+
+	/* head of the fair play order */
+	if( opt_queue_fair && m->num > 0 && NULL != (ent = fair_order(m))){
+		head = ent[0].idx;
+		tag = ent[0].tag;
+		fairid = m->q[head]->id;
+		free( ent );
+	}
+
+	/* memory-only queue of another zone */
+	if( zone_cur ){
+		q = mirror_remove(m, head);
+		goto found;
+	}
+
+	/* DB is down: play from the mirror, delete later */
+	if( ! db_isup() ){
+		q = mirror_remove(m, head);
+		db_spool( "DELETE FROM mserv_queue WHERE id = %d", q->id );
+		goto found;
+	}
+
+	/* fall back to the lowest id, when the fair pick is gone */
+	if( head ){
+		snprintf( sel, sizeof(sel), "WHERE id = %d", m->q[head]->id );
+		res = queue_dbfetch( sel );
+	}
+
+	if( ! res && NULL == (res = queue_dbfetch( "ORDER BY id" )))
+		return NULL;
+
+	qid = pgint(res, 0, PQfnumber(res, "qid"));
+	if( 0 <= (i = mirror_find(m, qid))){
+		q = mirror_remove(m, i);
+	} else {
+		/* mirror is out of sync - use the DB's data */
+		q = queue_convert( DBRES(res), 0 );
+	}
 	PQclear(res);
 
 	if( ! q )
 		return NULL;
 
-	res = db_query( "DELETE FROM mserv_queue WHERE id =%d", q->id);
-	if( ! res || PQresultStatus(res) != PGRES_COMMAND_OK )
-		syslog( LOG_ERR, "queue_fetch: %s", db_errstr() );
-	PQclear(res);
+	db_notify( "queue", NULL );
+
+found:
+	if( opt_queue_fair ){
+		if( m->num < 1 )
+			fair_reset( m );
+		else if( q->id == fairid )
+			fair_served( m, q, tag );
+	}
 
 	if(queue_func_fetch)
 		(*queue_func_fetch)( q );
@@ -173,89 +653,309 @@ t_queue *queue_fetch( void )
 
 it_queue *queue_list( void )
 {
-	return db_iterate( (db_convert)queue_convert, "SELECT "
-				"q.id AS qid,"
-				"time2unix(q.added) as queued,"
-				"q.user_id, "
+	t_mirror *m = MIRROR;
+	t_fairent *ent = NULL;
+	it_queue *it;
+	int i;
+
+	if( NULL == (it = malloc(sizeof(it_queue))))
+		return NULL;
+
+	it->num = m->num;
+	it->cur = 0;
+
+	if( NULL == (it->queue = malloc( (m->num +1) * sizeof(t_queue*)))){
+		free(it);
+		return NULL;
+	}
+
+	/* effective play order */
+	if( opt_queue_fair )
+		ent = fair_order( m );
+
+	for( i = 0; i < m->num; ++i ){
+		it->queue[i] = m->q[ ent ? ent[i].idx : i ];
+		queue_use( it->queue[i] );
+	}
+	free( ent );
+
+	return it;
+}
+
+t_queue *it_queue_begin( it_queue *it )
+{
+	if( ! it )
+		return NULL;
+	it->cur = 0;
+	return it_queue_cur(it);
+}
+
+t_queue *it_queue_cur( it_queue *it )
+{
+	t_queue *q;
+
+	if( ! it )
+		return NULL;
+	if( it->cur >= it->num )
+		return NULL;
+
+	q = it->queue[it->cur];
+	queue_use(q);
+	return q;
+}
+
+t_queue *it_queue_next( it_queue *it )
+{
+	if( ! it )
+		return NULL;
+	if( it->cur >= it->num )
+		return NULL;
+	it->cur++;
+	return it_queue_cur(it);
+}
+
+void it_queue_done( it_queue *it )
+{
+	if( ! it )
+		return;
+
+	for( it->cur = 0; it->cur < it->num; it->cur++ )
+		queue_free( it->queue[it->cur] );
+	free(it->queue);
+	free(it);
+}
+
+/*
+ * queue all tracks returned by the (ordered) subquery sel in a single
+ * statement and add them to the mirror. Returns the number of queued
+ * tracks or -1. *first gets the queue id of the first new entry.
+ */
+/*
+ * queue_addsel() for zones without DB backing: number the selected
+ * tracks and fetch them in one go.
+ */
+static int queue_addmem( const char *sel, int uid, int *first )
+{
+	PGresult *res;
+	int num;
+
+	res = db_query( "SELECT "
+				"s.qid,"
+				"time2unix(now()) AS queued,"
+				"%d AS user_id, "
 				"t.* "
-			"FROM mserv_queue q "
+			"FROM ( "
+				"SELECT nextval('mserv_queue_id_seq') AS qid,"
+					"s.id "
+				"FROM ( %s ) AS s "
+			") AS s "
 				"INNER JOIN mserv_track t "
-				"ON t.id = q.file_id "
-			"ORDER BY q.id" );
+				"ON t.id = s.id "
+			"ORDER BY s.qid", uid, sel );
+	if( !res || PQresultStatus(res) != PGRES_TUPLES_OK ){
+		syslog( LOG_ERR, "queue_addmem: %s", db_errstr());
+		PQclear(res);
+		return -1;
+	}
+
+	if( first && PQntuples(res) )
+		*first = pgint(res, 0, PQfnumber(res, "qid"));
+
+	num = mirror_loadres( MIRROR, res );
+	PQclear(res);
+
+	return num;
 }
 
-int queue_add( int trackid, int uid )
+static int queue_addsel( const char *sel, int uid, int *first )
 {
 	PGresult *res;
-	int qid;
+	char *where, *p;
+	int num;
+	int i;
 
-	res = db_query( "SELECT nextval('mserv_queue_id_seq')" );
+	if( zone_cur )
+		return queue_addmem( sel, uid, first );
+
+	res = db_query( "INSERT INTO mserv_queue(id, file_id, user_id) "
+			"SELECT nextval('mserv_queue_id_seq'), s.id, %d "
+			"FROM ( %s ) AS s "
+			"RETURNING id", uid, sel );
 	if( !res || PQresultStatus(res) != PGRES_TUPLES_OK ){
-		syslog( LOG_ERR, "queue_add: %s", db_errstr());
+		syslog( LOG_ERR, "queue_addsel: %s", db_errstr());
 		PQclear(res);
 		return -1;
 	}
 
-	if( 0 > (qid = pgint(res,0,0))){
+	if( 0 == (num = PQntuples(res))){
 		PQclear(res);
-		return -1;
+		return 0;
 	}
-	PQclear(res);
 
-	res = db_query( "INSERT INTO mserv_queue(id, file_id, user_id) "
-			"VALUES( %d, %d, %d )", qid, trackid, uid );
-	if( !res || PQresultStatus(res) != PGRES_COMMAND_OK ){
-		syslog( LOG_ERR, "queue_add: %s", db_errstr());
+	if( first )
+		*first = pgint(res, 0, 0);
+
+	/* fetch the new entries with their tracks */
+	if( NULL == (where = malloc( 32 + num * 12 ))){
 		PQclear(res);
 		return -1;
 	}
 
+	p = where + sprintf( where, "WHERE q.id IN (" );
+	for( i = 0; i < num; ++i )
+		p += sprintf( p, "%s%d", i ? "," : "", pgint(res, i, 0));
+	sprintf( p, ")" );
 	PQclear(res);
 
-	if( queue_func_add ){
-		t_queue *q = queue_get(qid);
-		if( q != NULL ){
-			(*queue_func_add)(q);
-			queue_free(q);
-		}
-	}
+	if( 0 > queue_load( where ))
+		num = -1;
+	free(where);
+
+	db_notify( "queue", NULL );
+	return num;
+}
+
+int queue_add( int trackid, int uid )
+{
+	char sel[128];
+	int qid;
+	int i;
+
+	snprintf( sel, 128, "SELECT id FROM mserv_track WHERE id = %d",
+			trackid );
+
+	if( 0 >= queue_addsel( sel, uid, &qid ))
+		return -1;
+
+	if( queue_func_add && 0 <= (i = mirror_find(MIRROR, qid)))
+		(*queue_func_add)(MIRROR->q[i]);
 
 	return qid;
 }
 
+int queue_addlist( const int *ids, int num, int uid, int *first )
+{
+	char *sel, *p;
+	int r;
+	int i;
+
+	if( num <= 0 )
+		return 0;
+
+	/* VALUES (id,pos),... - 2 * 10 digits + punctuation */
+	if( NULL == (sel = malloc( 128 + num * 26 )))
+		return -1;
+
+	p = sel + sprintf( sel, "SELECT v.id FROM ( VALUES " );
+	for( i = 0; i < num; ++i )
+		p += sprintf( p, "%s(%d,%d)", i ? "," : "", ids[i], i );
+	sprintf( p, " ) AS v(id,pos) "
+			"INNER JOIN mserv_track t "
+			"ON t.id = v.id "
+			"ORDER BY v.pos" );
+
+	r = queue_addsel( sel, uid, first );
+	free(sel);
+
+	if( r > 0 && queue_func_addlist )
+		(*queue_func_addlist)( r );
+
+	return r;
+}
+
+int queue_addalbum( int albumid, int uid )
+{
+	char sel[256];
+	int r;
+
+	snprintf( sel, 256, "SELECT id "
+			"FROM mserv_track "
+			"WHERE album_id = %d "
+			"ORDER BY album_pos", albumid );
+
+	r = queue_addsel( sel, uid, NULL );
+	if( r > 0 && queue_func_addlist )
+		(*queue_func_addlist)( r );
+
+	return r;
+}
+
+int queue_addfilter( expr *filter, int uid )
+{
+	char *where;
+	char *sel;
+	int r;
+
+	if( NULL == (where = sql_where( filter ))){
+		syslog( LOG_ERR, "queue_addfilter skipped: invalid filter");
+		return -1;
+	}
+
+	sel = g_strdup_printf( "SELECT id "
+			"FROM mserv_track t "
+			"WHERE %s "
+			"ORDER BY LOWER(album_artist_name), "
+				"LOWER(album_name), album_pos",
+			where );
+	free( where );
+
+	r = queue_addsel( sel, uid, NULL );
+	g_free( sel );
+	if( r > 0 && queue_func_addlist )
+		(*queue_func_addlist)( r );
+
+	return r;
+}
+
 int queue_del( int queueid, int uid )
 {
+	t_mirror *m = MIRROR;
 	PGresult *res;
-	t_queue *q = NULL;
+	t_queue *q;
+	int i;
 
-	if( queue_func_del )
-		q = queue_get(queueid);
+	if( zone_cur ){
+		if( 0 > (i = mirror_find(m, queueid)))
+			return 1;
+
+		if( uid && m->q[i]->user->id != uid )
+			return 1;
+
+		goto found;
+	}
 
 	if( uid ){
 		res = db_query( "DELETE FROM mserv_queue "
-				"WHERE id = %d and user_id = %d",
+				"WHERE id = %d and user_id = %d "
+				"RETURNING id",
 				queueid, uid );
 	} else {
-		res = db_query( "DELETE FROM mserv_queue WHERE id = %d",
+		res = db_query( "DELETE FROM mserv_queue WHERE id = %d "
+				"RETURNING id",
 				queueid );
 	}
-	if( !res || PQresultStatus(res) != PGRES_COMMAND_OK ){
+	if( !res || PQresultStatus(res) != PGRES_TUPLES_OK ){
 		syslog( LOG_ERR, "queue_del: %s", db_errstr());
 		PQclear(res);
 		return 1;
 	}
 
-	if( ! PQcmdTuples(res)){
+	if( ! PQntuples(res)){
 		PQclear(res);
 		return 1;
 	}
 
 	PQclear(res);
+	db_notify( "queue", NULL );
 
-	if(queue_func_del && q){
+	if( 0 > (i = mirror_find(m, queueid)))
+		return 0;
+
+found:
+	q = mirror_remove(m, i);
+	if(queue_func_del)
 		(*queue_func_del)( q );
-		queue_free(q);
-	}
+	queue_free(q);
 
 	return 0;
 }
@@ -264,6 +964,9 @@ int queue_clear( void )
 {
 	PGresult *res;
 
+	if( zone_cur )
+		goto clear;
+
 	res = db_query( "DELETE FROM mserv_queue" );
 	if( !res || PQresultStatus(res) != PGRES_COMMAND_OK ){
 		syslog( LOG_ERR, "queue_clear: %s", db_errstr());
@@ -272,6 +975,9 @@ int queue_clear( void )
 	}
 
 	PQclear(res);
+	db_notify( "queue", NULL );
+clear:
+	mirror_clear( MIRROR );
 
 	if(queue_func_clear)
 		(*queue_func_clear)();
@@ -281,28 +987,6 @@ int queue_clear( void )
 
 int queue_sum( void )
 {
-	PGresult *res;
-	int sum;
-
-	res = db_query( "SELECT SUM(time2unix(f.duration)) "
-			"FROM mserv_queue q "
-			"INNER JOIN stor_file f ON q.file_id = f.id" );
-	if( !res || PQresultStatus(res) != PGRES_TUPLES_OK ){
-		syslog( LOG_ERR, "queue_sum: %s", db_errstr());
-		PQclear(res);
-		return -1;
-	}
-
-	if( PQntuples(res) == 1 ){
-		sum = pgint(res,0,0);
-	} else {
-		sum = 0;
-	}
-	PQclear(res);
-
-	return sum;
+	return MIRROR->sum;
 }
 
-
-
-
@@ -7,44 +7,506 @@
  *
  */
 
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <syslog.h>
 
 #include <config.h>
+#include <opt.h>
 #include <commondb/random.h>
+#include <commondb/avail.h>
+#include <commondb/zone.h>
 #include "dudldb.h"
 #include "track.h"
 #include "filter.h"
+#include "pick.h"
+#include "sfcache.h"
+#include "tagidx.h"
 
 
 
+t_random_func random_func_filter = NULL;
 
-expr *filter = NULL;
+/*
+ * each zone picks from its own filter. Zone 0 uses juke_cache, others
+ * juke_cache<zone>.
+ */
+typedef struct {
+	char table[16];
+	expr *filter;
 
+	/*
+	 * in-memory copy of juke_cache. Tracks are picked from here. It
+	 * keeps the player going while the DB is down and is used to
+	 * restore juke_cache after a reconnect.
+	 */
+	t_pickset set;
 
-#define RANDOM_LIMIT 1000
+	/* filter was changed while the DB was down */
+	int filter_pending;
 
-t_random_func random_func_filter = NULL;
+	/* pk_shuffle: permutation in the shuffle file */
+	unsigned int shuffle_cycle;
+
+	/* track pre-picked by random_peek(), 0: none */
+	int next_id;
+	int next_slot;
+	int next_lplay;
+} t_rzone;
+
+static t_rzone rzones[ZONE_MAX];
+
+/* configured pick algorithm, -1: not yet looked up */
+static int algo_cur = -1;
 
-static int fill_cache( expr *filt )
+static t_pickalgo random_algo( void )
+{
+	if( algo_cur >= 0 )
+		return algo_cur;
+
+	if( 0 > (algo_cur = pick_algo( opt_random_algo ))){
+		syslog( LOG_ERR, "random: unknown random_algo %s, using abs",
+				opt_random_algo );
+		algo_cur = pk_abs;
+	}
+
+	return algo_cur;
+}
+
+/* random state of current zone */
+static t_rzone *rzone( void )
+{
+	t_rzone *z = &rzones[zone_cur];
+
+	if( ! *z->table ){
+		if( zone_cur )
+			snprintf( z->table, sizeof(z->table),
+					"juke_cache%d", zone_cur );
+		else
+			strcpy( z->table, "juke_cache" );
+	}
+
+	return z;
+}
+
+/*
+ * build a VALUES list of (tag, score) from random_scoretags
+ * "tag:score;tag:score"
+ */
+static int cand_scoretags( char *buf, size_t len )
+{
+	char *tags;
+	char *tok;
+	char *sep;
+	char *save = NULL;
+	char *name;
+	size_t used = 0;
+	int r;
+
+	*buf = 0;
+	if( random_algo() != pk_score || ! opt_random_scoretags )
+		return 0;
+
+	if( NULL == (tags = strdup( opt_random_scoretags )))
+		return -1;
+
+	for( tok = strtok_r( tags, ";", &save ); tok;
+			tok = strtok_r( NULL, ";", &save )){
+
+		if( NULL == (sep = strchr( tok, ':' ))){
+			syslog( LOG_ERR, "random_scoretags: missing score "
+					"for %s", tok );
+			continue;
+		}
+		*sep++ = 0;
+
+		if( NULL == (name = db_escape( tok )))
+			break;
+
+		r = snprintf( buf + used, len - used, "%s('%s',%d)",
+				used ? "," : "", name, atoi(sep) );
+		free( name );
+		if( r < 0 || (size_t)r >= len - used ){
+			syslog( LOG_ERR, "random_scoretags: too many tags" );
+			break;
+		}
+		used += r;
+	}
+
+	free( tags );
+	return 0;
+}
+
+/************************************************************
+ * shuffle state: the permutation of track ids and the cursor
+ * into it survive restarts.
+ */
+
+#define SHUFFLE_MAGIC	0x64736831	/* dsh1 */
+
+typedef struct {
+	int magic;
+	int cursor;
+	int num;
+} t_shufhead;
+
+static int shuffle_fname( char *buf, size_t len )
+{
+	if( ! opt_random_shuffle || ! *opt_random_shuffle )
+		return -1;
+
+	if( zone_cur )
+		snprintf( buf, len, "%s%d", opt_random_shuffle, zone_cur );
+	else
+		snprintf( buf, len, "%s", opt_random_shuffle );
+
+	return 0;
+}
+
+static int shuffle_save( t_rzone *z )
+{
+	char fname[MAXPATHLEN];
+	char tmp[MAXPATHLEN];
+	t_shufhead head;
+	FILE *fh;
+	int i;
+	int r = 0;
+
+	if( shuffle_fname( fname, MAXPATHLEN ))
+		return 0;
+	snprintf( tmp, MAXPATHLEN, "%s.tmp", fname );
+
+	if( NULL == (fh = fopen( tmp, "w" ))){
+		syslog( LOG_ERR, "shuffle: %s: %m", tmp );
+		return -1;
+	}
+
+	head.magic = SHUFFLE_MAGIC;
+	head.cursor = z->set.cursor;
+	head.num = z->set.num;
+
+	if( 1 != fwrite( &head, sizeof(t_shufhead), 1, fh ))
+		r = -1;
+	for( i = 0; ! r && i < z->set.num; ++i ){
+		if( 1 != fwrite( &z->set.cand[z->set.order[i]].id,
+					sizeof(int), 1, fh ))
+			r = -1;
+	}
+
+	if( r ){
+		syslog( LOG_ERR, "shuffle: %s: %m", tmp );
+		fclose( fh );
+		unlink( tmp );
+		return -1;
+	}
+
+	if( fclose( fh ) || rename( tmp, fname )){
+		syslog( LOG_ERR, "shuffle: %s: %m", fname );
+		unlink( tmp );
+		return -1;
+	}
+
+	return 0;
+}
+
+/* just update the cursor in place */
+static int shuffle_savecursor( t_rzone *z )
+{
+	char fname[MAXPATHLEN];
+	int fd;
+	int r = 0;
+
+	if( shuffle_fname( fname, MAXPATHLEN ))
+		return 0;
+
+	if( 0 > (fd = open( fname, O_WRONLY ))){
+		syslog( LOG_ERR, "shuffle: %s: %m", fname );
+		return -1;
+	}
+
+	if( sizeof(int) != pwrite( fd, &z->set.cursor, sizeof(int),
+				offsetof(t_shufhead, cursor) )){
+		syslog( LOG_ERR, "shuffle: %s: %m", fname );
+		r = -1;
+	}
+
+	close( fd );
+	return r;
+}
+
+/* write back the permutation after a pick - all of it when it was
+ * reshuffled */
+static void shuffle_sync( t_rzone *z, int cursor )
+{
+	if( random_algo() != pk_shuffle )
+		return;
+
+	if( z->set.cycle != z->shuffle_cycle ){
+		if( 0 == shuffle_save( z ))
+			z->shuffle_cycle = z->set.cycle;
+
+	} else if( cursor )
+		shuffle_savecursor( z );
+}
+
+/* returns saved permutation of ids - to free by caller */
+static int *shuffle_load( int *num, int *cursor )
+{
+	char fname[MAXPATHLEN];
+	t_shufhead head;
+	int *ids;
+	FILE *fh;
+
+	if( shuffle_fname( fname, MAXPATHLEN ))
+		return NULL;
+
+	if( NULL == (fh = fopen( fname, "r" )))
+		return NULL;
+
+	if( 1 != fread( &head, sizeof(t_shufhead), 1, fh )
+		|| head.magic != SHUFFLE_MAGIC
+		|| head.num < 0 ){
+
+		fclose( fh );
+		return NULL;
+	}
+
+	if( NULL == (ids = malloc( (head.num + 1) * sizeof(int)))){
+		fclose( fh );
+		return NULL;
+	}
+
+	if( (size_t)head.num != fread( ids, sizeof(int), head.num, fh )){
+		syslog( LOG_ERR, "shuffle: %s: truncated", fname );
+		free( ids );
+		fclose( fh );
+		return NULL;
+	}
+
+	fclose( fh );
+	*num = head.num;
+	*cursor = head.cursor;
+	return ids;
+}
+
+/* permutation of the current set - or the saved one after startup */
+static int *shuffle_prev( t_rzone *z, int *num, int *cursor )
+{
+	int *ids;
+	int i;
+
+	if( ! z->set.order )
+		return shuffle_load( num, cursor );
+
+	if( NULL == (ids = malloc( (z->set.num + 1) * sizeof(int))))
+		return NULL;
+
+	for( i = 0; i < z->set.num; ++i )
+		ids[i] = z->set.cand[z->set.order[i]].id;
+
+	*num = z->set.num;
+	*cursor = z->set.cursor;
+	return ids;
+}
+
+/*
+ * use candidates - in lplay order. Takes ownership of cand.
+ */
+static int cand_set( t_rzone *z, t_pickcand *cand, int num )
+{
+	t_pickconf conf;
+	int *prev = NULL;
+	int prev_num = 0;
+	int cursor = 0;
+	int i;
+
+	conf.algo = random_algo();
+	conf.percent = opt_random_percent;
+	conf.max = opt_random_max;
+	conf.scorebase = opt_random_scorebase;
+
+	/* reshuffle incrementally */
+	if( conf.algo == pk_shuffle )
+		prev = shuffle_prev( z, &prev_num, &cursor );
+
+	pickset_clear( &z->set );
+	if( pickset_init( &z->set, &conf, cand, num, time(NULL) )){
+		syslog( LOG_ERR, "cand_set: out of memory" );
+		for( i = 0; i < num; ++i )
+			free( cand[i].fname );
+		free( cand );
+		free( prev );
+		return -1;
+	}
+	z->next_id = 0;
+
+	if( prev && pickset_resume( &z->set, prev, prev_num, cursor ))
+		syslog( LOG_ERR, "cand_set: cannot resume shuffle" );
+	free( prev );
+
+	if( conf.algo == pk_shuffle && 0 == shuffle_save( z ))
+		z->shuffle_cycle = z->set.cycle;
+
+	return 0;
+}
+
+static int cand_load( t_rzone *z )
 {
 	PGresult *res;
-	char where[4096];
+	t_pickcand *tmp;
+	char tags[2048];
+	int num;
+	int i;
+
+	if( cand_scoretags( tags, sizeof(tags) ))
+		return -1;
 
-	*where = 0;
-	if( filt )
-		sql_expr(where, 4096, filt);
+	/* score is the sum of the scores of the file's tags */
+	if( *tags )
+		res = db_query( "SELECT c.id, c.lplay, c.filename, "
+				"COALESCE(s.score,0) "
+			"FROM %s c "
+				"LEFT JOIN ( "
+					"SELECT ft.file_id, "
+						"SUM(v.score) AS score "
+					"FROM mserv_filetag ft "
+						"INNER JOIN mserv_tag t "
+						"ON t.id = ft.tag_id "
+						"INNER JOIN ( VALUES %s ) "
+							"AS v(name, score) "
+						"ON v.name = t.name "
+					"GROUP BY ft.file_id "
+				") AS s "
+				"ON s.file_id = c.id "
+			"ORDER BY c.lplay", z->table, tags );
+	else
+		res = db_query( "SELECT id, lplay, filename, 0 "
+			"FROM %s "
+			"ORDER BY lplay", z->table );
+	if( ! res || PGRES_TUPLES_OK !=  PQresultStatus(res) ){
+		syslog( LOG_ERR, "cand_load: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	num = PQntuples(res);
+	if( NULL == (tmp = malloc( (num + 1) * sizeof(t_pickcand)))){
+		syslog( LOG_ERR, "cand_load: out of memory" );
+		PQclear(res);
+		return -1;
+	}
+
+	for( i = 0; i < num; ++i ){
+		tmp[i].id = pgint(res, i, 0);
+		tmp[i].lplay = pgint(res, i, 1);
+		tmp[i].score = pgint(res, i, 3);
+		if( NULL == (tmp[i].fname = pgstring(res, i, 2))){
+			while( --i >= 0 )
+				free( tmp[i].fname );
+			free( tmp );
+			PQclear(res);
+			return -1;
+		}
+	}
+	PQclear(res);
+
+	return cand_set( z, tmp, num );
+}
+
+/* append s to buf, escaped for COPY's text format */
+static char *cand_escape( char *buf, const char *s )
+{
+	for( ; *s; ++s ){
+		switch( *s ){
+		  case '\\':	*buf++ = '\\'; *buf++ = '\\'; break;
+		  case '\t':	*buf++ = '\\'; *buf++ = 't'; break;
+		  case '\n':	*buf++ = '\\'; *buf++ = 'n'; break;
+		  case '\r':	*buf++ = '\\'; *buf++ = 'r'; break;
+		  default:	*buf++ = *s;
+		}
+	}
+	return buf;
+}
+
+/*
+ * refill an empty juke_cache from memory
+ */
+static int cand_restore( t_rzone *z )
+{
+	t_pickcand *cand = z->set.cand;
+	char *buf;
+	char *p;
+	size_t len = 0;
+	int r;
+	int i;
+
+	for( i = 0; i < z->set.num; ++i )
+		len += 2 * 12 + 2 * strlen(cand[i].fname) + 3;
+
+	if( NULL == (buf = malloc(len + 1))){
+		syslog( LOG_ERR, "cand_restore: out of memory" );
+		return -1;
+	}
+
+	p = buf;
+	for( i = 0; i < z->set.num; ++i ){
+		p += sprintf( p, "%d\t%d\t", cand[i].id, cand[i].lplay );
+		p = cand_escape( p, cand[i].fname );
+		*p++ = '\n';
+	}
+
+	r = db_copyin( buf, p - buf, "COPY %s FROM STDIN", z->table );
+	free( buf );
+
+	return r;
+}
+
+static int fill_cache( t_rzone *z, expr *filt )
+{
+	PGresult *res;
+	t_bitmap *set;
+	char *where = NULL;
+	char *ids;
+
+	/* tag filters are resolved by the index */
+	if( NULL != (set = tagidx_eval( filt ))){
+		ids = bitmap_fmt( set );
+		bitmap_free( set );
+		if( ! ids )
+			return -1;
+
+		res = db_query( "INSERT INTO %s "
+				"SELECT id, lplay, filename "
+				"FROM mserv_track "
+				"WHERE id = ANY('{%s}')",
+				z->table, ids );
+		free( ids );
+		goto done;
+	}
+
+	if( filt && NULL == (where = sql_where( filt ))){
+		syslog( LOG_ERR, "fill_cache: invalid filter" );
+		return -1;
+	}
 
 	/* fill cache - if possible */
-	res = db_query( "INSERT INTO juke_cache "
+	res = db_query( "INSERT INTO %s "
 			"SELECT id, lplay, filename "
 			"FROM mserv_track t "
 			"%s%s",
-			filt && *where ? "WHERE " : "",
-			filt && *where ? where : ""
+			z->table,
+			where ? "WHERE " : "",
+			where ? where : ""
 			);
+	free( where );
+done:
 	if( ! res || PGRES_COMMAND_OK !=  PQresultStatus(res) ){
 		syslog( LOG_ERR, "fill_cache: %s", db_errstr() );
 		PQclear(res);
@@ -55,17 +517,17 @@ static int fill_cache( expr *filt )
 	return 0;
 }
 
-static int create_cache( void )
+static int create_cache( t_rzone *z )
 {
 	PGresult *res;
 
 	/* recreate empty cache table - now the filter may fail
 	 * and further queries are still vaild - but wont pick any results */
-	res = db_query( "CREATE TEMP TABLE juke_cache ("
+	res = db_query( "CREATE TEMP TABLE %s ("
 				"id INTEGER,"
 				"lplay INTEGER,"
 				"filename VARCHAR"
-			")");
+			")", z->table );
 	if (!res || PQresultStatus(res) != PGRES_COMMAND_OK){
 		syslog( LOG_ERR, "create_cache: %s", db_errstr() );
 		PQclear(res);
@@ -75,43 +537,115 @@ static int create_cache( void )
 	return 0;
 }
 
+static void create_index( t_rzone *z )
+{
+	PGresult *res;
+
+	/* try to create index for cache table */
+	res = db_query( "CREATE INDEX %s_idx "
+			"ON %s(id)", z->table, z->table );
+	PQclear(res);
+}
+
+/*
+ * (re-)create the current zone's juke_cache on a fresh connection.
+ */
 int random_init( void )
 {
-	return create_cache();
+	t_rzone *z = rzone();
+	expr *e;
+	int r;
+
+	/* shared by all zones */
+	if( ! zone_cur ){
+		tagidx_init();
+		sfcache_init();
+	}
+
+	/* filter changed meanwhile - build from scratch */
+	if( z->filter_pending ){
+		e = expr_copy(z->filter);
+		r = random_setfilter(e);
+		expr_free(e);
+		return r;
+	}
+
+	/* otherwise restore what we had - if anything. The startup filter
+	 * is set by the caller */
+	if( create_cache(z) )
+		return 1;
+
+	if( z->set.num && cand_restore(z) ){
+		syslog( LOG_ERR, "random_init: cannot restore cache table" );
+		return 1;
+	}
+
+	create_index(z);
+	return 0;
 }
 
 int random_setfilter( expr *filt )
 {
+	t_rzone *z = rzone();
 	PGresult *res;
+	t_pickcand *cand = NULL;
+	int num;
+
+	/* apply filter once the DB is back */
+	if( ! db_isup() ){
+		expr_free( z->filter );
+		z->filter = expr_copy(filt);
+		z->filter_pending = 1;
+
+		if( random_func_filter )
+			(*random_func_filter)();
+		return 0;
+	}
+
+	z->filter_pending = 0;
 
 	/* flush old filter */
-	res = db_query( "DROP TABLE juke_cache" );
+	res = db_query( "DROP TABLE %s", z->table );
 	PQclear(res);
-	expr_free( filter );
-	filter = NULL;
+	expr_free( z->filter );
+	z->filter = NULL;
 
-	if( create_cache() )
+	if( create_cache(z) )
 		return 1;
 
+	/* candidates are known - just copy them to the cache table.
+	 * sfcache doesn't know about scores */
+	if( random_algo() != pk_score || ! opt_random_scoretags
+			|| ! *opt_random_scoretags )
+		cand = sfcache_cand( filt, &num );
+
+	if( cand ){
+		if( cand_set( z, cand, num ) || cand_restore( z ))
+			goto clean1;
+
+		z->filter = expr_copy(filt);
+		goto done;
+	}
+
 	/* try filling cache - retry with reset filter */
-	if( fill_cache( filt ) ){
+	if( fill_cache( z, filt ) ){
 		if( ! filt )
 			goto clean1;
 
-		filter = NULL;
-		if( fill_cache(NULL) )
+		if( fill_cache( z, NULL ) )
 			goto clean1;
 	} else {
-		filter = expr_copy(filt);
+		z->filter = expr_copy(filt);
 	}
 
+	if( cand_load(z) )
+		goto clean1;
+
+done:
 	if( random_func_filter )
 		(*random_func_filter)();
 
-	/* try to create index for cache table */
-	res = db_query( "CREATE INDEX juke_cache_idx "
-			"ON juke_cache(id)" );
-	PQclear(res);
+	create_index(z);
 
 	return 0;
 
@@ -120,12 +654,21 @@ clean1:
 	return 1;
 }
 
-int random_cache_update( int id, int lplay )
+static int zone_cache_update( t_rzone *z, int id, int lplay )
 {
 	PGresult *res;
+	int slot;
 
-	res = db_query( "UPDATE juke_cache SET lplay = %d WHERE id = %d",
-			lplay, id );
+	/* the track was just played - it's the most recent one now */
+	if( 0 <= (slot = pickset_slot( &z->set, id )))
+		pickset_played( &z->set, slot, lplay );
+
+	/* juke_cache is restored from memory on reconnect */
+	if( ! db_isup() )
+		return 0;
+
+	res = db_query( "UPDATE %s SET lplay = %d WHERE id = %d",
+			z->table, lplay, id );
 	if( ! res || PQresultStatus(res) != PGRES_COMMAND_OK ){
 		syslog( LOG_ERR, "random_cache_update: %s", db_errstr());
 		PQclear(res);
@@ -136,28 +679,112 @@ int random_cache_update( int id, int lplay )
 	return 0;
 }
 
+/* NOTIFY payloads are limited to 8000 bytes */
+#define RANDOM_NOTIFYMAX	7900
 
-int random_filterstat( void )
+/*
+ * publish the current filter to other instances. Just zone 0 is shared
+ * - like its queue.
+ */
+int random_sharefilter( void )
 {
-	PGresult *res;
-	int num;
+	t_rzone *z = rzone();
+	char *buf;
+	char *tmp;
+	size_t size = 1024;
+	size_t n = 0;
+	int r;
 
-	res = db_query( "SELECT count(*) FROM juke_cache" );
-	if( ! res || PGRES_TUPLES_OK !=  PQresultStatus(res) ){
-		syslog( LOG_ERR, "filterstat: %s", db_errstr() );
-		PQclear(res);
+	if( zone_cur )
+		return 0;
+
+	if( NULL == (buf = malloc( size )))
 		return -1;
+
+	/* expr_fmt() doesn't tell the length it needs on truncation */
+	*buf = 0;
+	while( z->filter && size <= (n = expr_fmt( buf, size, z->filter ))
+			&& size <= RANDOM_NOTIFYMAX ){
+
+		size *= 2;
+		if( NULL == (tmp = realloc( buf, size ))){
+			free( buf );
+			return -1;
+		}
+		buf = tmp;
 	}
 
-	num = pgint(res, 0, 0 );
-	PQclear(res);
+	if( n >= size || n > RANDOM_NOTIFYMAX ){
+		syslog( LOG_NOTICE, "random_sharefilter: filter is too long "
+				"to share" );
+		free( buf );
+		return -1;
+	}
+
+	r = db_notify( "filter", buf );
+	free( buf );
+	return r;
+}
+
+/*
+ * another instance changed the filter of zone 0
+ */
+void random_notified( const char *arg )
+{
+	expr *e = NULL;
+	char *str;
+	char *msg;
+	int pos;
+	int zone = zone_cur;
+
+	if( arg && *arg ){
+		if( NULL == (str = strdup( arg )))
+			return;
+
+		e = expr_parse_str( &pos, &msg, str );
+		free( str );
+		if( ! e ){
+			syslog( LOG_ERR, "random_notified: error at pos %d "
+					"in filter: %s", pos, msg );
+			return;
+		}
+	}
+
+	zone_cur = 0;
+	random_setfilter( e );
+	zone_cur = zone;
+	expr_free( e );
+}
+
+/* lplay is shared: update the caches of all zones */
+int random_cache_update( int id, int lplay )
+{
+	int r = 0;
+	int i;
+
+	sfcache_played( id, lplay );
+
+	for( i = 0; i < ZONE_MAX; ++i ){
+		/* zone isn't used */
+		if( ! *rzones[i].table )
+			continue;
 
-	return num;
+		if( zone_cache_update( &rzones[i], id, lplay ))
+			r = -1;
+	}
+
+	return r;
+}
+
+
+int random_filterstat( void )
+{
+	return rzone()->set.num;
 }
 
 expr *random_filter( void )
 {
-	return filter;
+	return rzone()->filter;
 }
 
 it_track *random_top( int num )
@@ -167,7 +794,7 @@ it_track *random_top( int num )
 				"c.lplay "
 			"FROM "
 				"( SELECT * "
-					"FROM juke_cache "
+					"FROM %s "
 					"ORDER by lplay "
 					"LIMIT %d "
 				") AS c "
@@ -177,32 +804,17 @@ it_track *random_top( int num )
 				"c.lplay, "
 				"LOWER(album_artist_name), "
 				"LOWER(album_name), album_pos",
-				num );
+				rzone()->table, num );
 }
 
-t_track *random_fetch( void )
-{
-	PGresult *res;
-	int num;
-	int id;
-
-	num = random_filterstat() / 3;
-#if 0
-	if( num > RANDOM_LIMIT )
-		num = RANDOM_LIMIT;
-#endif
+/* max attempts to find an available track */
+#define RANDOM_TRIES	10
 
-	if( num < 1 )
-		num = 1;
-
-	/* get first tracks matching filter */
-	res = db_query( "SELECT id FROM juke_cache "
-			"ORDER BY lplay LIMIT %d", num );
-	if( ! res || PGRES_TUPLES_OK !=  PQresultStatus(res) ){
-		syslog( LOG_ERR, "random_fetch: %s", db_errstr());
-		PQclear(res);
-		return NULL;
-	}
+/* returns slot in set */
+static int random_pick( t_rzone *z )
+{
+	int slot;
+	int tries = 0;
 
 	/*
 	 * randomly pick a track while trying to avoid recently played
@@ -210,26 +822,83 @@ t_track *random_fetch( void )
 	 * random numbers looks like.
 	 *
 	 */
-#if 1
-	/* 'abs': folded and shifted gaussian distribution */
-	num = (double)abs( (double)random() + random() - RAND_MAX )
-		/ RAND_MAX * PQntuples(res);
-#else
-
-	/* 'div': more drastic */
-	num = ((double)random() * random())
-		/ ( (double)RAND_MAX * RAND_MAX)
-		* PQntuples(res);
-#endif
-
-	syslog( LOG_DEBUG, "random: picking %d from top %d", num,
-			PQntuples(res));
-
-	id = pgint( res, num, 0 );
-	PQclear(res);
+again:
+	if( 0 > (slot = pickset_pick( &z->set, time(NULL) )))
+		return -1;
+
+	/* skip tracks known to be missing without bothering the DB */
+	if( 0 == avail_track( z->set.cand[slot].id ) && ++tries < RANDOM_TRIES )
+		goto again;
+
+	syslog( LOG_DEBUG, "random: picking slot %d of %d", slot,
+			z->set.num );
+	return slot;
+}
+
+/*
+ * returns slot of the pre-picked track, when it's still a good choice
+ */
+static int random_next( t_rzone *z )
+{
+	t_pickcand *c;
+
+	if( ! z->next_id )
+		return -1;
+
+	c = &z->set.cand[z->next_slot];
+
+	/* played meanwhile? */
+	if( c->lplay != z->next_lplay || 0 == avail_track( z->next_id ) ){
+		z->next_id = 0;
+		return -1;
+	}
+
+	return z->next_slot;
+}
+
+/*
+ * pre-pick the track to return on the next random_fetch() and get
+ * its path.
+ */
+int random_peek( char *buf, int len )
+{
+	t_rzone *z = rzone();
+	t_track t;
+	int pick;
+
+	if( 0 > (pick = random_next(z))){
+		if( 0 > (pick = random_pick(z)))
+			return -1;
+		z->next_id = z->set.cand[pick].id;
+		z->next_slot = pick;
+		z->next_lplay = z->set.cand[pick].lplay;
+		shuffle_sync( z, 0 );
+	}
+
+	t.fname = z->set.cand[pick].fname;
+	return track_mkpath( buf, len, &t );
+}
+
+t_track *random_fetch( void )
+{
+	t_rzone *z = rzone();
+	t_pickcand *c;
+	t_track *t;
+	int pick;
+
+	if( 0 > (pick = random_next(z))
+		&& 0 > (pick = random_pick(z)))
+		return NULL;
+	z->next_id = 0;
+	c = &z->set.cand[pick];
+
+	shuffle_sync( z, 1 );
 
+	if( db_isup() && NULL != (t = track_get( c->id )))
+		return t;
 
-	return track_get( id );
+	/* DB is down: play what we know */
+	return track_minimal( c->id, c->fname, c->lplay );
 }
 
 
@@ -0,0 +1,721 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+/*
+ * in-memory candidate sets of the stored filters.
+ *
+ * Keeps a catalog of all tracks (id, lplay, filename) and a bitmap of
+ * the matching track ids for each sfilter. Modifications made through
+ * this instance update them track by track. Changes affecting many
+ * tracks at once (tags, albums, artists) have the filters evaluated again
+ * from the main loop. Tracks added or removed by other programs are
+ * picked up from the polled catalog summary, changed tagging has the
+ * filters on tags evaluated again. Filters aren't served while the cache
+ * is being rebuilt.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <syslog.h>
+
+#include <config.h>
+#include <opt.h>
+#include <commondb/sfilter.h>
+#include "dudldb.h"
+#include "filter.h"
+#include "bitmap.h"
+#include "sfcache.h"
+#include "tagidx.h"
+
+#define SFCACHE_SQLLEN	4096
+
+/* a track of the catalog */
+typedef struct {
+	int id;
+	int lplay;
+	char *fname;
+} t_sfctrack;
+
+/* a stored filter */
+typedef struct {
+	int id;
+	char *text;	/* as formatted by expr_fmt() */
+	char *where;
+	int lplay;	/* depends on lplay */
+	int tags;	/* depends on tags */
+	t_bitmap *set;
+} t_sfcent;
+
+/* sorted by id */
+static t_sfctrack *lib = NULL;
+static int lib_num = 0;
+static int lib_size = 0;
+
+static t_sfcent *ent = NULL;
+static int ent_num = 0;
+
+/* catalog and sets are usable */
+static int loaded = 0;
+
+/* sets are to be evaluated again */
+static int stale = 0;
+static int rebuild_id = 0;
+
+/* catalog summary the sets were evaluated with */
+static t_dbcatalog seen;
+
+static int sfcache_load( void );
+
+
+/* index of track or -(insert position) - 1 */
+static int lib_find( int id )
+{
+	int lo = 0;
+	int hi = lib_num;
+	int mid;
+
+	while( lo < hi ){
+		mid = (lo + hi) / 2;
+		if( lib[mid].id < id )
+			lo = mid + 1;
+		else if( lib[mid].id > id )
+			hi = mid;
+		else
+			return mid;
+	}
+
+	return -lo - 1;
+}
+
+static void lib_clear( void )
+{
+	int i;
+
+	for( i = 0; i < lib_num; ++i )
+		free( lib[i].fname );
+	free( lib );
+	lib = NULL;
+	lib_num = 0;
+	lib_size = 0;
+}
+
+static int lib_load( void )
+{
+	PGresult *res;
+	t_sfctrack *tmp;
+	int num;
+	int i;
+
+	res = db_query( "SELECT id, lplay, filename "
+			"FROM mserv_track "
+			"ORDER BY id" );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "sfcache: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	num = PQntuples(res);
+	if( NULL == (tmp = malloc( (num + 1) * sizeof(t_sfctrack)))){
+		PQclear(res);
+		return -1;
+	}
+
+	for( i = 0; i < num; ++i ){
+		tmp[i].id = pgint(res, i, 0);
+		tmp[i].lplay = pgint(res, i, 1);
+		if( NULL == (tmp[i].fname = pgstring(res, i, 2))){
+			while( --i >= 0 )
+				free( tmp[i].fname );
+			free( tmp );
+			PQclear(res);
+			return -1;
+		}
+	}
+	PQclear(res);
+
+	lib_clear();
+	lib = tmp;
+	lib_num = lib_size = num;
+	return 0;
+}
+
+/* add or update a track */
+static int lib_set( int id, int lplay, char *fname )
+{
+	t_sfctrack *tmp;
+	int i;
+
+	if( 0 <= (i = lib_find( id ))){
+		free( lib[i].fname );
+		lib[i].lplay = lplay;
+		lib[i].fname = fname;
+		return 0;
+	}
+	i = -i - 1;
+
+	if( lib_num >= lib_size ){
+		if( NULL == (tmp = realloc( lib, (lib_size * 2 + 16)
+				* sizeof(t_sfctrack))))
+			return -1;
+		lib = tmp;
+		lib_size = lib_size * 2 + 16;
+	}
+
+	memmove( lib + i + 1, lib + i, (lib_num - i) * sizeof(t_sfctrack));
+	++lib_num;
+	lib[i].id = id;
+	lib[i].lplay = lplay;
+	lib[i].fname = fname;
+	return 0;
+}
+
+static void lib_del( int id )
+{
+	int i;
+
+	if( 0 > (i = lib_find( id )))
+		return;
+
+	free( lib[i].fname );
+	--lib_num;
+	memmove( lib + i, lib + i + 1, (lib_num - i) * sizeof(t_sfctrack));
+}
+
+/* does the filter look at field? */
+static int expr_uses( expr *e, valfield field )
+{
+	switch( e->op ){
+	  case op_self:
+		return e->data.val->field == field;
+
+	  case op_not:
+		return expr_uses( e->data.expr[0], field );
+
+	  case op_and:
+	  case op_or:
+		return expr_uses( e->data.expr[0], field )
+			|| expr_uses( e->data.expr[1], field );
+
+	  case op_none:
+	  case op_max:
+		break;
+	}
+
+	return 0;
+}
+
+static void ent_clear( t_sfcent *n )
+{
+	free( n->text );
+	free( n->where );
+	bitmap_free( n->set );
+	memset( n, 0, sizeof(t_sfcent));
+}
+
+static int ent_load( t_sfcent *n, t_sfilter *sf )
+{
+	char buf[SFCACHE_SQLLEN];
+	PGresult *res;
+	expr *e;
+	char *msg;
+	int pos;
+	int i;
+
+	memset( n, 0, sizeof(t_sfcent));
+	n->id = sf->id;
+
+	/* the empty filter is served by the catalog */
+	if( ! sf->filter || ! *sf->filter )
+		return -1;
+
+	if( NULL == (e = expr_parse_str( &pos, &msg, sf->filter ))){
+		syslog( LOG_NOTICE, "sfcache: sfilter %d: error at pos %d: %s",
+				sf->id, pos, msg );
+		return -1;
+	}
+
+	expr_fmt( buf, SFCACHE_SQLLEN, e );
+	n->text = strdup( buf );
+	n->lplay = expr_uses( e, vf_lplay );
+	n->tags = expr_uses( e, vf_tag );
+
+	n->where = sql_where( e );
+	expr_free( e );
+	if( ! n->text || ! n->where || NULL == (n->set = bitmap_new()))
+		goto clean1;
+
+	res = db_query( "SELECT id "
+			"FROM mserv_track t "
+			"WHERE %s "
+			"ORDER BY id", n->where );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "sfcache: sfilter %d: %s", sf->id,
+				db_errstr() );
+		PQclear(res);
+		goto clean1;
+	}
+
+	for( i = 0; i < PQntuples(res); ++i ){
+		if( 0 > bitmap_add( n->set, pgint(res, i, 0) )){
+			PQclear(res);
+			goto clean1;
+		}
+	}
+	PQclear(res);
+
+	return 0;
+
+clean1:
+	ent_clear( n );
+	return -1;
+}
+
+/* add entry for sf */
+static void ent_add( t_sfilter *sf )
+{
+	t_sfcent *tmp;
+
+	if( NULL == (tmp = realloc( ent, (ent_num + 1) * sizeof(t_sfcent))))
+		return;
+	ent = tmp;
+
+	if( 0 == ent_load( &ent[ent_num], sf ))
+		++ent_num;
+}
+
+static void ent_del( int id )
+{
+	int i;
+
+	for( i = 0; i < ent_num; ++i ){
+		if( ent[i].id != id )
+			continue;
+
+		ent_clear( &ent[i] );
+		--ent_num;
+		memmove( ent + i, ent + i + 1,
+				(ent_num - i) * sizeof(t_sfcent));
+		return;
+	}
+}
+
+/* evaluate sfilter id again */
+static void ent_update( int id )
+{
+	t_sfilter *sf;
+
+	ent_del( id );
+	if( NULL == (sf = sfilter_get( id )))
+		return;
+
+	ent_add( sf );
+	sfilter_free( sf );
+}
+
+/* evaluate the sfilters again - only those testing tags, if tags is set */
+static void ent_reload( int tags )
+{
+	int *ids;
+	int num = 0;
+	int i;
+
+	if( NULL == (ids = malloc( (ent_num + 1) * sizeof(int)))){
+		loaded = 0;
+		return;
+	}
+
+	for( i = 0; i < ent_num; ++i )
+		if( ! tags || ent[i].tags )
+			ids[num++] = ent[i].id;
+
+	syslog( LOG_DEBUG, "sfcache: evaluating %d filters", num );
+	for( i = 0; i < num; ++i )
+		ent_update( ids[i] );
+
+	free( ids );
+}
+
+static gboolean sfcache_rebuild( gpointer data )
+{
+	(void)data;
+	rebuild_id = 0;
+
+	/* sfcache_init() takes care on reconnect */
+	if( ! db_isup() )
+		return FALSE;
+
+	if( ! loaded ){
+		sfcache_load();
+
+	} else if( stale ){
+		if( db_catalog( &seen ))
+			memset( &seen, 0, sizeof(seen) );
+		ent_reload( 0 );
+		stale = 0;
+	}
+
+	return FALSE;
+}
+
+/* rebuild from the main loop - never while switching filters */
+static void sfcache_later( int all )
+{
+	if( all )
+		loaded = 0;
+	else
+		stale = 1;
+
+	if( ! rebuild_id )
+		rebuild_id = g_idle_add( sfcache_rebuild, NULL );
+}
+
+static int sfcache_load( void )
+{
+	it_sfilter *it;
+	t_sfilter *sf;
+
+	loaded = 0;
+	stale = 0;
+	while( ent_num )
+		ent_clear( &ent[--ent_num] );
+
+	/* changes made while loading are caught up later */
+	if( db_catalog( &seen ))
+		memset( &seen, 0, sizeof(seen) );
+
+	if( lib_load() )
+		return -1;
+
+	it = sfilters_list();
+	for( sf = it_sfilter_begin(it); sf; sf = it_sfilter_next(it) ){
+		ent_add( sf );
+		sfilter_free( sf );
+	}
+	it_sfilter_done( it );
+
+	syslog( LOG_INFO, "sfcache: %d tracks, %d filters", lib_num, ent_num );
+	loaded = 1;
+	return 0;
+}
+
+static int cand_cmp( const void *a, const void *b )
+{
+	return ((const t_pickcand*)a)->lplay - ((const t_pickcand*)b)->lplay;
+}
+
+t_pickcand *sfcache_cand( expr *filt, int *num )
+{
+	char buf[SFCACHE_SQLLEN];
+	t_pickcand *cand;
+	t_bitmap *set = NULL;
+	t_bitmap *tmp = NULL;
+	int *ids = NULL;
+	int n;
+	int c = 0;
+	int i;
+	int j;
+
+	if( ! opt_sfilter_cache || ! loaded || stale )
+		return NULL;
+
+	if( filt ){
+		expr_fmt( buf, SFCACHE_SQLLEN, filt );
+		for( i = 0; i < ent_num && strcmp( ent[i].text, buf ); ++i )
+			;
+
+		/* no sfilter, maybe the tag index knows */
+		if( i < ent_num )
+			set = ent[i].set;
+		else if( NULL == (set = tmp = tagidx_eval( filt )))
+			return NULL;
+	}
+
+	n = set ? bitmap_num(set) : lib_num;
+	if( NULL == (cand = malloc( (n + 1) * sizeof(t_pickcand))))
+		goto clean0;
+
+	if( set && NULL == (ids = bitmap_ids( set, &n )))
+		goto clean1;
+
+	/* both are sorted by id */
+	for( i = j = 0; j < lib_num && ( ! ids || i < n ); ++j ){
+		if( ids ){
+			while( i < n && ids[i] < lib[j].id )
+				++i;
+			if( i >= n || ids[i] != lib[j].id )
+				continue;
+		}
+
+		cand[c].id = lib[j].id;
+		cand[c].lplay = lib[j].lplay;
+		cand[c].score = 0;
+		if( NULL == (cand[c].fname = strdup( lib[j].fname )))
+			goto clean2;
+		++c;
+	}
+	free( ids );
+	bitmap_free( tmp );
+
+	qsort( cand, c, sizeof(t_pickcand), cand_cmp );
+
+	*num = c;
+	return cand;
+
+clean2:
+	while( --c >= 0 )
+		free( cand[c].fname );
+	free( ids );
+clean1:
+	free( cand );
+clean0:
+	bitmap_free( tmp );
+	return NULL;
+}
+
+/*
+ * evaluate all filters at once for the tracks matching cond. Returns
+ * number of tracks, -1 on error.
+ */
+static int sfcache_eval( const char *cond )
+{
+	PGresult *res;
+	char *sql;
+	char *p;
+	char *fname;
+	size_t len = 128;
+	int num;
+	int id;
+	int t;
+	int i;
+
+	for( i = 0; i < ent_num; ++i )
+		len += strlen( ent[i].where ) + 4;
+
+	if( NULL == (sql = malloc( len )))
+		return -1;
+
+	p = sql + sprintf( sql, "SELECT id, lplay, filename" );
+	for( i = 0; i < ent_num; ++i )
+		p += sprintf( p, ",(%s)", ent[i].where );
+
+	res = db_query( "%s FROM mserv_track t WHERE %s", sql, cond );
+	free( sql );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "sfcache_eval: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	num = PQntuples(res);
+	for( t = 0; t < num; ++t ){
+		id = pgint(res, t, 0);
+
+		if( NULL == (fname = pgstring(res, t, 2))
+			|| lib_set( id, pgint(res, t, 1), fname )){
+
+			free( fname );
+			PQclear(res);
+			return -1;
+		}
+
+		for( i = 0; i < ent_num; ++i ){
+			if( 0 > (pgbool(res, t, 3 + i)
+					? bitmap_add( ent[i].set, id )
+					: bitmap_del( ent[i].set, id ))){
+				PQclear(res);
+				return -1;
+			}
+		}
+	}
+
+	PQclear(res);
+	return num;
+}
+
+/* track is gone */
+static void sfcache_drop( int id )
+{
+	int i;
+
+	lib_del( id );
+	for( i = 0; i < ent_num; ++i )
+		bitmap_del( ent[i].set, id );
+}
+
+void sfcache_track( int id )
+{
+	char cond[32];
+	int num;
+
+	if( ! opt_sfilter_cache || ! loaded )
+		return;
+
+	/* missed - rebuild */
+	if( ! db_isup() ){
+		loaded = 0;
+		return;
+	}
+
+	snprintf( cond, sizeof(cond), "id = %d", id );
+	if( 0 > (num = sfcache_eval( cond )))
+		sfcache_later( 1 );
+	else if( num == 0 )
+		sfcache_drop( id );
+}
+
+/*
+ * drop tracks removed by other programs, evaluate those we missed
+ */
+static int lib_sync( void )
+{
+	PGresult *res;
+	int *gone;
+	int *missed;
+	int ngone = 0;
+	int nmissed = 0;
+	int num;
+	int id = 0;
+	int i, j;
+
+	res = db_query( "SELECT id FROM mserv_track ORDER BY id" );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "sfcache: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	num = PQntuples(res);
+	gone = malloc( (lib_num + 1) * sizeof(int));
+	missed = malloc( (num + 1) * sizeof(int));
+	if( ! gone || ! missed ){
+		free( gone );
+		free( missed );
+		PQclear(res);
+		return -1;
+	}
+
+	/* both are sorted by id */
+	for( i = j = 0; i < lib_num || j < num; ){
+		if( j < num )
+			id = pgint(res, j, 0);
+
+		if( j >= num || ( i < lib_num && lib[i].id < id ))
+			gone[ngone++] = lib[i++].id;
+		else if( i >= lib_num || lib[i].id > id ){
+			missed[nmissed++] = id;
+			++j;
+		} else {
+			++i;
+			++j;
+		}
+	}
+	PQclear(res);
+
+	syslog( LOG_DEBUG, "sfcache: %d tracks gone, %d missed", ngone,
+			nmissed );
+	for( i = 0; i < ngone; ++i )
+		sfcache_drop( gone[i] );
+	for( i = 0; i < nmissed; ++i )
+		sfcache_track( missed[i] );
+
+	free( gone );
+	free( missed );
+	return 0;
+}
+
+/*
+ * catch up with changes made by other programs
+ */
+static void sfcache_catalog( const t_dbcatalog *c )
+{
+	char cond[32];
+	int max;
+
+	if( ! opt_sfilter_cache || rebuild_id )
+		return;
+
+	if( ! loaded ){
+		sfcache_load();
+		return;
+	}
+
+	/* added */
+	max = lib_num ? lib[lib_num-1].id : 0;
+	if( c->track_max > max ){
+		snprintf( cond, sizeof(cond), "id > %d", max );
+		if( 0 > sfcache_eval( cond )){
+			sfcache_later( 1 );
+			return;
+		}
+	}
+
+	/* removed */
+	if( c->tracks != lib_num && lib_sync() ){
+		sfcache_later( 1 );
+		return;
+	}
+
+	/* tagging changed */
+	if( c->tags != seen.tags || c->tag_max != seen.tag_max
+			|| c->filetags != seen.filetags ){
+		seen = *c;
+		ent_reload( 1 );
+	}
+}
+
+int sfcache_init( void )
+{
+	if( ! opt_sfilter_cache )
+		return 0;
+
+	db_catalog_watch( sfcache_catalog );
+	return sfcache_load();
+}
+
+void sfcache_played( int id, int lplay )
+{
+	int i;
+
+	if( ! opt_sfilter_cache || ! loaded )
+		return;
+
+	if( 0 <= (i = lib_find( id )))
+		lib[i].lplay = lplay;
+
+	for( i = 0; i < ent_num; ++i ){
+		if( ent[i].lplay ){
+			sfcache_track( id );
+			return;
+		}
+	}
+}
+
+void sfcache_sfilter( int id )
+{
+	if( ! opt_sfilter_cache || ! loaded )
+		return;
+
+	/* missed - rebuild */
+	if( ! db_isup() ){
+		loaded = 0;
+		return;
+	}
+
+	ent_update( id );
+}
+
+void sfcache_invalidate( void )
+{
+	if( ! opt_sfilter_cache || ! loaded )
+		return;
+
+	sfcache_later( 0 );
+}
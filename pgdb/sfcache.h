@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PGDB_SFCACHE_H
+#define _PGDB_SFCACHE_H
+
+#include <commondb/parseexpr.h>
+#include "pick.h"
+
+/*
+ * candidate sets of all stored filters, kept in memory when
+ * sfilter_cache is enabled. Switching to one of them doesn't need to
+ * evaluate the filter on the DB.
+ */
+
+/* (re-)load everything on a new DB connection */
+int sfcache_init( void );
+
+/* candidates in lplay order for pickset_init() or NULL when filt isn't
+ * cached - to free by caller */
+t_pickcand *sfcache_cand( expr *filt, int *num );
+
+/* track was modified / played */
+void sfcache_track( int id );
+void sfcache_played( int id, int lplay );
+
+/* stored filter was added, changed or deleted */
+void sfcache_sfilter( int id );
+
+/* tags, albums or artists changed: evaluate the filters again from the
+ * main loop */
+void sfcache_invalidate( void );
+
+#endif
@@ -15,15 +15,33 @@
 #include <config.h>
 #include <commondb/sfilter.h>
 #include "dudldb.h"
+#include "sfcache.h"
+
+enum {
+	sc_id,
+	sc_name,
+	sc_filter,
+	sc_max
+};
+
+static const char *sfilter_cols[] = {
+	[sc_id]		= "id",
+	[sc_name]	= "name",
+	[sc_filter]	= "filter",
+	[sc_max]	= NULL,
+};
 
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing sfilter data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing sfilter data: %s", sfilter_cols[field] ); \
 		goto gofail; \
 	}
 
-static t_sfilter *sfilter_convert( PGresult *res, int tup )
+/* few and rarely listed - these stay on the heap */
+static t_sfilter *sfilter_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_sfilter *h;
 	int f;
 
@@ -33,18 +51,21 @@ static t_sfilter *sfilter_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
+	if( NULL == (col = db_colmap( r, sfilter_cols )))
+		return NULL;
+
 	if( NULL == (h = malloc(sizeof(t_sfilter))))
 		return NULL;
 	memset( h, 0, sizeof(t_sfilter));
 
-	GETFIELD(f,"id", clean1 );
+	GETFIELD(f,sc_id, clean1 );
 	h->id = pgint(res, tup, f);
 
-	GETFIELD(f,"name", clean1 );
+	GETFIELD(f,sc_name, clean1 );
 	if( NULL == ( h->name = pgstring(res, tup, f )))
 		goto clean1;
 
-	GETFIELD(f,"filter", clean1 );
+	GETFIELD(f,sc_filter, clean1 );
 	if( NULL == ( h->filter = pgstring(res, tup, f )))
 		goto clean2;
 
@@ -83,7 +104,7 @@ t_sfilter *sfilter_get( int id )
 		return NULL;
 	}
 
-	t = sfilter_convert(res, 0 );
+	t = sfilter_convert(DBRES(res), 0 );
 	PQclear(res);
 
 	return t;
@@ -175,6 +196,8 @@ int sfilter_del( int id )
 	}
 
 	PQclear(res);
+
+	sfcache_sfilter( id );
 	return 0;
 }
 
@@ -221,6 +244,8 @@ int sfilter_setfilter( int id, const char *filter )
 
 	PQclear(res);
 
+	sfcache_sfilter( id );
+
 	return 0;
 }
 
@@ -9,6 +9,7 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 
@@ -16,18 +17,36 @@
 #include <commondb/tag.h>
 #include "dudldb.h"
 #include "track.h"
+#include "sfcache.h"
+#include "tagidx.h"
 
 t_tag_func tag_func_changed = NULL;
 t_tag_func tag_func_del = NULL;
 
+enum {
+	tc_id,
+	tc_name,
+	tc_cmnt,
+	tc_max
+};
+
+static const char *tag_cols[] = {
+	[tc_id]		= "id",
+	[tc_name]	= "name",
+	[tc_cmnt]	= "cmnt",
+	[tc_max]	= NULL,
+};
+
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing tag data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing tag data: %s", tag_cols[field] ); \
 		goto gofail; \
 	}
 
-static t_tag *tag_convert( PGresult *res, int tup )
+static t_tag *tag_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_tag *h;
 	int f;
 
@@ -37,28 +56,33 @@ static t_tag *tag_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (h = malloc(sizeof(t_tag))))
+	if( NULL == (col = db_colmap( r, tag_cols )))
+		return NULL;
+
+	if( NULL == (h = arena_alloc( r->arena, sizeof(t_tag))))
 		return NULL;
 	memset(h, 0, sizeof(t_tag));
 
-	GETFIELD(f,"id", clean1 );
+	h->_arena = NULL != r->arena;
+
+	GETFIELD(f,tc_id, clean1 );
 	h->id = pgint(res, tup, f);
 
-	GETFIELD(f,"name", clean1 );
-	if( NULL == ( h->name = pgstring(res, tup, f )))
+	GETFIELD(f,tc_name, clean1 );
+	if( NULL == ( h->name = pgastring(r->arena, res, tup, f )))
 		goto clean1;
 
-	GETFIELD(f,"cmnt", clean1 );
-	if( NULL == ( h->desc = pgstring(res, tup, f )))
+	GETFIELD(f,tc_cmnt, clean1 );
+	if( NULL == ( h->desc = pgastring(r->arena, res, tup, f )))
 		goto clean2;
 
 	return h;
 
 clean2:
-	free(h->name);
+	arena_free(r->arena, h->name);
 
 clean1:
-	free(h);
+	arena_free(r->arena, h);
 
 	return NULL;
 }
@@ -69,6 +93,9 @@ void tag_free( t_tag *t )
 	if( ! t )
 		return;
 
+	if( t->_arena )
+		return;
+
 	free(t->desc);
 	free(t->name);
 	free(t);
@@ -87,7 +114,7 @@ t_tag *tag_get( int id )
 		return NULL;
 	}
 
-	t = tag_convert(res, 0 );
+	t = tag_convert(DBRES(res), 0 );
 	PQclear(res);
 
 	return t;
@@ -144,6 +171,46 @@ it_tag *tags_artist( int aid )
 			"ORDER BY LOWER(name)", aid );
 }
 
+/* tell other instances */
+static void tag_notify( int id )
+{
+	char buf[16];
+
+	snprintf( buf, sizeof(buf), "%d", id );
+	db_notify( "tag", buf );
+}
+
+/*
+ * another instance added, modified or deleted a tag
+ */
+void tag_notified( const char *arg )
+{
+	t_tag *t;
+	t_tag gone;
+	int id;
+
+	if( ! arg || 0 >= (id = atoi(arg)))
+		return;
+
+	tagidx_tag( id );
+	sfcache_invalidate();
+	if( NULL != (t = tag_get(id))){
+		if( tag_func_changed )
+			(*tag_func_changed)(t);
+		tag_free(t);
+		return;
+	}
+
+	/* deleted - only the id is left */
+	if( tag_func_del ){
+		memset( &gone, 0, sizeof(gone) );
+		gone.id = id;
+		gone.name = "";
+		gone.desc = "";
+		(*tag_func_del)( &gone );
+	}
+}
+
 int tag_add( const char *name )
 {
 	PGresult *res;
@@ -185,6 +252,10 @@ int tag_add( const char *name )
 			tag_free(t);
 		}
 	}
+	/* filters refer to tags by name */
+	tagidx_tag( id );
+	sfcache_invalidate();
+	tag_notify(id);
 
 	return id;
 }
@@ -210,6 +281,10 @@ int tag_del( int id )
 	}
 
 	PQclear(res);
+	/* filters refer to tags by name */
+	tagidx_tag( id );
+	sfcache_invalidate();
+	tag_notify(id);
 	return 0;
 }
 
@@ -241,6 +316,10 @@ int tag_setname( int id, const char *name )
 			tag_free(t);
 		}
 	}
+	/* filters refer to tags by name */
+	tagidx_tag( id );
+	sfcache_invalidate();
+	tag_notify(id);
 
 	return 0;
 }
@@ -273,6 +352,7 @@ int tag_setdesc( int id, const char *desc )
 			tag_free(t);
 		}
 	}
+	tag_notify(id);
 
 	return 0;
 }
@@ -346,6 +426,9 @@ int track_tagadd( int tid, int id )
 	}
 
 	PQclear(res);
+
+	tagidx_tagged( tid, id, 1 );
+	sfcache_track( tid );
 	return 0;
 }
 
@@ -363,6 +446,9 @@ int track_tagdel( int tid, int id )
 	}
 
 	PQclear(res);
+
+	tagidx_tagged( tid, id, 0 );
+	sfcache_track( tid );
 	return 0;
 }
 
@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+/*
+ * bitmap of tracks for each tag plus one of all tracks. Tag tests of a
+ * filter become bitmaps, AND/OR/NOT become bitmap operations.
+ *
+ * Tagging done by this instance is applied right away. New tracks and
+ * tags of other programs are picked up from the polled catalog summary,
+ * anything else not adding up triggers a reload.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <config.h>
+#include <opt.h>
+#include "dudldb.h"
+#include "tagidx.h"
+
+typedef struct {
+	int id;
+	char *name;
+	t_bitmap *tracks;
+} t_tagent;
+
+/* sorted by id */
+static t_tagent *tags = NULL;
+static int tags_num = 0;
+
+/* tracks of mserv_track */
+static t_bitmap *all = NULL;
+static int track_max = 0;
+
+/* usable */
+static int loaded = 0;
+
+
+static void tagidx_clear( void )
+{
+	int i;
+
+	for( i = 0; i < tags_num; ++i ){
+		free( tags[i].name );
+		bitmap_free( tags[i].tracks );
+	}
+	free( tags );
+	tags = NULL;
+	tags_num = 0;
+
+	bitmap_free( all );
+	all = NULL;
+	track_max = 0;
+	loaded = 0;
+}
+
+/* index of tag or -(insert position) - 1 */
+static int tag_find( int id )
+{
+	int lo = 0;
+	int hi = tags_num;
+	int mid;
+
+	while( lo < hi ){
+		mid = (lo + hi) / 2;
+		if( tags[mid].id < id )
+			lo = mid + 1;
+		else if( tags[mid].id > id )
+			hi = mid;
+		else
+			return mid;
+	}
+
+	return -lo - 1;
+}
+
+/* fill bitmap with column 0 of query, returns highest id */
+static int load_ids( t_bitmap *b, char *query )
+{
+	PGresult *res;
+	int max = 0;
+	int id;
+	int i;
+
+	res = db_query( "%s", query );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "tagidx: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	for( i = 0; i < PQntuples(res); ++i ){
+		if( 0 > bitmap_add( b, id = pgint(res, i, 0) )){
+			PQclear(res);
+			return -1;
+		}
+		if( id > max )
+			max = id;
+	}
+
+	PQclear(res);
+	return max;
+}
+
+/* add tag_id, file_id rows of query to the tags */
+static int load_filetags( char *query )
+{
+	PGresult *res;
+	t_tagent *t = NULL;
+	int tag;
+	int i;
+
+	res = db_query( "%s", query );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "tagidx: %s", db_errstr() );
+		PQclear(res);
+		return -1;
+	}
+
+	for( i = 0; i < PQntuples(res); ++i ){
+		tag = pgint(res, i, 0);
+
+		if( ! t || t->id != tag ){
+			if( 0 > (tag = tag_find( tag ))){
+				t = NULL;
+				continue;
+			}
+			t = &tags[tag];
+		}
+
+		if( 0 > bitmap_add( t->tracks, pgint(res, i, 1) )){
+			PQclear(res);
+			return -1;
+		}
+	}
+
+	PQclear(res);
+	return 0;
+}
+
+static int tagidx_load( void )
+{
+	PGresult *res;
+	int num;
+
+	tagidx_clear();
+
+	if( NULL == (all = bitmap_new()))
+		return -1;
+
+	if( 0 > (track_max = load_ids( all, "SELECT id "
+			"FROM mserv_track "
+			"ORDER BY id" )))
+		goto clean1;
+
+	res = db_query( "SELECT id, name FROM mserv_tag ORDER BY id" );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "tagidx: %s", db_errstr() );
+		PQclear(res);
+		goto clean1;
+	}
+
+	num = PQntuples(res);
+	if( NULL == (tags = malloc( (num + 1) * sizeof(t_tagent)))){
+		PQclear(res);
+		goto clean1;
+	}
+
+	for( tags_num = 0; tags_num < num; ++tags_num ){
+		tags[tags_num].id = pgint(res, tags_num, 0);
+		tags[tags_num].name = pgstring(res, tags_num, 1);
+		tags[tags_num].tracks = bitmap_new();
+
+		if( ! tags[tags_num].name || ! tags[tags_num].tracks ){
+			++tags_num;
+			PQclear(res);
+			goto clean1;
+		}
+	}
+	PQclear(res);
+
+	if( load_filetags( "SELECT tag_id, file_id "
+			"FROM mserv_filetag "
+			"ORDER BY tag_id, file_id" ))
+		goto clean1;
+
+	loaded = 1;
+	syslog( LOG_DEBUG, "tagidx: %d tracks, %d tags", bitmap_num(all),
+			tags_num );
+	return 0;
+
+clean1:
+	syslog( LOG_ERR, "tagidx: failed to load index" );
+	tagidx_clear();
+	return -1;
+}
+
+/* tags and tracks added by other programs, returns number of tags */
+static int tagidx_catchup( const t_dbcatalog *c )
+{
+	PGresult *res;
+	char query[128];
+	int max;
+	int i;
+
+	if( tags_num && c->tag_max > tags[tags_num-1].id ){
+		res = db_query( "SELECT id FROM mserv_tag WHERE id > %d",
+				tags[tags_num-1].id );
+		if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+			syslog( LOG_ERR, "tagidx: %s", db_errstr() );
+			PQclear(res);
+			return -1;
+		}
+
+		for( i = 0; loaded && i < PQntuples(res); ++i )
+			tagidx_tag( pgint(res, i, 0) );
+		PQclear(res);
+	}
+
+	if( c->track_max > track_max ){
+		snprintf( query, sizeof(query), "SELECT id "
+				"FROM mserv_track "
+				"WHERE id > %d "
+				"ORDER BY id", track_max );
+		if( 0 > (max = load_ids( all, query )))
+			return -1;
+
+		snprintf( query, sizeof(query), "SELECT tag_id, file_id "
+				"FROM mserv_filetag "
+				"WHERE file_id > %d "
+				"ORDER BY tag_id, file_id", track_max );
+		if( load_filetags( query ))
+			return -1;
+
+		if( max > track_max )
+			track_max = max;
+	}
+
+	return loaded ? tags_num : -1;
+}
+
+static void tagidx_catalog( const t_dbcatalog *c )
+{
+	int filetags = 0;
+	int i;
+
+	if( ! opt_tag_index )
+		return;
+
+	if( loaded && c->tags == tagidx_catchup( c )
+			&& c->tracks == bitmap_num(all) ){
+
+		for( i = 0; i < tags_num; ++i )
+			filetags += bitmap_num(tags[i].tracks);
+
+		if( c->filetags == filetags )
+			return;
+	}
+
+	syslog( LOG_INFO, "tagidx: catalog changed, reloading" );
+	tagidx_load();
+}
+
+int tagidx_init( void )
+{
+	if( ! opt_tag_index )
+		return 0;
+
+	db_catalog_watch( tagidx_catalog );
+	return tagidx_load();
+}
+
+static int tagidx_ready( void )
+{
+	return opt_tag_index && loaded;
+}
+
+static t_tagent *tag_byname( const char *name )
+{
+	int i;
+
+	for( i = 0; i < tags_num; ++i )
+		if( 0 == strcmp( tags[i].name, name ))
+			return &tags[i];
+
+	return NULL;
+}
+
+/* same, but ask the DB for tags we don't know (yet) */
+static t_tagent *tag_resolve( const char *name )
+{
+	PGresult *res;
+	t_tagent *t;
+	char *esc;
+	int id;
+	int i;
+
+	if( NULL != (t = tag_byname( name )) || ! db_isup() )
+		return t;
+
+	if( NULL == (esc = db_escape( name )))
+		return NULL;
+
+	res = db_query( "SELECT id FROM mserv_tag WHERE name = '%s'", esc );
+	free( esc );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "tagidx: %s", db_errstr() );
+		PQclear(res);
+		return NULL;
+	}
+
+	if( PQntuples(res) < 1 ){
+		PQclear(res);
+		return NULL;
+	}
+
+	id = pgint(res, 0, 0);
+	PQclear(res);
+
+	syslog( LOG_DEBUG, "tagidx: new tag %d %s", id, name );
+	tagidx_tag( id );
+	if( 0 > (i = tag_find( id )))
+		return NULL;
+
+	return &tags[i];
+}
+
+/* tracks tagged with tag referred to by v, NULL: unknown tag */
+static t_tagent *tag_byval( value *v )
+{
+	int i;
+
+	switch( v->type ){
+	  case vt_num:
+		if( 0 > (i = tag_find( v->val.num )))
+			return NULL;
+		return &tags[i];
+
+	  case vt_string:
+		return tag_resolve( v->val.string );
+
+	  case vt_none:
+	  case vt_list:
+	  case vt_max:
+		break;
+	}
+
+	return NULL;
+}
+
+static t_bitmap *eval_test( valtest *vt )
+{
+	t_bitmap *r;
+	t_bitmap *tmp;
+	t_tagent *t;
+	value **v;
+
+	if( vt->field != vf_tag )
+		return NULL;
+
+	switch( vt->op ){
+	  case vo_eq:
+		if( vt->val->type != vt_num && vt->val->type != vt_string )
+			return NULL;
+
+		if( NULL == (t = tag_byval( vt->val )))
+			return bitmap_new();
+
+		return bitmap_and( t->tracks, all );
+
+	  case vo_in:
+		if( vt->val->type != vt_list )
+			return NULL;
+
+		if( NULL == (r = bitmap_new()))
+			return NULL;
+
+		for( v = vt->val->val.list; *v; ++v ){
+			if( NULL == (t = tag_byval( *v )))
+				continue;
+
+			tmp = bitmap_or( r, t->tracks );
+			bitmap_free( r );
+			if( NULL == (r = tmp) )
+				return NULL;
+		}
+
+		tmp = bitmap_and( r, all );
+		bitmap_free( r );
+		return tmp;
+
+	  default:
+		/* regular expressions are left to the DB */
+		break;
+	}
+
+	return NULL;
+}
+
+static t_bitmap *eval( expr *e )
+{
+	t_bitmap *a;
+	t_bitmap *b;
+	t_bitmap *r = NULL;
+
+	switch( e->op ){
+	  case op_self:
+		return eval_test( e->data.val );
+
+	  case op_not:
+		if( NULL == (a = eval( e->data.expr[0] )))
+			return NULL;
+
+		r = bitmap_andnot( all, a );
+		bitmap_free( a );
+		return r;
+
+	  case op_and:
+	  case op_or:
+		if( NULL == (a = eval( e->data.expr[0] )))
+			return NULL;
+
+		if( NULL == (b = eval( e->data.expr[1] ))){
+			bitmap_free( a );
+			return NULL;
+		}
+
+		if( e->op == op_and )
+			r = bitmap_and( a, b );
+		else
+			r = bitmap_or( a, b );
+
+		bitmap_free( a );
+		bitmap_free( b );
+		return r;
+
+	  case op_none:
+	  case op_max:
+		break;
+	}
+
+	return NULL;
+}
+
+t_bitmap *tagidx_eval( expr *e )
+{
+	t_bitmap *r;
+
+	if( ! e || ! tagidx_ready() )
+		return NULL;
+
+	if( NULL != (r = eval( e )))
+		syslog( LOG_DEBUG, "tagidx: %d matches", bitmap_num(r) );
+
+	return r;
+}
+
+int tagidx_id( const char *name )
+{
+	t_tagent *t;
+
+	if( ! tagidx_ready() )
+		return -2;
+
+	if( NULL == (t = tag_byname( name )))
+		return -1;
+
+	return t->id;
+}
+
+void tagidx_tagged( int tid, int id, int set )
+{
+	int i;
+
+	if( ! loaded )
+		return;
+
+	if( 0 > (i = tag_find( id )))
+		return;
+
+	if( 0 > (set ? bitmap_add( tags[i].tracks, tid )
+			: bitmap_del( tags[i].tracks, tid )))
+		loaded = 0;
+}
+
+void tagidx_tag( int id )
+{
+	PGresult *res;
+	t_tagent *tmp;
+	t_tagent t;
+	char query[128];
+	int i;
+
+	if( ! loaded )
+		return;
+
+	if( 0 <= (i = tag_find( id ))){
+		free( tags[i].name );
+		bitmap_free( tags[i].tracks );
+		--tags_num;
+		memmove( tags + i, tags + i + 1,
+				(tags_num - i) * sizeof(t_tagent));
+	}
+
+	res = db_query( "SELECT name FROM mserv_tag WHERE id = %d", id );
+	if( ! res || PGRES_TUPLES_OK != PQresultStatus(res) ){
+		syslog( LOG_ERR, "tagidx_tag: %s", db_errstr() );
+		PQclear(res);
+		loaded = 0;
+		return;
+	}
+
+	/* deleted */
+	if( PQntuples(res) < 1 ){
+		PQclear(res);
+		return;
+	}
+
+	t.id = id;
+	t.name = pgstring(res, 0, 0);
+	t.tracks = bitmap_new();
+	PQclear(res);
+
+	snprintf( query, sizeof(query), "SELECT file_id "
+			"FROM mserv_filetag "
+			"WHERE tag_id = %d "
+			"ORDER BY file_id", id );
+
+	if( ! t.name || ! t.tracks || 0 > load_ids( t.tracks, query )
+		|| NULL == (tmp = realloc( tags, (tags_num + 1)
+				* sizeof(t_tagent)))){
+
+		free( t.name );
+		bitmap_free( t.tracks );
+		loaded = 0;
+		return;
+	}
+
+	tags = tmp;
+	i = -tag_find( id ) - 1;
+	memmove( tags + i + 1, tags + i, (tags_num - i) * sizeof(t_tagent));
+	tags[i] = t;
+	++tags_num;
+}
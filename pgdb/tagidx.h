@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PGDB_TAGIDX_H
+#define _PGDB_TAGIDX_H
+
+#include <commondb/parseexpr.h>
+#include "bitmap.h"
+
+/*
+ * in-memory index of tagged tracks, enabled by tag_index. Filters
+ * consisting of tag tests only are evaluated without the DB.
+ */
+
+/* (re-)load on a new DB connection */
+int tagidx_init( void );
+
+/* tracks matching e, NULL when e can't be evaluated by the index -
+ * to free by caller */
+t_bitmap *tagidx_eval( expr *e );
+
+/* tag id by name, -1: not in the index (yet), -2: index not loaded */
+int tagidx_id( const char *name );
+
+/* track tid was (un)tagged with tag id */
+void tagidx_tagged( int tid, int id, int set );
+
+/* tag was added, renamed or deleted */
+void tagidx_tag( int id );
+
+#endif
@@ -7,52 +7,328 @@
  *
  */
 
+/*
+ * drive the random pick engine against a synthetic library with a
+ * simulated play clock and report speed and quality of the picks.
+ */
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <config.h>
+#include "pick.h"
+
+/* simulation starts here */
+#define CLOCK_START	1200000000
 
+/* history of the synthetic library */
+#define HIST_SPAN	(365 * 24 * 3600)
+
+/* buckets for the rank histogram */
 #define NUM	20
 
-static void set( char *what, int *ar, int num )
+static const char *algos[] = {
+	"plain",
+	"abs",
+	"divi",
+	"first",
+	"lastplay",
+	"score",
+	"shuffle",
+	NULL,
+};
+
+static int sizes[] = {
+	10000,
+	100000,
+	1000000,
+	0,
+};
+
+typedef struct {
+	int num;		/* tracks */
+	int plays;		/* simulated plays */
+	int gap;		/* seconds per play */
+	int percent;
+	int max;
+	double scorebase;
+	unsigned int seed;
+} t_sim;
+
+static double now_us( void )
 {
-	if( num < NUM ){
-		++ar[num];
-	} else {
-		printf("%s out of bounds: %d\n", what, num );
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (double)ts.tv_sec * 1000000 + (double)ts.tv_nsec / 1000;
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_int( const void *a, const void *b )
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+static int cmp_lplay( const void *a, const void *b )
+{
+	return ((const t_pickcand*)a)->lplay - ((const t_pickcand*)b)->lplay;
+}
+
+/* percentile of a sorted array */
+#define PCT(ar,num,p)	((num) ? (ar)[ (int)((double)(num-1) * (p) / 100) ] : 0)
+
+/*
+ * synthetic library: 10% never played, the rest played during the
+ * last year. Most tracks have no score.
+ */
+static t_pickcand *mklib( t_sim *sim )
+{
+	t_pickcand *cand;
+	int i;
+	int r;
+
+	if( NULL == (cand = malloc( (sim->num + 1) * sizeof(t_pickcand))))
+		return NULL;
+
+	for( i = 0; i < sim->num; ++i ){
+		cand[i].id = i + 1;
+		cand[i].fname = NULL;
+
+		if( random() % 10 == 0 )
+			cand[i].lplay = 0;
+		else
+			cand[i].lplay = CLOCK_START - 1 -
+				(int)((double)random() / RAND_MAX * HIST_SPAN);
+
+		r = random() % 20;
+		cand[i].score = r < 2 ? r - 2 : r > 17 ? r - 17 : 0;
 	}
+
+	qsort( cand, sim->num, sizeof(t_pickcand), cmp_lplay );
+	return cand;
 }
 
-int main( int argc, char **argv )
+static int simulate( t_sim *sim, t_pickalgo algo, const char *name )
 {
-	int plain[NUM];
-	int arit[NUM];
-	int geom[NUM];
-	int abso[NUM];
-	int divi[NUM];
+	t_pickconf conf;
+	t_pickset set;
+	t_pickcand *cand;
+	double *lat_pick;
+	double upd = 0;
+	int *age;
+	int *dist;
+	int *last;
+	int ndist = 0;
+	int never = 0;
+	int cover = 0;
+	int clock = CLOCK_START;
+	double t0;
+	int slot;
 	int i;
+	int r = -1;
 
-	memset(plain, 0, sizeof(int) * NUM );
-	memset(arit, 0, sizeof(int) * NUM );
-	memset(geom, 0, sizeof(int) * NUM );
-	memset(abso, 0, sizeof(int) * NUM );
-	memset(divi, 0, sizeof(int) * NUM );
+	srandom( sim->seed );
+	if( NULL == (cand = mklib( sim )))
+		goto clean1;
 
-	(void)argc;
-	(void)argv;
+	conf.algo = algo;
+	conf.percent = sim->percent;
+	conf.max = sim->max;
+	conf.scorebase = sim->scorebase;
+
+	if( pickset_init( &set, &conf, cand, sim->num, clock )){
+		free( cand );
+		goto clean1;
+	}
 
+	lat_pick = malloc( sim->plays * sizeof(double) );
+	age = malloc( sim->plays * sizeof(int) );
+	dist = malloc( sim->plays * sizeof(int) );
+	last = malloc( sim->num * sizeof(int) );
+	if( ! lat_pick || ! age || ! dist || ! last )
+		goto clean2;
+
+	for( i = 0; i < sim->num; ++i )
+		last[i] = -1;
+
+	for( i = 0; i < sim->plays; ++i ){
+		t0 = now_us();
+		slot = pickset_pick( &set, clock );
+		lat_pick[i] = now_us() - t0;
+
+		if( set.cand[slot].lplay )
+			age[i] = clock - set.cand[slot].lplay;
+		else {
+			age[i] = -1;
+			++never;
+		}
+
+		if( last[slot] < 0 )
+			++cover;
+		else
+			dist[ndist++] = i - last[slot];
+		last[slot] = i;
+
+		t0 = now_us();
+		pickset_played( &set, slot, clock );
+		upd += now_us() - t0;
+
+		clock += sim->gap;
+	}
+
+	qsort( lat_pick, sim->plays, sizeof(double), cmp_double );
+	qsort( age, sim->plays, sizeof(int), cmp_int );
+	qsort( dist, ndist, sizeof(int), cmp_int );
+
+	/* skip never played tracks for the age percentiles */
+	printf( "%-8s %8d %7d %7.2f %7.2f %7.2f %7.2f "
+			"%6.0f %6.0f %6.0f %6d "
+			"%6d %6d %6d %6.1f\n",
+			name, sim->num, sim->plays,
+			PCT(lat_pick, sim->plays, 50),
+			PCT(lat_pick, sim->plays, 99),
+			lat_pick[sim->plays-1],
+			upd / sim->plays,
+			PCT(age + never, sim->plays - never, 10) / 3600.0,
+			PCT(age + never, sim->plays - never, 50) / 3600.0,
+			PCT(age + never, sim->plays - never, 90) / 3600.0,
+			never,
+			ndist,
+			ndist ? dist[0] : 0,
+			PCT(dist, ndist, 50),
+			100.0 * cover / sim->num );
+	r = 0;
+
+clean2:
+	free( lat_pick );
+	free( age );
+	free( dist );
+	free( last );
+	pickset_clear( &set );
+clean1:
+	if( r )
+		fprintf( stderr, "%s: out of memory\n", name );
+	return r;
+}
+
+/* distribution of the ranks picked by the rank based algorithms */
+static void histogram( void )
+{
+	int hist[pk_first+1][NUM];
+	int a;
+	int i;
+
+	memset( hist, 0, sizeof(hist) );
 	for( i = 1000000; --i; ){
-		set( "plain", plain, ((double)random() / RAND_MAX) * NUM );
-		set( "arit", arit, ( (double)random() + random() ) / ((double)2*RAND_MAX) * NUM );
-		set( "geom", geom, sqrt( (double)random() * random() ) / RAND_MAX * NUM );
-		set( "abso", abso, (double)abs( (double)random() + random() - RAND_MAX )  / RAND_MAX * NUM );
-		set( "divi", divi, ((double)random() * random()) / ( (double)RAND_MAX * RAND_MAX) * NUM );
+		for( a = 0; a <= pk_first; ++a )
+			++hist[a][pick_rank( a, NUM )];
 	}
 
+	printf( "%3s", "i" );
+	for( a = 0; a <= pk_first; ++a )
+		printf( " %6s", algos[a] );
+	printf( "\n" );
 
-	printf( "%3s %6s %6s %6s %6s %6s\n", "i", "plain", "arit", "geom", "abs", "div");
 	for( i = 0; i < NUM; ++i ){
-		printf( "%3d %6d %6d %6d %6d %6d\n", i, plain[i], arit[i], geom[i], abso[i], divi[i] );
+		printf( "%3d", i );
+		for( a = 0; a <= pk_first; ++a )
+			printf( " %6d", hist[a][i] );
+		printf( "\n" );
+	}
+}
+
+static void usage( const char *name )
+{
+	fprintf( stderr, "usage: %s [-H] [-a <algo>] [-n <tracks>] "
+			"[-p <plays>] [-g <gap>] [-P <percent>] [-m <max>] "
+			"[-b <scorebase>] [-s <seed>]\n", name );
+	exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+	t_sim sim;
+	const char *algo = NULL;
+	int fixed;
+	int a;
+	int i;
+	int c;
+
+	sim.num = 0;
+	sim.plays = 10000;
+	sim.gap = 240;
+	sim.percent = 33;
+	sim.max = 0;
+	sim.scorebase = 2;
+	sim.seed = 1;
+
+	while( -1 != (c = getopt( argc, argv, "Ha:n:p:g:P:m:b:s:" ))){
+		switch( c ){
+		  case 'H':
+			histogram();
+			return 0;
+
+		  case 'a':
+			algo = optarg;
+			if( 0 > pick_algo( algo ))
+				usage( argv[0] );
+			break;
+
+		  case 'n': sim.num = atoi( optarg ); break;
+		  case 'p': sim.plays = atoi( optarg ); break;
+		  case 'g': sim.gap = atoi( optarg ); break;
+		  case 'P': sim.percent = atoi( optarg ); break;
+		  case 'm': sim.max = atoi( optarg ); break;
+		  case 'b': sim.scorebase = atof( optarg ); break;
+		  case 's': sim.seed = atoi( optarg ); break;
+		  default: usage( argv[0] );
+		}
+	}
+
+	if( optind < argc || sim.plays < 1 )
+		usage( argv[0] );
+
+	/*
+	 * pick:   latency of a pick in us: median, 99th percentile, max
+	 * upd:    mean latency of the update after a play in us
+	 * age:    hours since the last play of picked tracks: 10th,
+	 *         50th and 90th percentile
+	 * never:  picks of tracks never played before
+	 * repeat: tracks picked again during the simulation, minimum
+	 *         and median number of plays in between
+	 * cover:  percentage of the library played
+	 */
+	printf( "%-8s %8s %7s %7s %7s %7s %7s "
+			"%6s %6s %6s %6s "
+			"%6s %6s %6s %6s\n",
+			"algo", "tracks", "plays",
+			"pick50", "pick99", "pickmax", "upd",
+			"age10", "age50", "age90", "never",
+			"repeat", "dmin", "d50", "cover" );
+
+	/* -n runs a single library size */
+	fixed = sim.num;
+	for( i = 0; fixed ? i < 1 : sizes[i] > 0; ++i ){
+		if( ! fixed )
+			sim.num = sizes[i];
+
+		for( a = 0; algos[a]; ++a ){
+			if( algo && strcmp( algo, algos[a] ))
+				continue;
+
+			if( simulate( &sim, a, algos[a] ))
+				return 1;
+		}
 	}
 
 	return 0;
@@ -19,25 +19,58 @@
 
 #include <config.h>
 #include <opt.h>
+#include <commondb/avail.h>
 #include "dudldb.h"
 #include "track.h"
 #include "artist.h"
 #include "album.h"
 #include "filter.h"
-
-
-
-
-
+#include "sfcache.h"
+#include "tagidx.h"
+
+
+
+
+
+
+enum {
+	tc_id,
+	tc_albumpos,
+	tc_lplay,
+	tc_dur,
+	tc_segfrom,
+	tc_segto,
+	tc_rgain,
+	tc_rgainpeak,
+	tc_filename,
+	tc_title,
+	tc_max
+};
+
+static const char *track_cols[] = {
+	[tc_id]		= "id",
+	[tc_albumpos]	= "album_pos",
+	[tc_lplay]	= "lplay",
+	[tc_dur]	= "dur",
+	[tc_segfrom]	= "seg_from",
+	[tc_segto]	= "seg_to",
+	[tc_rgain]	= "rgain",
+	[tc_rgainpeak]	= "rgain_peak",
+	[tc_filename]	= "filename",
+	[tc_title]	= "title",
+	[tc_max]	= NULL,
+};
 
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing track data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing track data: %s", track_cols[field] ); \
 		goto gofail; \
 	}
 
-t_track *track_convert( PGresult *res, int tup )
+t_track *track_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_track *t;
 	int f;
 
@@ -49,54 +82,58 @@ t_track *track_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
-	if( NULL == (t = malloc(sizeof(t_track))))
+	if( NULL == (col = db_colmap( r, track_cols )))
+		return NULL;
+
+	if( NULL == (t = arena_alloc( r->arena, sizeof(t_track))))
 		return NULL;
 	memset( t, 0, sizeof(t_track));
 
 	t->_refs = 1;
+	t->_arena = NULL != r->arena;
 
-	GETFIELD(f,"id", clean1 );
+	GETFIELD(f,tc_id, clean1 );
 	t->id = pgint(res, tup, f );
 
-	GETFIELD(f,"album_pos", clean1 );
+	GETFIELD(f,tc_albumpos, clean1 );
 	t->albumnr = pgint(res, tup, f);
 
 	t->lastplay = 0;
-	if( -1 != (f = PQfnumber( res, "lplay" )))
+	if( -1 != (f = col[tc_lplay]))
 		t->lastplay = pgint(res, tup, f);
 
 	t->duration = 0; /* TODO: nanosec duration */
-	if( -1 != (f = PQfnumber( res, "dur" )))
+	if( -1 != (f = col[tc_dur]))
 		t->duration = pgint(res, tup, f);
 
 	t->seg_from = 0;
-	if( -1 != (f = PQfnumber( res, "seg_from" )))
+	if( -1 != (f = col[tc_segfrom]))
 		t->seg_from = pgint64(res, tup, f);
 
 	t->seg_to = (gint64)t->duration * 1000000000;
-	if( -1 != (f = PQfnumber( res, "seg_to" )))
+	if( -1 != (f = col[tc_segto]))
 		t->seg_to = pgint64(res, tup, f);
 
 	t->rgain = 0;
-	if( -1 != (f = PQfnumber( res, "rgain" )))
+	if( -1 != (f = col[tc_rgain]))
 		t->rgain = pgdouble(res, tup, f);
 
 	t->rgainpeak = 0;
-	if( -1 != (f = PQfnumber( res, "rgain_peak" )))
+	if( -1 != (f = col[tc_rgainpeak]))
 		t->rgainpeak = pgdouble(res, tup, f);
 
-	GETFIELD(f,"filename", clean1 );
-	if( NULL == (t->fname = pgstring(res, tup, f)))
+	GETFIELD(f,tc_filename, clean1 );
+	if( NULL == (t->fname = pgastring(r->arena, res, tup, f)))
 		goto clean1;
 
-	GETFIELD(f,"title", clean2 );
-	if( NULL == (t->title = pgstring(res, tup, f)))
+	GETFIELD(f,tc_title, clean2 );
+	if( NULL == (t->title = pgastring(r->arena, res, tup, f)))
 		goto clean2;
 
-	if( NULL == (t->artist = artist_convert_title(res, tup)))
+	if( NULL == (t->artist = artist_convert_title(r, tup)))
 		goto clean3;
 
-	if( NULL == (t->album = album_convert(res, tup)))
+	if( NULL == (t->album = album_convert(r, tup)))
 		goto clean4;
 
 	return t;
@@ -105,19 +142,86 @@ clean4:
 	artist_free(t->artist);
 
 clean3:
-	free(t->title);
+	arena_free(r->arena, t->title);
 
 clean2:
-	free(t->fname);
+	arena_free(r->arena, t->fname);
 
 clean1:
-	free(t);
+	arena_free(r->arena, t);
+
+	return NULL;
+}
+
+/*
+ * copy a track (from an iterator's arena) to the heap
+ */
+static t_track *track_dup( t_track *in )
+{
+	t_track *t;
+
+	if( NULL == (t = malloc(sizeof(t_track))))
+		return NULL;
+
+	*t = *in;
+	t->_refs = 1;
+	t->_arena = 0;
+	t->fname = NULL;
+	t->title = NULL;
+	t->artist = NULL;
+	t->album = NULL;
+
+	if( NULL == (t->fname = strdup(in->fname)))
+		goto clean1;
+
+	if( NULL == (t->title = strdup(in->title)))
+		goto clean1;
+
+	if( NULL == (t->artist = artist_dup(in->artist)))
+		goto clean1;
 
+	if( NULL == (t->album = album_dup(in->album)))
+		goto clean1;
+
+	return t;
+
+clean1:
+	track_free(t);
 	return NULL;
 }
 
+/*
+ * build a track from the little that's known without the DB - to keep
+ * playing while it is down.
+ */
+t_track *track_minimal( int id, char *fname, unsigned int lastplay )
+{
+	t_artist artist = {
+		.id = 0,
+		.artist = "",
+	};
+	t_album album = {
+		.id = 0,
+		.album = "",
+		.artist = &artist,
+	};
+	t_track t = {
+		.id = id,
+		.album = &album,
+		.title = "",
+		.artist = &artist,
+		.fname = fname,
+		.lastplay = lastplay,
+	};
+
+	return track_dup( &t );
+}
+
 t_track *track_use( t_track *t )
 {
+	if( t->_arena )
+		return track_dup(t);
+
 	t->_refs ++;
 	return t;
 }
@@ -127,6 +231,9 @@ void track_free( t_track *t )
 	if( ! t )
 		return;
 
+	if( t->_arena )
+		return;
+
 	if( -- t->_refs > 0 )
 		return;
 
@@ -157,6 +264,8 @@ int track_setname( int trackid, const char *title )
 
 	PQclear(res);
 
+	sfcache_track( trackid );
+
 	return 0;
 }
 
@@ -174,6 +283,8 @@ int track_setartist( int trackid, int artistid )
 
 	PQclear(res);
 
+	sfcache_track( trackid );
+
 	return 0;
 }
 
@@ -218,7 +329,7 @@ t_track *track_get( int id )
 		return NULL;
 	}
 
-	t = track_convert( res, 0 );
+	t = track_convert( DBRES(res), 0 );
 	PQclear( res );
 
 	return t;
@@ -260,21 +371,35 @@ it_track *tracks_search( const char *substr )
 
 it_track *tracks_searchf( expr *filter )
 {
-	char where[4096];
+	t_bitmap *set;
+	char *ids;
+	it_track *it;
+
+	/* tag filters are resolved by the index */
+	if( NULL != (set = tagidx_eval( filter ))){
+		ids = bitmap_fmt( set );
+		bitmap_free( set );
+		if( ! ids )
+			return NULL;
+
+		it = db_iterate( (db_convert)track_convert, "SELECT * "
+			"FROM mserv_track t "
+			"WHERE id = ANY('{%s}') "
+			"ORDER BY LOWER(album_artist_name), LOWER(album_name), album_pos",
+			ids );
+		free( ids );
+		return it;
+	}
 
-	*where = 0;
-	sql_expr(where, 4096, filter);
-	if( ! *where ){
-		syslog( LOG_ERR, "tracks_searchf skipped: empty where statement");
+	if( NULL == (it = sql_iterate( (db_convert)track_convert, filter,
+			"SELECT * FROM mserv_track t",
+			"ORDER BY LOWER(album_artist_name), LOWER(album_name), album_pos" ))){
+		syslog( LOG_ERR, "tracks_searchf failed" );
 		// TODO: errno = EINVAL;
 		return NULL;
 	}
 
-	return db_iterate( (db_convert)track_convert, "SELECT * "
-			"FROM mserv_track t "
-			"WHERE %s "
-			"ORDER BY LOWER(album_artist_name), LOWER(album_name), album_pos",
-			where );
+	return it;
 }
 
 int tracks( void )
@@ -304,8 +429,12 @@ int track_mkpath( char *buf, int len, t_track *t )
 int track_exists( t_track *t )
 {
 	char buf[MAXPATHLEN];
-	PGresult *res;
 	int fd;
+	int avail;
+
+	/* background scanner knows better - without blocking */
+	if( 0 <= (avail = avail_track( t->id )))
+		return avail;
 
 	/* try to open the file - the easiest way to see, if it is
 	 * readable */
@@ -314,13 +443,8 @@ int track_exists( t_track *t )
 
 		syslog( LOG_NOTICE, "track is unavailable: %d, %s",
 				t->id, buf );
-		res = db_query( "UPDATE stor_file SET available = false "
+		db_spool( "UPDATE stor_file SET available = false "
 				"WHERE id = %d", t->id );
-
-		if( ! res || PQresultStatus(res) != PGRES_COMMAND_OK )
-			syslog( LOG_ERR, "track_exists: %s", db_errstr() );
-
-		PQclear(res);
 		return 0;
 	}
 
@@ -13,6 +13,7 @@
 #include <commondb/track.h>
 #include "dudldb.h"
 
-t_track *track_convert( PGresult *res, int tup );
+t_track *track_convert( t_dbres *r, int tup );
+t_track *track_minimal( int id, char *fname, unsigned int lastplay );
 
 #endif
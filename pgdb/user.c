@@ -18,14 +18,33 @@
 #include "dudldb.h"
 #include "user.h"
 
+enum {
+	uc_id,
+	uc_lev,
+	uc_name,
+	uc_pass,
+	uc_max
+};
+
+static const char *user_cols[] = {
+	[uc_id]		= "id",
+	[uc_lev]	= "lev",
+	[uc_name]	= "name",
+	[uc_pass]	= "pass",
+	[uc_max]	= NULL,
+};
+
 #define GETFIELD(var,field,gofail) \
-	if( -1 == (var = PQfnumber(res, field ))){\
-		syslog( LOG_ERR, "missing user data: %s", field ); \
+	if( -1 == (var = col[field] )){\
+		syslog( LOG_ERR, "missing user data: %s", user_cols[field] ); \
 		goto gofail; \
 	}
 
-static t_user *user_convert( PGresult *res, int tup )
+/* users are refcounted and shared with clients - always on the heap */
+static t_user *user_convert( t_dbres *r, int tup )
 {
+	PGresult *res = r->res;
+	const int *col;
 	t_user *u;
 	int f;
 
@@ -35,23 +54,26 @@ static t_user *user_convert( PGresult *res, int tup )
 	if( tup >= PQntuples(res) )
 		return NULL;
 
+	if( NULL == (col = db_colmap( r, user_cols )))
+		return NULL;
+
 	if( NULL == (u = malloc(sizeof(t_user))))
 		return NULL;
 	memset( u, 0, sizeof(t_user));
 
 	u->_refs = 1;
 
-	GETFIELD(f,"id", clean1 );
+	GETFIELD(f,uc_id, clean1 );
 	u->id = pgint(res, tup, f);
 
-	GETFIELD(f,"lev", clean1 );
+	GETFIELD(f,uc_lev, clean1 );
 	u->right = pgint(res, tup, f );
 
-	GETFIELD(f,"name", clean1 );
+	GETFIELD(f,uc_name, clean1 );
 	if( NULL == (u->name = pgstring(res, tup, f)))
 		goto clean1;
 
-	GETFIELD(f,"pass", clean1 );
+	GETFIELD(f,uc_pass, clean1 );
 	if( NULL == (u->_pass = pgstring(res, tup, f)))
 		goto clean2;
 
@@ -65,6 +87,12 @@ clean1:
 	return NULL;
 }
 
+t_user *user_use( t_user *u )
+{
+	u->_refs ++;
+	return u;
+}
+
 void user_free( t_user *u )
 {
 	if( ! u )
@@ -155,7 +183,7 @@ t_user *user_get( int uid )
 		return NULL;
 	}
 
-	u = user_convert(res, 0);
+	u = user_convert(DBRES(res), 0);
 	PQclear(res);
 	return u;
 }
@@ -182,7 +210,7 @@ t_user *user_getn( const char *name )
 		return NULL;
 	}
 
-	u = user_convert(res, 0);
+	u = user_convert(DBRES(res), 0);
 	PQclear(res);
 	return u;
 }
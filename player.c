@@ -12,6 +12,8 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -34,23 +36,69 @@
 #include "commondb/queue.h"
 #include "commondb/history.h"
 #include "commondb/tag.h"
+#include "commondb/zone.h"
 #include "player.h"
+#include "prefetch.h"
+#include "seekindex.h"
+#include "stream.h"
 
 
-static int do_random = 1;
-static int gap = 0;
-static int cut = 0;
-static t_replaygain rgtype = rg_none;
-static double rgpreamp = 0;
-static int gap_id = 0;
-static int elapsed_id = 0;
+/* filesrc read size with read-ahead enabled */
+#define READAHEAD_BLOCK	65536
 
-static t_track *curtrack = NULL;
-static int curuid = 0;
+/* seconds of audio to buffer for the stream encoder */
+#define STREAM_QUEUE	2
 
-GstElement *p_src = NULL;
-GstElement *p_vol = NULL;
-GstElement *p_pipe = NULL;
+/* number of queued tracks to prefetch */
+#define PREFETCH_QUEUE	4
+
+/* refresh prefetching this many seconds before a track ends */
+#define PREFETCH_LEAD	30
+
+/*
+ * each zone has its own pipeline and play state. Interface functions
+ * work on the player of zone_cur.
+ */
+typedef struct {
+	int zone;
+
+	int do_random;
+	int gap;
+	int cut;
+	t_replaygain rgtype;
+	double rgpreamp;
+	int gap_id;
+	int elapsed_id;
+	int prefetch_id;
+
+	t_track *curtrack;
+	int curuid;
+
+	/* streaming thread that got realtime priority */
+	pthread_t rt_thread;
+	volatile gint rt_done;
+	/* failure was reported */
+	volatile gint rt_warned;
+
+	/* read-ahead stats - updated by the streaming thread */
+	volatile gint buf_running;
+	volatile gint buf_underruns;
+
+	GstElement *p_src;
+	GstElement *p_buf;
+	GstElement *p_dec;
+	/* seek index of current track for p_dec */
+	GstIndex *p_index;
+	GstElement *p_vol;
+	GstElement *p_out;
+	GstElement *p_pipe;
+} t_player;
+
+static t_player players[ZONE_MAX];
+
+#define PLAYER	(&players[zone_cur])
+
+static int rt_policy = SCHED_FIFO;
 
 /* used by player_start: */
 t_player_func_update player_func_resume = NULL;
@@ -63,6 +111,15 @@ t_player_func_update player_func_stop = NULL;
 t_player_func_update player_func_random = NULL;
 t_player_func_elapsed player_func_elapsed = NULL;
 
+/* main loop callbacks act on behalf of their player's zone */
+static int zone_enter( t_player *p )
+{
+	int old = zone_cur;
+
+	zone_cur = p->zone;
+	return old;
+}
+
 /************************************************************
  * database functions
  */
@@ -70,161 +127,403 @@ t_player_func_elapsed player_func_elapsed = NULL;
 /*
  * get next track to play from database
  */
-static t_track *db_getnext( void )
+static t_track *db_getnext( t_player *p )
 {
 	t_queue *q;
 
-	if( curtrack ){
+	if( p->curtrack ){
 		syslog(LOG_NOTICE, "old track still busy");
 		return NULL;
 	}
 
 	/* queue */
 	while( NULL != (q = queue_fetch())){
-		curtrack = queue_track(q);
-		curuid = q->user->id;
+		p->curtrack = queue_track(q);
+		p->curuid = q->user->id;
 		queue_free(q);
 
-		if( track_exists(curtrack) )
-			return curtrack;
+		if( track_exists(p->curtrack) )
+			return p->curtrack;
 
-		track_free(curtrack);
+		track_free(p->curtrack);
 	}
 
-	curuid = 0;
-	if( ! do_random )
+	p->curuid = 0;
+	if( ! p->do_random )
 		return NULL;
 
 	/* random */
-	while( NULL != (curtrack = random_fetch())){
-		if( track_exists(curtrack) )
-			return curtrack;
+	while( NULL != (p->curtrack = random_fetch())){
+		if( track_exists(p->curtrack) )
+			return p->curtrack;
 
 		syslog( LOG_INFO, "skipping nonexisting track: %d",
-				curtrack->id);
-		track_free(curtrack);
+				p->curtrack->id);
+		track_free(p->curtrack);
 	}
 
 	return NULL;
 }
 
-static void db_finish( int completed )
+static void db_finish( t_player *p, int completed )
 {
-	if( ! curtrack )
+	if( ! p->curtrack )
 		return;
 
 	// TODO: set "complete" only when track was played at least 50%?
-	history_add( curtrack, curuid, completed );
+	history_add( p->curtrack, p->curuid, completed );
 	if( ! completed ){
 		int tagid;
 
 		if( 0 < (tagid = tag_id(opt_failtag)))
-			track_tagadd(curtrack->id,tagid);
+			track_tagadd(p->curtrack->id,tagid);
 	}
 
 
-	track_free( curtrack );
-	curtrack = NULL;
-	curuid = 0;
+	track_free( p->curtrack );
+	p->curtrack = NULL;
+	p->curuid = 0;
 }
 
 /************************************************************
  * gst backend functions
  */
 
-static int bp_start(void);
-static void bp_finish( int complete );
-static int bp_resume( void );
-static int bp_pause( void );
-static t_playstatus bp_status( void );
+static int bp_start( t_player *p );
+static void bp_finish( t_player *p, int complete );
+static int bp_resume( t_player *p );
+static int bp_pause( t_player *p );
+static t_playstatus bp_status( t_player *p );
+
+/*
+ * read-ahead queue ran dry. This also happens when a track starts and
+ * after the whole file was read - only count real stalls.
+ */
+static void cb_buf_underrun( GstElement *queue, gpointer data )
+{
+	t_player *p = (t_player*)data;
+	gint64 pos, dur;
+	GstFormat fmt = GST_FORMAT_BYTES;
+
+	(void)queue;
+
+	if( ! g_atomic_int_get( &p->buf_running ) )
+		return;
+
+	if( ! gst_element_query_position( p->p_src, &fmt, &pos )
+		|| ! gst_element_query_duration( p->p_src, &fmt, &dur )
+		|| pos >= dur )
+		return;
+
+	g_atomic_int_inc( &p->buf_underruns );
+	syslog( LOG_NOTICE, "player %d: read-ahead underrun at %d/%d KB",
+			p->zone, (int)(pos / 1024), (int)(dur / 1024) );
+}
+
+static void cb_buf_running( GstElement *queue, gpointer data )
+{
+	t_player *p = (t_player*)data;
+
+	(void)queue;
+
+	g_atomic_int_set( &p->buf_running, 1 );
+}
+
+/*
+ * runs in the streaming thread feeding the decoder - the one that
+ * has to keep the sink busy. Raise its priority once per thread. Each
+ * track may get a new thread, so failure is reported only once.
+ */
+static gboolean cb_rt_probe( GstPad *pad, GstBuffer *buf, gpointer data )
+{
+	t_player *p = (t_player*)data;
+	struct sched_param sp;
+	int r;
+
+	(void)pad;
+	(void)buf;
+
+	if( g_atomic_int_get( &p->rt_done )
+		&& pthread_equal( p->rt_thread, pthread_self() ))
+		return TRUE;
+
+	memset( &sp, 0, sizeof(sp) );
+	sp.sched_priority = opt_rtprio;
+	if( 0 != (r = pthread_setschedparam( pthread_self(), rt_policy, &sp ))
+		&& ! g_atomic_int_get( &p->rt_warned )){
+
+		g_atomic_int_set( &p->rt_warned, 1 );
+		syslog( LOG_WARNING, "player %d: cannot set realtime "
+				"priority: %s", p->zone, strerror(r) );
+	}
+
+	p->rt_thread = pthread_self();
+	g_atomic_int_set( &p->rt_done, 1 );
+
+	return TRUE;
+}
+
+/* set sink property in usec - if the element has it */
+static void sink_set( GstElement *e, const char *prop, int usec )
+{
+	if( usec <= 0 )
+		return;
+
+	if( ! g_object_class_find_property( G_OBJECT_GET_CLASS(e), prop ))
+		return;
+
+	syslog( LOG_DEBUG, "player: %s %s=%d", GST_ELEMENT_NAME(e),
+			prop, usec );
+	g_object_set( G_OBJECT(e), prop, (gint64)usec, NULL );
+}
+
+/*
+ * adjust audio sinks of the output pipeline. They're created by
+ * autoaudiosink & co when going to READY - and dropped again on NULL.
+ * So this is needed before each track.
+ */
+static void sink_setup( GstElement *out )
+{
+	GstIterator *it;
+	gpointer item;
+	int done = 0;
+
+	if( opt_sink_buffer <= 0 && opt_sink_latency <= 0 )
+		return;
+
+	it = gst_bin_iterate_recurse( GST_BIN(out) );
+	while( ! done ){
+		switch( gst_iterator_next( it, &item )){
+		  case GST_ITERATOR_OK:
+			sink_set( GST_ELEMENT(item), "buffer-time",
+					opt_sink_buffer );
+			sink_set( GST_ELEMENT(item), "latency-time",
+					opt_sink_latency );
+			gst_object_unref( item );
+			break;
+
+		  case GST_ITERATOR_RESYNC:
+			gst_iterator_resync( it );
+			break;
+
+		  default:
+			done++;
+			break;
+		}
+	}
+	gst_iterator_free( it );
+}
+
+/* encoded data for stream listeners */
+static void cb_stream_handoff( GstElement *sink, GstBuffer *buf,
+		GstPad *pad, gpointer data )
+{
+	(void)sink;
+	(void)pad;
+	(void)data;
+
+	stream_push( (const char*)GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf),
+			GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_IN_CAPS) );
+}
+
+/*
+ * encoding branch for the stream server. Its queue is leaky: when
+ * encoding falls behind, data is dropped - local playback never waits.
+ */
+static GstElement *stream_branch( void )
+{
+	GstElement *bin;
+	GstElement *sink;
+	GError *err = NULL;
+	char *desc;
+
+	desc = g_strdup_printf( "queue leaky=2 max-size-buffers=0 "
+			"max-size-bytes=0 max-size-time=%" G_GUINT64_FORMAT
+			" ! %s ! fakesink name=p_strsink sync=false "
+			"signal-handoffs=true",
+			(guint64)STREAM_QUEUE * GST_SECOND,
+			opt_stream_encoder );
+
+	syslog(LOG_DEBUG,"player: constructing stream pipeline: %s", desc );
+	bin = gst_parse_bin_from_description( desc, TRUE, &err );
+	g_free( desc );
+
+	if( NULL == bin ){
+		syslog(LOG_ERR,"player: cannot create stream pipeline: %s",
+			err->message );
+		g_error_free (err);
+		return NULL;
+	}
+
+	sink = gst_bin_get_by_name( GST_BIN(bin), "p_strsink" );
+	g_signal_connect( sink, "handoff",
+			G_CALLBACK(cb_stream_handoff), NULL );
+	gst_object_unref( sink );
+
+	return bin;
+}
+
+static void gap_finish( t_player *p )
+{
+	g_source_remove(p->gap_id);
+	p->gap_id = 0;
+}
+
+/*
+ * get the files of the next tracks into the page cache
+ */
+static void prefetch_next( t_player *p )
+{
+	char buf[PREFETCH_QUEUE +1][MAXPATHLEN];
+	char *paths[PREFETCH_QUEUE +1];
+	it_queue *it;
+	t_queue *q;
+	int num = 0;
+
+	it = queue_list();
+	for( q = it_queue_begin(it); q && num < PREFETCH_QUEUE;
+			q = it_queue_next(it) ){
+
+		track_mkpath( buf[num], MAXPATHLEN, q->track );
+		paths[num] = buf[num];
+		num++;
+		queue_free(q);
+	}
+	queue_free(q);
+	it_queue_done(it);
+
+	if( p->do_random && 0 <= random_peek( buf[num], MAXPATHLEN )){
+		paths[num] = buf[num];
+		num++;
+	}
+
+	prefetch_files( p->zone, paths, num );
+}
+
+static gint cb_prefetch_timeout( gpointer data )
+{
+	t_player *p = (t_player*)data;
+	int zone;
+
+	zone = zone_enter( p );
+	p->prefetch_id = 0;
+	prefetch_next( p );
+	zone_cur = zone;
+
+	return FALSE;
+}
+
+static void prefetch_add( t_player *p )
+{
+	t_track *t = p->curtrack;
+
+	if( p->prefetch_id )
+		g_source_remove( p->prefetch_id );
+	p->prefetch_id = 0;
+
+	prefetch_next( p );
 
-static void gap_finish( void )
+	/* queue might have changed till then */
+	if( t && t->duration > PREFETCH_LEAD )
+		p->prefetch_id = g_timeout_add(
+				1000 * (t->duration - PREFETCH_LEAD),
+				cb_prefetch_timeout, p );
+}
+
+static void prefetch_del( t_player *p )
 {
-	g_source_remove(gap_id);
-	gap_id = 0;
+	if( ! p->prefetch_id )
+		return;
+
+	g_source_remove( p->prefetch_id );
+	p->prefetch_id = 0;
 }
 
 static gint cb_elapsed_timeout( gpointer data )
 {
+	t_player *p = (t_player*)data;
 	gint64 pos;
 	GstFormat fmt = GST_FORMAT_TIME;
-
-	(void)data;
+	int zone;
 
 	if( ! player_func_elapsed ){
-		elapsed_id = 0;
+		p->elapsed_id = 0;
 		return FALSE;
 	}
 
-	if( ! gst_element_query_position( p_pipe, &fmt, &pos))
+	if( ! gst_element_query_position( p->p_pipe, &fmt, &pos))
 		pos = 0;
 
+	zone = zone_enter( p );
 	(*player_func_elapsed)( pos );
+	zone_cur = zone;
 
 	return TRUE;
 }
 
-static void elapsed_add( void )
+static void elapsed_add( t_player *p )
 {
 	if( ! player_func_elapsed )
 		return;
 
-	if( elapsed_id )
+	if( p->elapsed_id )
 		return;
 
-	elapsed_id = g_timeout_add(1000, cb_elapsed_timeout, NULL );
+	p->elapsed_id = g_timeout_add(1000, cb_elapsed_timeout, p );
 }
 
-static void elapsed_del( void )
+static void elapsed_del( t_player *p )
 {
-	if( ! elapsed_id )
+	if( ! p->elapsed_id )
 		return;
 
-	g_source_remove( elapsed_id );
-	elapsed_id = 0;
+	g_source_remove( p->elapsed_id );
+	p->elapsed_id = 0;
 }
 
-static t_playstatus bp_status( void )
+static t_playstatus bp_status( t_player *p )
 {
-	if( GST_STATE(p_pipe) == GST_STATE_PLAYING )
+	if( GST_STATE(p->p_pipe) == GST_STATE_PLAYING )
 		return pl_play;
 
-	else if( gap_id )
+	else if( p->gap_id )
 		return pl_play;
 
-	else if( GST_STATE(p_pipe) == GST_STATE_PAUSED )
+	else if( GST_STATE(p->p_pipe) == GST_STATE_PAUSED )
 		return pl_pause;
 
 	return pl_stop;
 }
 
-static int bp_volume( void )
+static int bp_volume( t_player *p )
 {
 	double volume;
 
-	if( ! curtrack )
+	if( ! p->curtrack )
 		return PE_OK;
 
-	volume = rgtype
-		? pow( 10, ( (track_rgval( curtrack, rgtype ) + rgpreamp)/20 ) )
+	volume = p->rgtype
+		? pow( 10, ( (track_rgval( p->curtrack, p->rgtype )
+				+ p->rgpreamp)/20 ) )
 		: 1;
-	g_object_set( G_OBJECT(p_vol), "volume", volume, NULL );
+	g_object_set( G_OBJECT(p->p_vol), "volume", volume, NULL );
 
 	return PE_OK;
 }
 
-static int bp_seek( gint64 to )
+static int bp_seek( t_player *p, gint64 to )
 {
+	t_track *curtrack = p->curtrack;
 	gboolean ret;
 
 
-	if( cut && curtrack->seg_to && to < (gint64)curtrack->seg_to ){
+	if( p->cut && curtrack->seg_to && to < (gint64)curtrack->seg_to ){
 		syslog(LOG_DEBUG, "bp_seek (%d) %d -> %d (%d)",
 			(int)( curtrack->seg_from / GST_SECOND),
 			(int)( to / GST_SECOND),
 			(int)( curtrack->seg_to / GST_SECOND),
 			curtrack->duration );
-		ret = gst_element_seek( p_pipe, 1.0, GST_FORMAT_TIME,
+		ret = gst_element_seek( p->p_pipe, 1.0, GST_FORMAT_TIME,
 			GST_SEEK_FLAG_FLUSH,
 			GST_SEEK_TYPE_SET, to,
 			GST_SEEK_TYPE_SET, (gint64)curtrack->seg_to);
@@ -233,7 +532,7 @@ static int bp_seek( gint64 to )
 			(int)( curtrack->seg_from / GST_SECOND),
 			(int)( to / GST_SECOND),
 			curtrack->duration );
-		ret = gst_element_seek( p_pipe, 1.0, GST_FORMAT_TIME,
+		ret = gst_element_seek( p->p_pipe, 1.0, GST_FORMAT_TIME,
 			GST_SEEK_FLAG_FLUSH,
 			GST_SEEK_TYPE_SET, to,
 			GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE );
@@ -246,44 +545,97 @@ static int bp_seek( gint64 to )
 
 }
 
-static int bp_start(void)
+/*
+ * hand the file's frame index to mad. It's used for seeking (to
+ * segment start or on jumps) instead of estimating the byte offset.
+ */
+static void bp_index( t_player *p, const char *fname )
+{
+	t_seekindex *si;
+	GstIndex *idx;
+	gint id;
+	int i;
+
+	if( p->p_index ){
+		gst_element_set_index( p->p_dec, NULL );
+		gst_object_unref( p->p_index );
+		p->p_index = NULL;
+	}
+
+	if( NULL == (si = seekindex_load( fname )))
+		return;
+
+	if( NULL == (idx = gst_index_factory_make( "memindex" ))){
+		syslog( LOG_ERR, "player: cannot create index" );
+		goto clean1;
+	}
+
+	if( ! gst_index_get_writer_id( idx, GST_OBJECT(p->p_dec), &id ) ){
+		gst_object_unref( idx );
+		goto clean1;
+	}
+
+	for( i = 0; i < si->num; ++i )
+		gst_index_add_association( idx, id,
+			GST_ASSOCIATION_FLAG_KEY_UNIT,
+			GST_FORMAT_BYTES, (gint64)si->off[i],
+			GST_FORMAT_TIME,
+				(gint64)i * si->spf * GST_SECOND / si->rate,
+			0 );
+
+	/* mad doesn't take a reference */
+	gst_element_set_index( p->p_dec, idx );
+	p->p_index = idx;
+
+clean1:
+	seekindex_free( si );
+}
+
+static int bp_start( t_player *p )
 {
 	char fname[MAXPATHLEN];
 
-	syslog(LOG_DEBUG, "bp_start");
-	if( bp_status() != pl_stop ){
+	syslog(LOG_DEBUG, "bp_start %d", p->zone);
+	if( bp_status(p) != pl_stop ){
 		syslog(LOG_NOTICE,"gst is still busy");
 		return -1;
 	}
 
 	/* get next track */
-	db_getnext();
-	if( NULL == curtrack ){
+	db_getnext(p);
+	if( NULL == p->curtrack ){
 		if( player_func_stop )
 			(*player_func_stop)();
 		return PE_NOTHING;
 	}
 
-	track_mkpath(fname, MAXPATHLEN, curtrack);
+	track_mkpath(fname, MAXPATHLEN, p->curtrack);
 	syslog(LOG_DEBUG, "play_gst: >%s<", fname);
-	g_object_set( G_OBJECT(p_src), "location", fname, NULL);
+	g_object_set( G_OBJECT(p->p_src), "location", fname, NULL);
+	g_atomic_int_set( &p->buf_running, 0 );
+	bp_index( p, fname );
+
+	bp_volume(p);
 
-	bp_volume();
+	/* sinks are recreated after bp_finish() went to NULL */
+	gst_element_set_state( p->p_pipe, GST_STATE_READY );
+	gst_element_get_state( p->p_pipe, NULL, NULL, GST_CLOCK_TIME_NONE );
+	sink_setup( p->p_out );
 
-	gst_element_set_state( p_pipe, GST_STATE_PAUSED );
-	gst_element_get_state( p_pipe, NULL, NULL, GST_CLOCK_TIME_NONE );
+	gst_element_set_state( p->p_pipe, GST_STATE_PAUSED );
+	gst_element_get_state( p->p_pipe, NULL, NULL, GST_CLOCK_TIME_NONE );
 
-	if( cut ){
-		bp_seek( curtrack->seg_from ); /* ignore failure */
+	if( p->cut ){
+		bp_seek( p, p->curtrack->seg_from ); /* ignore failure */
 	} else {
-		bp_seek( 0 );
+		bp_seek( p, 0 );
 	}
 
-	if( gst_element_set_state( p_pipe, GST_STATE_PLAYING )
+	if( gst_element_set_state( p->p_pipe, GST_STATE_PLAYING )
 		== GST_STATE_CHANGE_FAILURE ){
 
 		syslog(LOG_ERR, "play_gst: failed to play" );
-		db_finish(0);
+		db_finish(p, 0);
 
 		if( player_func_stop )
 			(*player_func_stop)();
@@ -294,44 +646,46 @@ static int bp_start(void)
 	if( player_func_newtrack )
 		(*player_func_newtrack)();
 
-	elapsed_add();
+	elapsed_add(p);
+	prefetch_add(p);
 
 	return PE_OK;
 }
 
-static void bp_finish( int complete )
+static void bp_finish( t_player *p, int complete )
 {
-	syslog(LOG_DEBUG, "bp_finish %d", complete);
+	syslog(LOG_DEBUG, "bp_finish %d %d", p->zone, complete);
 
-	elapsed_del();
+	elapsed_del(p);
+	prefetch_del(p);
 
-	if( gap_id )
-		gap_finish();
+	if( p->gap_id )
+		gap_finish(p);
 
 	// stop the pipe completely
-	if( gst_element_set_state( p_pipe, GST_STATE_NULL )
+	if( gst_element_set_state( p->p_pipe, GST_STATE_NULL )
 		== GST_STATE_CHANGE_FAILURE ){
 
 		syslog(LOG_ERR, "play_gst: failed to finish");
-		db_finish(0);
+		db_finish(p, 0);
 		return;
 	}
 
-	db_finish(complete);
+	db_finish(p, complete);
 }
 
-static int bp_resume( void )
+static int bp_resume( t_player *p )
 {
-	syslog(LOG_DEBUG, "bp_resume");
+	syslog(LOG_DEBUG, "bp_resume %d", p->zone);
 
-	if( GST_STATE(p_pipe) != GST_STATE_PAUSED )
+	if( GST_STATE(p->p_pipe) != GST_STATE_PAUSED )
 		return -1;
 
-	if( gst_element_set_state( p_pipe, GST_STATE_PLAYING )
+	if( gst_element_set_state( p->p_pipe, GST_STATE_PLAYING )
 		== GST_STATE_CHANGE_FAILURE ){
 
 		syslog(LOG_ERR, "play_gst: failed to resume");
-		bp_finish(0);
+		bp_finish(p, 0);
 		if( player_func_stop )
 			(*player_func_stop)();
 		return -1;
@@ -340,17 +694,17 @@ static int bp_resume( void )
 	if( player_func_resume )
 		(*player_func_resume)();
 
-	elapsed_add();
+	elapsed_add(p);
 
 	return 0;
 }
 
-static int bp_pause( void )
+static int bp_pause( t_player *p )
 {
-	syslog(LOG_DEBUG, "bp_pause");
+	syslog(LOG_DEBUG, "bp_pause %d", p->zone);
 
-	if( gap_id ){
-		gap_finish();
+	if( p->gap_id ){
+		gap_finish(p);
 
 		if( player_func_stop )
 			(*player_func_stop)();
@@ -358,15 +712,15 @@ static int bp_pause( void )
 		return 0;
 	}
 
-	if( GST_STATE(p_pipe) != GST_STATE_PLAYING )
+	if( GST_STATE(p->p_pipe) != GST_STATE_PLAYING )
 		return -1;
 
 
-	if( gst_element_set_state( p_pipe, GST_STATE_PAUSED )
+	if( gst_element_set_state( p->p_pipe, GST_STATE_PAUSED )
 		== GST_STATE_CHANGE_FAILURE ){
 
 		syslog(LOG_ERR, "play_gst: failed to finish");
-		bp_finish(0);
+		bp_finish(p, 0);
 		if( player_func_stop )
 			(*player_func_stop)();
 		return -1;
@@ -375,32 +729,40 @@ static int bp_pause( void )
 	if( player_func_pause )
 		(*player_func_pause)();
 
-	elapsed_del();
+	elapsed_del(p);
 
 	return 0;
 }
 
 static gint cb_gap_timeout( gpointer data )
 {
-	(void)data;
+	t_player *p = (t_player*)data;
+	int zone;
+
+	zone = zone_enter( p );
+	p->gap_id = 0;
+	bp_start(p);
+	zone_cur = zone;
 
-	gap_id = 0;
-	bp_start();
 	return FALSE;
 }
 
 static gboolean cb_bus( GstBus *bus, GstMessage *msg, gpointer data)
 {
-	GMainLoop *loop = (GMainLoop *) data;
+	t_player *p = (t_player*)data;
+	t_track *curtrack = p->curtrack;
+	int zone;
 	(void)bus;
 
+	zone = zone_enter( p );
+
 	switch (GST_MESSAGE_TYPE (msg)) {
 
 	  case GST_MESSAGE_EOS: {
 		gint64 pos;
 		GstFormat fmt = GST_FORMAT_TIME;
 
-		if( ! gst_element_query_position( p_pipe, &fmt, &pos))
+		if( ! gst_element_query_position( p->p_pipe, &fmt, &pos))
 			pos = 0;
 
 		if( curtrack && pos + 1000000000 < (gint64)curtrack->seg_to ){
@@ -410,13 +772,14 @@ static gboolean cb_bus( GstBus *bus, GstMessage *msg, gpointer data)
 					(int)( curtrack->seg_to / GST_SECOND) );
 		}
 
-		bp_finish(1);
+		bp_finish(p, 1);
 
-		if( gap ){
+		if( p->gap ){
 			syslog(LOG_DEBUG, "play_gst: gap started");
-			gap_id = g_timeout_add(1000 * gap, cb_gap_timeout, loop );
+			p->gap_id = g_timeout_add(1000 * p->gap,
+					cb_gap_timeout, p );
 		} else {
-			bp_start();
+			bp_start(p);
 		}
 
 		break;
@@ -453,7 +816,7 @@ static gboolean cb_bus( GstBus *bus, GstMessage *msg, gpointer data)
 					curtrack->id, curtrack->album->id,
 					curtrack->albumnr );
 
-		bp_finish(0);
+		bp_finish(p, 0);
 
 		//TODO: stop on read/decode, otherwise pause
 		if( player_func_stop )
@@ -474,6 +837,7 @@ static gboolean cb_bus( GstBus *bus, GstMessage *msg, gpointer data)
 		break;
 	}
 
+	zone_cur = zone;
 	return TRUE;
 }
 
@@ -487,13 +851,14 @@ static gboolean cb_bus( GstBus *bus, GstMessage *msg, gpointer data)
  */
 t_track *player_track( void )
 {
-	if( ! curtrack )
+	t_player *p = PLAYER;
+
+	if( ! p->curtrack )
 		return NULL;
 
 	// TODO: player_track doesn't tell, who picked this track. This is
 	// hidden, till the track is added to the history
-	track_use(curtrack);
-	return curtrack;
+	return track_use(p->curtrack);
 }
 
 /*
@@ -501,65 +866,66 @@ t_track *player_track( void )
  */
 t_playstatus player_status( void )
 {
-	return bp_status();
+	return bp_status(PLAYER);
 }
 
 int player_gap( void )
 {
-	return gap;
+	return PLAYER->gap;
 }
 
 t_playerror player_setgap( int g )
 {
-	gap = g;
+	PLAYER->gap = g;
 	return PE_OK;
 }
 
 int player_cut( void )
 {
-	return cut;
+	return PLAYER->cut;
 }
 
 t_playerror player_setcut( int g )
 {
-	cut = g;
+	PLAYER->cut = g;
 	return PE_OK;
 }
 
 double player_rgpreamp( void )
 {
-	return rgpreamp;
+	return PLAYER->rgpreamp;
 }
 
 t_playerror player_setrgpreamp( double g )
 {
-	rgpreamp = g;
-	return bp_volume() ? PE_OK : PE_FAIL;
+	PLAYER->rgpreamp = g;
+	return bp_volume(PLAYER) ? PE_OK : PE_FAIL;
 }
 
 t_replaygain player_rgtype( void )
 {
-	return rgtype;
+	return PLAYER->rgtype;
 }
 
 t_playerror player_setrgtype( t_replaygain g )
 {
-	rgtype = g;
-	return bp_volume() ? PE_OK : PE_FAIL;
+	PLAYER->rgtype = g;
+	return bp_volume(PLAYER) ? PE_OK : PE_FAIL;
 }
 
 int player_random( void )
 {
-	return do_random;
+	return PLAYER->do_random;
 }
 
 t_playerror player_setrandom( int r )
 {
-	int old = do_random;
+	t_player *p = PLAYER;
+	int old = p->do_random;
 
-	do_random = r ? 1 : 0;
+	p->do_random = r ? 1 : 0;
 
-	if( old != do_random && player_func_random )
+	if( old != p->do_random && player_func_random )
 		(*player_func_random)();
 
 	return PE_OK;
@@ -567,24 +933,41 @@ t_playerror player_setrandom( int r )
 
 int player_elapsed( void )
 {
+	t_player *p = PLAYER;
 	gint64 pos;
 	GstFormat fmt = GST_FORMAT_TIME;
 
-	if( pl_stop == bp_status() )
+	if( pl_stop == bp_status(p) )
 		return 0;
 
-	if( ! gst_element_query_position( p_pipe, &fmt, &pos))
+	if( ! gst_element_query_position( p->p_pipe, &fmt, &pos))
 		return 0;
 
 	return pos / GST_SECOND;
 }
 
+void player_bufstat( t_bufstat *s )
+{
+	t_player *p = PLAYER;
+	guint level = 0;
+
+	s->size = p->p_buf ? opt_readahead * 1024 : 0;
+	s->underruns = g_atomic_int_get( &p->buf_underruns );
+
+	if( p->p_buf && pl_stop != bp_status(p) )
+		g_object_get( G_OBJECT(p->p_buf), "current-level-bytes",
+				&level, NULL );
+	s->level = level;
+}
+
 t_playerror player_jump( int to_sec )
 {
-	if( pl_stop == bp_status() )
+	t_player *p = PLAYER;
+
+	if( pl_stop == bp_status(p) )
 		return PE_NOTHING;
 
-	if( ! bp_seek( to_sec * GST_SECOND ) )
+	if( ! bp_seek( p, to_sec * GST_SECOND ) )
 		return PE_FAIL;
 
 	return PE_OK;
@@ -608,7 +991,9 @@ t_playerror player_jump( int to_sec )
 
 t_playerror player_pause( void )
 {
-	t_playstatus mode = bp_status();
+	t_player *p = PLAYER;
+	t_playstatus mode = bp_status(p);
+
 	if( mode == pl_pause ){
 		return PE_NOTHING;
 
@@ -616,7 +1001,7 @@ t_playerror player_pause( void )
 		return PE_FAIL;
 	}
 
-	if( -1 == bp_pause() )
+	if( -1 == bp_pause(p) )
 		return PE_FAIL;
 	return PE_OK;
 }
@@ -624,16 +1009,17 @@ t_playerror player_pause( void )
 /* unpause or start playing */
 t_playerror player_start( void )
 {
-	t_playstatus mode = bp_status();
+	t_player *p = PLAYER;
+	t_playstatus mode = bp_status(p);
 
 	if( mode == pl_play ){
 		return PE_NOTHING;
 
 	} else if( mode == pl_pause ){
-		if( -1 == bp_resume())
+		if( -1 == bp_resume(p))
 			return PE_FAIL;
 
-	} else if( -1 == bp_start()){
+	} else if( -1 == bp_start(p)){
 		return PE_FAIL;
 
 	}
@@ -643,9 +1029,11 @@ t_playerror player_start( void )
 
 t_playerror player_next( void )
 {
+	t_player *p = PLAYER;
+
 	/* TODO: first get next track, then stop current and start next */
-	bp_finish(1);
-	if( -1 == bp_start() )
+	bp_finish(p, 1);
+	if( -1 == bp_start(p) )
 		return PE_FAIL;
 
 	return PE_OK;
@@ -660,12 +1048,13 @@ t_playerror player_prev( void )
 
 t_playerror player_stop( void )
 {
-	t_playstatus mode = bp_status();
+	t_player *p = PLAYER;
+	t_playstatus mode = bp_status(p);
 
 	if( mode == pl_stop )
 		return PE_NOTHING;
 
-	bp_finish(1);
+	bp_finish(p, 1);
 	if( player_func_stop )
 		(*player_func_stop)();
 
@@ -682,23 +1071,58 @@ GOptionGroup *player_options( void )
 	return gst_init_get_option_group();
 }
 
+/*
+ * setup the player of zone_cur
+ */
 void player_init( GMainLoop *loop )
 {
+	t_player *p = PLAYER;
+	t_optzone *oz = &opt_zone[zone_cur];
 	GstBus *bus = NULL;
-	GstElement *p_dec = NULL;
 	GstElement *p_scale = NULL;
 	GstElement *p_conv = NULL;
 	GstElement *p_out = NULL;
+	GstElement *p_tee = NULL;
+	GstElement *p_outq = NULL;
+	GstElement *p_stream = NULL;
 	GError *err = NULL;
 
+	(void)loop;
+
+	memset( p, 0, sizeof(t_player) );
+	p->zone = zone_cur;
+	p->do_random = 1;
+
 	/* TODO: autoplug input to support non-mp3 */
 
-	if( NULL == (p_src = gst_element_factory_make ("filesrc", "p_src"))){
+	if( NULL == (p->p_src = gst_element_factory_make ("filesrc", "p_src"))){
 		syslog(LOG_ERR,"player: cannot create src object");
 		exit(1);
 	}
 
-	if( NULL == (p_dec = gst_element_factory_make ("mad", "p_dec"))){
+	/* read-ahead to bridge stalls of (network) storage */
+	if( opt_readahead > 0 ){
+		if( NULL == (p->p_buf = gst_element_factory_make ("queue", "p_buf"))){
+			syslog(LOG_ERR,"player: cannot create buffer object");
+			exit(1);
+		}
+
+		g_object_set( G_OBJECT(p->p_buf),
+			"max-size-bytes", (guint)opt_readahead * 1024,
+			"max-size-buffers", (guint)0,
+			"max-size-time", (guint64)0,
+			NULL );
+		g_signal_connect( p->p_buf, "underrun",
+				G_CALLBACK(cb_buf_underrun), p );
+		g_signal_connect( p->p_buf, "running",
+				G_CALLBACK(cb_buf_running), p );
+
+		/* fewer, larger reads */
+		g_object_set( G_OBJECT(p->p_src), "blocksize",
+				(gulong)READAHEAD_BLOCK, NULL );
+	}
+
+	if( NULL == (p->p_dec = gst_element_factory_make ("mad", "p_dec"))){
 		syslog(LOG_ERR,"player: cannot create decode object");
 		exit(1);
 	}
@@ -713,15 +1137,15 @@ void player_init( GMainLoop *loop )
 		exit(1);
 	}
 
-	if( NULL == (p_vol = gst_element_factory_make ("volume", "p_vol"))){
+	if( NULL == (p->p_vol = gst_element_factory_make ("volume", "p_vol"))){
 		syslog(LOG_ERR,"player: cannot create volume object");
 		exit(1);
 	}
 
-	syslog(LOG_DEBUG,"player: constructing output pipeline: %s",
-		opt_pipeline );
+	syslog(LOG_DEBUG,"player: constructing output pipeline for %s: %s",
+		oz->name, oz->pipeline );
 	if( NULL == (p_out = gst_parse_bin_from_description(
-		opt_pipeline, TRUE, &err ))){
+		oz->pipeline, TRUE, &err ))){
 
 		syslog(LOG_ERR,"player: cannot create output pipeline: %s",
 			err->message );
@@ -729,33 +1153,88 @@ void player_init( GMainLoop *loop )
 		exit(1);
 	}
 
-	if( NULL == (p_pipe = gst_pipeline_new("p_pipe"))){
+	/* tee output to the stream server - there is just one */
+	if( zone_cur == 0 && opt_stream_port > 0
+		&& NULL != (p_stream = stream_branch())){
+		if( NULL == (p_tee = gst_element_factory_make ("tee", "p_tee"))){
+			syslog(LOG_ERR,"player: cannot create tee object");
+			exit(1);
+		}
+
+		if( NULL == (p_outq = gst_element_factory_make ("queue", "p_outq"))){
+			syslog(LOG_ERR,"player: cannot create output queue");
+			exit(1);
+		}
+	}
+
+	if( NULL == (p->p_pipe = gst_pipeline_new("p_pipe"))){
 		syslog(LOG_ERR,"player: cannot create pipe object");
 		exit(1);
 	}
 
-	bus = gst_pipeline_get_bus (GST_PIPELINE (p_pipe));
-	gst_bus_add_watch (bus, cb_bus, loop);
+	bus = gst_pipeline_get_bus (GST_PIPELINE (p->p_pipe));
+	gst_bus_add_watch (bus, cb_bus, p);
 	gst_object_unref (bus);
 
-	gst_bin_add_many( GST_BIN(p_pipe),
-		p_src, p_dec, p_scale, p_conv, p_vol, p_out, NULL);
+	gst_bin_add_many( GST_BIN(p->p_pipe),
+		p->p_src, p->p_dec, p_scale, p_conv, p->p_vol, p_out, NULL);
+
+	if( p->p_buf ){
+		gst_bin_add( GST_BIN(p->p_pipe), p->p_buf );
+
+		if( !gst_element_link_many( p->p_src, p->p_buf, p->p_dec, NULL ) )
+			syslog( LOG_ERR, "player: failed to link read-ahead" );
+
+	} else if( !gst_element_link( p->p_src, p->p_dec ) )
+		syslog( LOG_ERR, "player: failed to link source" );
 
-	if( !gst_element_link_many(
-		p_src, p_dec, p_scale, p_conv, p_vol, p_out, NULL) )
+	if( p_stream ){
+		gst_bin_add_many( GST_BIN(p->p_pipe),
+			p_tee, p_outq, p_stream, NULL );
+
+		if( !gst_element_link_many(
+			p->p_dec, p_scale, p_conv, p->p_vol, p_tee, NULL)
+			|| !gst_element_link_many( p_tee, p_outq, p_out, NULL )
+			|| !gst_element_link( p_tee, p_stream ) )
+
+			syslog( LOG_ERR, "player: failed to link pipeline 1" );
+
+	} else if( !gst_element_link_many(
+		p->p_dec, p_scale, p_conv, p->p_vol, p_out, NULL) )
 
 		syslog( LOG_ERR, "player: failed to link pipeline 1" );
 
+	if( opt_rtprio > 0 ){
+		GstPad *pad;
+
+		rt_policy = 0 == strcmp( opt_rtpolicy, "rr" )
+			? SCHED_RR : SCHED_FIFO;
+
+		pad = gst_element_get_static_pad( p->p_dec, "sink" );
+		gst_pad_add_buffer_probe( pad, G_CALLBACK(cb_rt_probe), p );
+		gst_object_unref( pad );
+	}
+
 
-	if( gst_element_set_state (p_pipe, GST_STATE_READY)
+	if( gst_element_set_state (p->p_pipe, GST_STATE_READY)
 		== GST_STATE_CHANGE_FAILURE )
 
 		syslog( LOG_ERR, "play_gst: failed to init pipeline" );
+
+	/* sinks are adjusted by bp_start() */
+	p->p_out = p_out;
 }
 
 void player_done( void )
 {
+	t_player *p = PLAYER;
+
 	player_stop();
-	gst_element_set_state( p_pipe, GST_STATE_NULL);
-	gst_object_unref( GST_OBJECT( p_pipe));
+	gst_element_set_state( p->p_pipe, GST_STATE_NULL);
+	if( p->p_index ){
+		gst_element_set_index( p->p_dec, NULL );
+		gst_object_unref( p->p_index );
+		p->p_index = NULL;
+	}
+	gst_object_unref( GST_OBJECT( p->p_pipe));
 }
@@ -28,6 +28,13 @@ typedef enum {
 	PE_FAIL,
 } t_playerror;
 
+/* read-ahead buffer */
+typedef struct {
+	int level;	/* bytes buffered */
+	int size;	/* max. bytes, 0: disabled */
+	int underruns;	/* stalls since startup */
+} t_bufstat;
+
 typedef void (*t_player_func_update)( void );
 typedef void (*t_player_func_elapsed)( guint64 );
 
@@ -53,6 +60,7 @@ int player_random( void );
 t_playerror player_setrandom( int random );
 int player_elapsed( void ); /* TODO: nanosec */
 t_playerror player_jump( int to_sec ); /* TODO: nanosec */
+void player_bufstat( t_bufstat *s );
 
 t_playerror player_start( void );
 t_playerror player_stop( void );
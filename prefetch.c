@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <glib.h>
+
+#include <config.h>
+#include "opt.h"
+#include "commondb/zone.h"
+#include "prefetch.h"
+#include "seekindex.h"
+
+/************************************************************
+ * prefetch
+ *
+ * reads files of upcoming tracks in the background to get them into
+ * the page cache - and to spin up the disk or warm the NFS cache
+ * before they're played. Files are read until opt_prefetch KB are
+ * used up. The seek index is built for each file on the way.
+ *
+ * Each zone has one pending job. A newer job of the same zone replaces
+ * it, jobs of different zones are served in turn.
+ */
+
+#define PREFETCH_BLOCK	65536
+
+/* remember this many recently prefetched files to skip them */
+#define PREFETCH_MEMO	16
+
+static GMutex *plock = NULL;
+static GCond *pcond = NULL;
+static GThread *pthread = NULL;
+static int pstop = 0;
+/* pending jobs: NULL terminated list of paths. protected by plock */
+static char **pjob[ZONE_MAX];
+/* zone of the job in progress. protected by plock */
+static int pcur = 0;
+
+/* only used by prefetch thread */
+static char *pmemo[PREFETCH_MEMO];
+static int pmemo_next = 0;
+
+static void prefetch_jobfree( char **job )
+{
+	char **p;
+
+	if( ! job )
+		return;
+
+	for( p = job; *p; ++p )
+		free( *p );
+	free( job );
+}
+
+static int prefetch_seen( const char *path )
+{
+	int i;
+
+	for( i = 0; i < PREFETCH_MEMO; ++i )
+		if( pmemo[i] && 0 == strcmp( pmemo[i], path ))
+			return 1;
+
+	return 0;
+}
+
+static void prefetch_remember( const char *path )
+{
+	free( pmemo[pmemo_next] );
+	pmemo[pmemo_next] = strdup( path );
+	pmemo_next = (pmemo_next + 1) % PREFETCH_MEMO;
+}
+
+/* a newer job of the same zone is waiting or we're asked to stop */
+static int prefetch_abort( void )
+{
+	int r;
+
+	g_mutex_lock(plock);
+	r = pstop || pjob[pcur];
+	g_mutex_unlock(plock);
+
+	return r;
+}
+
+/* next pending job after the current zone's, NULL if there is none */
+static char **prefetch_nextjob( void )
+{
+	char **job;
+	int i;
+	int z;
+
+	for( i = 1; i <= ZONE_MAX; ++i ){
+		z = (pcur + i) % ZONE_MAX;
+		if( NULL == (job = pjob[z]) )
+			continue;
+
+		pjob[z] = NULL;
+		pcur = z;
+		return job;
+	}
+
+	return NULL;
+}
+
+/* returns number of bytes read */
+static off_t prefetch_file( const char *path, off_t budget )
+{
+	char buf[PREFETCH_BLOCK];
+	struct stat st;
+	off_t done = 0;
+	ssize_t len;
+	int fd;
+
+	if( 0 > (fd = open( path, O_RDONLY ))){
+		syslog( LOG_DEBUG, "prefetch: %s: %m", path );
+		return 0;
+	}
+
+	if( fstat( fd, &st ) ){
+		close( fd );
+		return 0;
+	}
+
+	if( st.st_size < budget )
+		budget = st.st_size;
+
+	/* let the kernel start on it and read it ourselves - the advice
+	 * is ignored by some network filesystems */
+	posix_fadvise( fd, 0, budget, POSIX_FADV_SEQUENTIAL );
+	posix_fadvise( fd, 0, budget, POSIX_FADV_WILLNEED );
+
+	while( done < budget && ! prefetch_abort() ){
+		if( 0 >= (len = read( fd, buf, PREFETCH_BLOCK )))
+			break;
+		done += len;
+	}
+
+	close( fd );
+	syslog( LOG_DEBUG, "prefetch: %s: %d KB", path, (int)(done / 1024));
+	return done;
+}
+
+static gpointer prefetch_worker( gpointer data )
+{
+	char **job;
+	char **p;
+	off_t budget;
+
+	(void)data;
+
+	g_mutex_lock(plock);
+	while( ! pstop ){
+		if( NULL == (job = prefetch_nextjob()) ){
+			g_cond_wait( pcond, plock );
+			continue;
+		}
+		g_mutex_unlock(plock);
+
+		budget = (off_t)opt_prefetch * 1024;
+		for( p = job; *p && budget > 0 && ! prefetch_abort(); ++p ){
+			if( prefetch_seen( *p ) )
+				continue;
+
+			budget -= prefetch_file( *p, budget );
+			if( prefetch_abort() )
+				break;
+
+			/* cheap, while the file is cached */
+			seekindex_build( *p );
+			prefetch_remember( *p );
+		}
+		prefetch_jobfree( job );
+
+		g_mutex_lock(plock);
+	}
+	g_mutex_unlock(plock);
+
+	return NULL;
+}
+
+void prefetch_files( int zone, char **paths, int num )
+{
+	char **job;
+	int i;
+
+	if( ! pthread || num < 1 || zone < 0 || zone >= ZONE_MAX )
+		return;
+
+	if( NULL == (job = malloc( (num + 1) * sizeof(char*))))
+		return;
+
+	for( i = 0; i < num; ++i ){
+		if( NULL == (job[i] = strdup( paths[i] ))){
+			job[i] = NULL;
+			prefetch_jobfree( job );
+			return;
+		}
+	}
+	job[num] = NULL;
+
+	g_mutex_lock(plock);
+	prefetch_jobfree( pjob[zone] );
+	pjob[zone] = job;
+	g_cond_signal(pcond);
+	g_mutex_unlock(plock);
+}
+
+int prefetch_init( void )
+{
+	GError *err = NULL;
+
+	if( opt_prefetch <= 0 )
+		return 0;
+
+	plock = g_mutex_new();
+	pcond = g_cond_new();
+	pstop = 0;
+
+	if( NULL == (pthread = g_thread_create( prefetch_worker, NULL,
+			TRUE, &err ))){
+
+		syslog( LOG_ERR, "cannot start prefetch: %s", err->message );
+		g_error_free(err);
+		g_cond_free(pcond);
+		g_mutex_free(plock);
+		return -1;
+	}
+
+	return 0;
+}
+
+void prefetch_done( void )
+{
+	int i;
+
+	if( ! pthread )
+		return;
+
+	g_mutex_lock(plock);
+	pstop++;
+	g_cond_signal(pcond);
+	g_mutex_unlock(plock);
+
+	g_thread_join(pthread);
+	pthread = NULL;
+
+	for( i = 0; i < ZONE_MAX; ++i ){
+		prefetch_jobfree( pjob[i] );
+		pjob[i] = NULL;
+	}
+
+	for( i = 0; i < PREFETCH_MEMO; ++i ){
+		free( pmemo[i] );
+		pmemo[i] = NULL;
+	}
+
+	g_cond_free(pcond);
+	g_mutex_free(plock);
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+int prefetch_init( void );
+void prefetch_done( void );
+
+/* replace pending prefetches of zone by these files. Most urgent first */
+void prefetch_files( int zone, char **paths, int num );
+
+#endif
@@ -49,6 +49,8 @@
 #include <ctype.h>
 
 #include <config.h>
+#include "opt.h"
+#include "budget.h"
 #include "player.h"
 #include "sleep.h"
 #include "proto.h"
@@ -66,53 +68,66 @@
 /*
  * minor version: increased on non-intrusive protocl additions
  */
-#define PROTO_MINOR_VERSION 2
+#define PROTO_MINOR_VERSION 7
 
-static t_cmd *cmd_find( t_protstate context, char *name )
+/*
+ * lines to process in a row before giving the main loop a chance
+ */
+#define PROTO_BATCH	8
+
+/*
+ * log commands taking more CPU time (msec)
+ */
+#define PROTO_SLOW	100
+
+/* FNV-1a - has to match cmdhash in mkproto.pl */
+static unsigned int proto_hash( const char *name, int len, unsigned int seed )
 {
-	t_cmd *cmd;
+	unsigned int h = 2166136261U ^ seed;
 
-	for( cmd = proto_cmds; cmd && cmd->name; cmd++ ){
-		if( cmd->context != context && cmd->context != p_any )
-			continue;
-		if( 0 == strcmp(cmd->name, name))
-			return cmd;
-	}
+	while( len-- > 0 )
+		h = (h ^ (unsigned char)*name++) * 16777619U;
 
-	return NULL;
+	return h;
 }
 
-
-static void cmd_arg_free( t_cmd *cmd, void **argv )
+/* perfect hash lookup, see mkproto.pl */
+static t_cmd *cmd_find( t_protstate context, const char *name, int len )
 {
-	void **ndat;
-	t_cmd_arg *narg;
+	t_cmd *cmd;
+	int disp;
+	int i;
 
-	for( ndat = argv, narg = cmd->args; *ndat; ndat++, narg++ ){
-		//assert(narg);
+	disp = proto_cmddisp[ proto_hash( name, len, 0 ) % PROTO_HASHBUCKETS ];
+	i = proto_cmdslot[ proto_hash( name, len, disp ) % PROTO_HASHSIZE ];
+	if( i < 0 )
+		return NULL;
 
-		if( narg->free )
-			(*narg->free)(*ndat);
-	}
-	free(argv);
+	cmd = &proto_cmds[i];
+	if( strncmp( cmd->name, name, len ) || cmd->name[len] )
+		return NULL;
+
+	if( cmd->context != context && cmd->context != p_any )
+		return NULL;
+
+	return cmd;
 }
 
+/*
+ * arguments are parsed in place: strings are terminated within line
+ */
 static int cmd_parse( t_client *client, t_cmd *cmd, char *line )
 {
+	void *argv[PROTO_MAXARGS +1];
+	t_argstore store[PROTO_MAXARGS];
 	char *next = line;
 	char *end;
 	t_cmd_arg *arg;
 	int argc = 0;
-	void **argv = NULL;
 	int missing = 0;
 
-	if( NULL == (argv = malloc(sizeof(void*))))
-		return -1;
-	argv[0] = NULL;
-
 	for( arg = cmd->args; arg && arg->name; arg++ ){
 		void *data;
-		void **tmp;
 
 		SKIPSPACE(next);
 		if( *next == 0 ){
@@ -120,67 +135,81 @@ static int cmd_parse( t_client *client, t_cmd *cmd, char *line )
 			continue;
 		}
 
-		data = (*arg->parse)( next, &end );
+		data = (*arg->parse)( next, &end, &store[argc] );
 		if( end == next || ( *end && !isspace(*end) )){
 			proto_rlast( client, "501",
 					"invalid data for argument %s",
 					arg->name );
-			goto clean1;
+			return -1;
 		}
-		next = end;
 
-		if( NULL == (tmp = realloc(argv, (argc +2) * sizeof(void*)))){
-			proto_rlast( client, "501", "internal error" );
-			goto clean1;
-		}
-
-		argv = tmp;
-		argv[argc++] = (void*)data;
-		argv[argc] = NULL;
+		next = end;
+		if( *next )
+			*next++ = 0;
 
+		argv[argc++] = data;
 	}
+	argv[argc] = NULL;
 
 
 	if( *next != 0 ){
 		proto_rlast( client, "501", "too many arguments" );
-		goto clean1;
+		return -1;
 	}
 
 	if( missing ){
 		proto_rlast( client, "501", "missing arguments" );
-		goto clean1;
+		return -1;
 	}
 
 	(*cmd->run)( client, cmd->code, argv );
 
-	cmd_arg_free(cmd, argv);
 	return 0;
+}
 
-clean1:
-	cmd_arg_free(cmd, argv);
-	return -1;
+/*
+ * msec to wait before running cmd, -1: reject it
+ */
+static int proto_budget( t_client *client, t_cmd *cmd )
+{
+	if( ! cmd->heavy )
+		return 0;
+
+	if( budget_overload() )
+		return -1;
 
+	return bucket_wait( &client->brow, 1 );
 }
 
-static void proto_line( t_client *client, char *line )
+/*
+ * returns 1 when the line has to be retried later
+ */
+static int proto_line( t_client *client, char *line )
 {
 	char *end;
-	char *scmd=NULL;
 	t_cmd *cmd;
 	t_rights perm;
+	double cpu;
+	int wait;
+
+	if( 0 < (wait = bucket_wait( &client->bcmd, 1 ))){
+		client_defer( client, wait );
+		return 1;
+	}
 
 	SKIPSPACE(line);
-	scmd = val_name( line, &end );
-	if( line == end || ! scmd ){
+	for( end = line; isalnum(*end); ++end )
+		;
+	if( line == end || ( *end && ! isspace(*end) )){
 		proto_rlast( client, "501", "invalid command");
 		goto clean1;
 	}
-	line = end;
 
-	if( NULL == (cmd = cmd_find( client->pstate, scmd ))){
+	if( NULL == (cmd = cmd_find( client->pstate, line, end - line ))){
 		proto_rlast( client, "501", "no such command" );
 		goto clean1;
 	}
+	line = end;
 
 	perm = client->user ? client->user->right : r_any;
 	if( perm < cmd->perm ){
@@ -188,9 +217,33 @@ static void proto_line( t_client *client, char *line )
 		goto clean1;
 	}
 
+	if( 0 > (wait = proto_budget( client, cmd ))){
+		proto_rlast( client, "520", "server overloaded, try again later" );
+		goto clean1;
+
+	} else if( wait ){
+		client_defer( client, wait );
+		return 1;
+	}
+
+	bucket_charge( &client->bcmd, 1 );
+
+	/* player, queue and filter commands act on the client's zone */
+	zone_cur = client->zone;
+	cpu = budget_cputime();
 	cmd_parse( client, cmd, line );
+	cpu = budget_cputime() - cpu;
+
+	client->cpu += cpu;
+	budget_cpu( cpu );
+	if( cpu > PROTO_SLOW )
+		syslog( LOG_NOTICE, "con #%d: %s took %.0fms", client->id,
+				cmd->name, cpu );
+	return 0;
+
 clean1:
-	free(scmd);
+	bucket_charge( &client->bcmd, 1 );
+	return 0;
 }
 
 /*
@@ -199,11 +252,20 @@ clean1:
 static void proto_input( t_client *client )
 {
 	char *line;
+	int num;
 
-	while( NULL != (line = client_getline( client) )){
-		proto_line( client, line );
-		free(line);
+	for( num = 0; num < PROTO_BATCH; ++num ){
+		if( NULL == (line = client_getline( client) ))
+			return;
+
+		if( proto_line( client, line )){
+			client_ungetline( client );
+			return;
+		}
 	}
+
+	/* there might be more - let the player run first */
+	client_defer( client, 0 );
 }
 
 /*
@@ -212,6 +274,8 @@ static void proto_input( t_client *client )
 static void proto_newclient( t_client *client )
 {
 	client->ifunc = (void*)proto_input;
+	bucket_init( &client->bcmd, opt_client_cmdrate, opt_client_cmdburst );
+	bucket_init( &client->brow, opt_client_rowrate, opt_client_rowburst );
 	proto_rlast( client, "220", "dudld %d %d",
 			PROTO_MAJOR_VERSION, PROTO_MINOR_VERSION );
 	syslog( LOG_DEBUG, "con #%d: new connection from %s", client->id,
@@ -247,6 +311,7 @@ void proto_init( void )
 	random_func_filter = proto_bcast_filter;
 
 	queue_func_add = proto_bcast_queue_add;
+	queue_func_addlist = proto_bcast_queue_addlist;
 	queue_func_del = proto_bcast_queue_del;
 	queue_func_clear = proto_bcast_queue_clear;
 	queue_func_fetch = proto_bcast_queue_fetch;
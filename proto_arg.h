@@ -19,40 +19,43 @@
  * - pre'define'd struct members for argument lists
  */
 
-#define arg_end { NULL, NULL, NULL }
+#define arg_end { NULL, NULL }
 
 typedef int t_arg_bool;
-#define arg_bool { "bool", APARSE(val_int), NULL }
+#define arg_bool { "bool", APARSE(val_int) }
 
 // TODO: dedicated filter parser
 typedef char * t_arg_filter;
-#define arg_filter { "filter", APARSE(val_string), AFREE(free) }
+#define arg_filter { "filter", APARSE(val_string) }
 
 typedef int t_arg_id;
-#define arg_id { "id", APARSE(val_uint), NULL }
+#define arg_id { "id", APARSE(val_uint) }
 
 typedef char * t_arg_name;
-#define arg_name { "name", APARSE(val_name), AFREE(free) }
+#define arg_name { "name", APARSE(val_name) }
 
 typedef unsigned int t_arg_num;
-#define arg_num { "num", APARSE(val_uint), NULL }
+#define arg_num { "num", APARSE(val_uint) }
 
 typedef char * t_arg_pass;
-#define arg_pass { "pass", APARSE(val_string), AFREE(free) }
+#define arg_pass { "pass", APARSE(val_string) }
 
 typedef t_rights t_arg_right;
-#define arg_right { "right", APARSE(val_uint), NULL }
+#define arg_right { "right", APARSE(val_uint) }
 
 typedef t_replaygain t_arg_replaygain;
-#define arg_replaygain { "replaygain", APARSE(val_replaygain), NULL }
+#define arg_replaygain { "replaygain", APARSE(val_replaygain) }
 
 typedef int t_arg_sec;
-#define arg_sec { "sec", APARSE(val_uint), NULL }
+#define arg_sec { "sec", APARSE(val_uint) }
 
 typedef double *t_arg_decibel;
-#define arg_decibel { "decibel", APARSE(val_double), AFREE(free) }
+#define arg_decibel { "decibel", APARSE(val_double) }
 
 typedef char *t_arg_string;
-#define arg_string { "string", APARSE(val_string), AFREE(free) }
+#define arg_string { "string", APARSE(val_string) }
+
+typedef t_idlist *t_arg_idlist;
+#define arg_idlist { "idlist", APARSE(val_idlist) }
 
 #endif
@@ -44,7 +44,7 @@ void proto_bcast_player_newtrack( void )
 		return;
 
 	if( NULL != (buf = mktrack(track))){
-		proto_bcast( r_guest, "640", "%s", buf );
+		proto_zbcast( r_guest, "640", "%s", buf );
 		free(buf);
 	}
 	track_free(track);
@@ -52,32 +52,32 @@ void proto_bcast_player_newtrack( void )
 
 void proto_bcast_player_stop( void )
 {
-	proto_bcast( r_guest, "641", "stopped" );
+	proto_zbcast( r_guest, "641", "stopped" );
 }
 
 void proto_bcast_player_pause( void )
 {
-	proto_bcast( r_guest, "642", "paused" );
+	proto_zbcast( r_guest, "642", "paused" );
 }
 
 void proto_bcast_player_resume( void )
 {
-	proto_bcast( r_guest, "643", "resumed" );
+	proto_zbcast( r_guest, "643", "resumed" );
 }
 
 void proto_bcast_player_random( void )
 {
-	proto_bcast( r_guest, "646", "%d", player_random() );
+	proto_zbcast( r_guest, "646", "%d", player_random() );
 }
 
 void proto_bcast_player_elapsed( guint64 elapsed )
 {
-	proto_bcast( r_guest, "647", "%d", elapsed / 1000000000 );
+	proto_zbcast( r_guest, "647", "%d", elapsed / 1000000000 );
 }
 
 void proto_bcast_sleep( void )
 {
-	proto_bcast( r_guest, "651", "%d", sleep_remain());
+	proto_zbcast( r_guest, "651", "%d", sleep_remain());
 }
 
 void proto_bcast_filter( void )
@@ -89,7 +89,7 @@ void proto_bcast_filter( void )
 	if( e )
 		expr_fmt( buf, 1024, e );
 
-	proto_bcast( r_guest, "650", "%s", e ? buf : "" );
+	proto_zbcast( r_guest, "650", "%s", e ? buf : "" );
 }
 
 void proto_bcast_queue_fetch( t_queue *q )
@@ -98,7 +98,7 @@ void proto_bcast_queue_fetch( t_queue *q )
 
 	if( NULL == (buf = mkqueue(q)))
 		return;
-	proto_bcast( r_guest, "660", "%s", buf );
+	proto_zbcast( r_guest, "660", "%s", buf );
 	free(buf);
 }
 
@@ -108,23 +108,28 @@ void proto_bcast_queue_add( t_queue *q )
 
 	if( NULL == (buf = mkqueue(q)))
 		return;
-	proto_bcast( r_guest, "661", "%s", buf );
+	proto_zbcast( r_guest, "661", "%s", buf );
 	free(buf);
 }
 
+void proto_bcast_queue_addlist( int num )
+{
+	proto_zbcast( r_guest, "664", "%d", num );
+}
+
 void proto_bcast_queue_del( t_queue *q )
 {
 	char *buf;
 
 	if( NULL == (buf = mkqueue(q)))
 		return;
-	proto_bcast( r_guest, "662", "%s", buf );
+	proto_zbcast( r_guest, "662", "%s", buf );
 	free(buf);
 }
 
 void proto_bcast_queue_clear( void )
 {
-	proto_bcast( r_guest, "663", "queue cleared" );
+	proto_zbcast( r_guest, "663", "queue cleared" );
 }
 
 void proto_bcast_tag_changed( t_tag *t )
@@ -24,6 +24,7 @@ void proto_bcast_sleep( void );
 void proto_bcast_filter( void );
 void proto_bcast_queue_fetch( t_queue *q );
 void proto_bcast_queue_add( t_queue *q );
+void proto_bcast_queue_addlist( int num );
 void proto_bcast_queue_del( t_queue *q );
 void proto_bcast_queue_clear( void );
 void proto_bcast_tag_changed( t_tag *t );
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <syslog.h>
 
+#include "opt.h"
 #include "sleep.h"
 #include "proto_helper.h"
 #include "proto_cmd.h"
@@ -247,6 +248,55 @@ void cmd_elapsed( t_client *client, char *code, void **argv )
 	proto_rlast(client, code, "%d", player_elapsed());
 }
 
+void cmd_bufstat( t_client *client, char *code, void **argv )
+{
+	t_bufstat s;
+
+	(void)argv;
+	player_bufstat( &s );
+	proto_rlast(client, code, "%d\t%d\t%d", s.level, s.size,
+			s.underruns );
+}
+
+void cmd_zonelist( t_client *client, char *code, void **argv )
+{
+	int i;
+
+	(void)argv;
+	for( i = 0; i < opt_zones; ++i ){
+		if( 0 > proto_rline( client, code, "%d\t%s", i,
+				opt_zone[i].name ))
+			return;
+	}
+	proto_rlast( client, code, "" );
+}
+
+void cmd_zone( t_client *client, char *code, void **argv )
+{
+	(void)argv;
+	proto_rlast( client, code, "%d\t%s", client->zone,
+			opt_zone[client->zone].name );
+}
+
+void cmd_zoneset( t_client *client, char *code, void **argv )
+{
+	t_arg_name	name = (t_arg_name)argv[0];
+	int i;
+
+	for( i = 0; i < opt_zones; ++i ){
+		if( 0 == strcmp( name, opt_zone[i].name ))
+			break;
+	}
+
+	if( i >= opt_zones ){
+		proto_rlast( client, "541", "no such zone" );
+		return;
+	}
+
+	client->zone = zone_cur = i;
+	proto_rlast( client, code, "zone selected" );
+}
+
 void cmd_jump( t_client *client, char *code, void **argv )
 {
 	t_arg_sec	sec = (t_arg_sec)argv[0];
@@ -505,6 +555,7 @@ void cmd_filterset( t_client *client, char *code, void **argv )
 	if( random_setfilter(e)){
 		proto_rlast(client, "511", "failed to apply (correct) filter" );
 	} else {
+		random_sharefilter();
 		proto_rlast(client, code, "filter changed" );
 	}
 	expr_free(e);
@@ -581,10 +632,19 @@ void cmd_queueget( t_client *client, char *code, void **argv )
 
 void cmd_queueadd( t_client *client, char *code, void **argv )
 {
-	t_arg_id	id = (t_arg_id)argv[0];
+	t_arg_idlist	ids = (t_arg_idlist)argv[0];
 	int qid;
 
-	if( -1 == (qid = queue_add(id, client->user->id))){
+	/* a single track is announced with its queue entry */
+	if( ids->num == 1 ){
+		qid = queue_add(ids->id[0], client->user->id);
+
+	} else if( 0 >= queue_addlist( ids->id, ids->num,
+			client->user->id, &qid )){
+		qid = -1;
+	}
+
+	if( qid == -1 ){
 		proto_rlast(client, "561", "failed to add track to queue" );
 		return;
 	}
@@ -592,6 +652,43 @@ void cmd_queueadd( t_client *client, char *code, void **argv )
 	proto_rlast(client, code, "%d", qid );
 }
 
+void cmd_queueaddalbum( t_client *client, char *code, void **argv )
+{
+	t_arg_id	id = (t_arg_id)argv[0];
+	int num;
+
+	if( 0 >= (num = queue_addalbum(id, client->user->id))){
+		proto_rlast(client, "561", "failed to add album to queue" );
+		return;
+	}
+
+	proto_rlast(client, code, "%d", num );
+}
+
+void cmd_queueaddfilter( t_client *client, char *code, void **argv )
+{
+	t_arg_filter	filter = (t_arg_filter)argv[0];
+	expr *e = NULL;
+	char *msg;
+	int pos;
+	int num;
+
+	if( NULL == (e = expr_parse_str( &pos, &msg, filter ))){
+		proto_rlast(client, "511", "error at pos %d in filter: %s", pos, msg );
+		return;
+	}
+
+	num = queue_addfilter(e, client->user->id);
+	expr_free(e);
+
+	if( 0 >= num ){
+		proto_rlast(client, "561", "failed to add tracks to queue" );
+		return;
+	}
+
+	proto_rlast(client, code, "%d", num );
+}
+
 void cmd_queuedel( t_client *client, char *code, void **argv )
 {
 	t_arg_id	id = (t_arg_id)argv[0];
@@ -131,7 +131,8 @@ char *mkclient( t_client *c )
 	if( NULL == (sub = mkuser(c->user)))
 		return NULL;
 
-	tmp = mktab( "dst", c->id, inet_ntoa(c->sin.sin_addr), sub );
+	tmp = mktab( "dstd", c->id, inet_ntoa(c->sin.sin_addr), sub,
+			client_mem(c) );
 	free(sub);
 
 	return tmp;
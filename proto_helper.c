@@ -45,6 +45,8 @@ static int proto_vline( t_client *client, int last, const char *code,
 	if( NULL == ( line = proto_fmtline( last, code, fmt, ap )))
 		return -1;
 
+	bucket_charge( &client->brow, 1 );
+
 	ret = client_send( client, line );
 	free(line);
 
@@ -100,6 +102,23 @@ void proto_bcast( t_rights right, const char *code,
 	va_end(ap);
 }
 
+/*
+ * broadcast to clients that selected the current zone
+ */
+void proto_zbcast( t_rights right, const char *code,
+		const char *fmt, ... )
+{
+	char *line;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if( NULL != (line = proto_fmtline(1, code, fmt, ap))){
+		client_bcast_zone(line, right, zone_cur);
+		free(line);
+	}
+	va_end(ap);
+}
+
 void proto_player_reply( t_client *client, t_playstatus r, char *code, char *reply )
 {
 	switch(r){
@@ -20,18 +20,25 @@
 #include "commondb/queue.h"
 #include "commondb/tag.h"
 #include "commondb/sfilter.h"
+#include "commondb/zone.h"
 
-typedef void *(*t_arg_parse)( char *in, char **end );
-typedef void (*t_arg_free)( void *data );
+/*
+ * scratch space for arguments that don't fit into a pointer. Like
+ * strings pointing into the command line, it's valid until the command
+ * returns.
+ */
+typedef union {
+	double d;
+} t_argstore;
+
+typedef void *(*t_arg_parse)( char *in, char **end, t_argstore *st );
 
 typedef struct _t_cmd_arg {
 	char *name;
 	t_arg_parse parse;
-	t_arg_free free;
 } t_cmd_arg;
 
 #define APARSE(func)	(t_arg_parse)func
-#define AFREE(func)	(t_arg_free)func
 
 typedef void (*t_cmd_run)( t_client *c, char *code, void **argv );
 
@@ -42,6 +49,7 @@ typedef struct _t_cmd {
 	t_protstate context;
 	t_cmd_run run;
 	t_cmd_arg *args;
+	int heavy;
 } t_cmd;
 
 int proto_rline( t_client *client, const char *code,
@@ -51,6 +59,8 @@ int proto_rlast( t_client *client, const char *code,
 
 void proto_bcast( t_rights right, const char *code,
 		const char *fmt, ... );
+void proto_zbcast( t_rights right, const char *code,
+		const char *fmt, ... );
 
 void proto_player_reply( t_client *client, t_playstatus r, char *code, char *reply );
 
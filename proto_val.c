@@ -7,28 +7,30 @@
  *
  */
 
-#define _GNU_SOURCE
-
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
 
 #include "proto_val.h"
 
-int val_int( char *in, char **end )
+int val_int( char *in, char **end, t_argstore *st )
 {
+	(void)st;
 	return strtol(in, end, 10 );
 }
 
-unsigned int val_uint( char *in, char **end )
+unsigned int val_uint( char *in, char **end, t_argstore *st )
 {
+	(void)st;
 	return strtoul(in, end, 10 );
 }
 
-char *val_name( char *in, char **end )
+/* not terminated - the caller does that */
+char *val_name( char *in, char **end, t_argstore *st )
 {
 	char *e = in;
 
+	(void)st;
 	if( end ) *end = in;
 
 	while(isalnum(*e))
@@ -40,27 +42,21 @@ char *val_name( char *in, char **end )
 	if( end )
 		*end = e;
 
-	return strndup(in, e - in);
+	return in;
 }
 
-double *val_double( char *in, char **end )
+double *val_double( char *in, char **end, t_argstore *st )
 {
-	double *r;
-
-	if( end )
-		*end = in;
-
-	if( NULL != (r = malloc(sizeof(double))))
-		*r = strtod(in, end );
-
-	return r;
+	st->d = strtod(in, end );
+	return &st->d;
 }
 
-t_replaygain val_replaygain( char *in, char **end )
+t_replaygain val_replaygain( char *in, char **end, t_argstore *st )
 {
 	char *tend = NULL;
 	unsigned int r = rg_none;
 
+	(void)st;
 	r = strtoul(in, &tend, 10 );
 	if( in != tend ){
 		switch(r){
@@ -84,12 +80,68 @@ t_replaygain val_replaygain( char *in, char **end )
 	return r;
 }
 
-char *val_string( char *in, char **end )
+char *val_string( char *in, char **end, t_argstore *st )
 {
+	(void)st;
 	if( end )
 		*end = in + strlen(in);
 
-	return strdup(in);
+	return in;
+}
+
+/*
+ * list of ids separated by commas and/or whitespace. Takes the rest of
+ * the line. A line can't hold more ids than half its length - the list
+ * is kept in static storage that grows with the longest line seen.
+ */
+static t_idlist *idlist = NULL;
+static int idlist_max = 0;
+
+t_idlist *val_idlist( char *in, char **end, t_argstore *st )
+{
+	t_idlist *l;
+	char *p, *e;
+	int max;
+
+	(void)st;
+	if( end )
+		*end = in;
+
+	max = strlen(in) / 2 + 1;
+	if( max > idlist_max ){
+		if( NULL == (l = realloc( idlist, sizeof(t_idlist)
+				+ max * sizeof(int) )))
+			return NULL;
+		idlist = l;
+		idlist_max = max;
+	}
+
+	l = idlist;
+	l->num = 0;
+
+	p = in;
+	while( *p ){
+		if( ! isdigit(*p) )
+			return NULL;
+
+		l->id[l->num++] = strtoul(p, &e, 10);
+		p = e;
+
+		while( isspace(*p) )
+			p++;
+		if( *p == ',' )
+			p++;
+		while( isspace(*p) )
+			p++;
+	}
+
+	if( ! l->num )
+		return NULL;
+
+	if( end )
+		*end = p;
+
+	return l;
 }
 
 
@@ -12,11 +12,21 @@
 
 #include "proto_helper.h"
 
-int val_int( char *in, char **end );
-unsigned int val_uint( char *in, char **end );
-double *val_double( char *in, char **end );
-t_replaygain val_replaygain( char *in, char **end );
-char *val_name( char *in, char **end );
-char *val_string( char *in, char **end );
+typedef struct {
+	int num;
+	int id[];
+} t_idlist;
+
+/*
+ * argument parsers. Strings and lists point into the parsed line or
+ * static storage - nothing is allocated.
+ */
+int val_int( char *in, char **end, t_argstore *st );
+unsigned int val_uint( char *in, char **end, t_argstore *st );
+double *val_double( char *in, char **end, t_argstore *st );
+t_replaygain val_replaygain( char *in, char **end, t_argstore *st );
+char *val_name( char *in, char **end, t_argstore *st );
+char *val_string( char *in, char **end, t_argstore *st );
+t_idlist *val_idlist( char *in, char **end, t_argstore *st );
 
 #endif
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <config.h>
+#include "opt.h"
+#include "seekindex.h"
+
+/************************************************************
+ * seek index
+ *
+ * mad has to guess the byte offset for a time when seeking - which is
+ * imprecise for VBR files. The index lists the offset of each frame.
+ * It's built once per file (usually by the prefetch thread) and cached
+ * in opt_seekindex/<hash>.idx:
+ *
+ *  t_seekhead, path, num * guint32 offsets
+ *
+ * The cached index is invalidated by changes to the file's size or
+ * mtime.
+ */
+
+#define SEEK_MAGIC	0x31495344	/* "DSI1" */
+
+/* bytes to search for the first frame after a (broken) tag */
+#define SEEK_SYNCMAX	65536
+
+/* initial number of offsets to allocate */
+#define SEEK_ALLOC	16384
+
+typedef struct {
+	guint32 magic;
+	guint32 rate;
+	guint32 spf;
+	guint32 num;
+	guint64 size;
+	gint64 mtime;
+	guint32 pathlen;
+	guint32 pad;
+} t_seekhead;
+
+/* kbit/s by [mpeg1 ? 0 : 1][layer 1..3 -1][index] */
+static const int mpa_bitrate[2][3][16] = {
+	{
+		{ 0,32,64,96,128,160,192,224,256,288,320,352,384,416,448,0 },
+		{ 0,32,48,56,64,80,96,112,128,160,192,224,256,320,384,0 },
+		{ 0,32,40,48,56,64,80,96,112,128,160,192,224,256,320,0 },
+	},
+	{
+		{ 0,32,48,56,64,80,96,112,128,144,160,176,192,224,256,0 },
+		{ 0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0 },
+		{ 0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0 },
+	},
+};
+
+static const int mpa_rate[3] = { 44100, 48000, 32000 };
+
+/*
+ * parse MPEG audio frame header. Returns frame length in bytes, 0 for
+ * an invalid header.
+ */
+static int mpa_frame( const unsigned char *h, int *rate, int *spf )
+{
+	int ver, layer, bri, sri, pad, br;
+
+	if( h[0] != 0xff || (h[1] & 0xe0) != 0xe0 )
+		return 0;
+
+	ver = (h[1] >> 3) & 3;		/* 0: 2.5, 1: reserved, 2: 2, 3: 1 */
+	layer = 4 - ((h[1] >> 1) & 3);	/* 4: reserved */
+	bri = h[2] >> 4;
+	sri = (h[2] >> 2) & 3;
+	pad = (h[2] >> 1) & 1;
+
+	if( ver == 1 || layer == 4 || bri == 0 || bri == 15 || sri == 3 )
+		return 0;
+
+	br = mpa_bitrate[ver == 3 ? 0 : 1][layer-1][bri] * 1000;
+	*rate = mpa_rate[sri] >> (ver == 3 ? 0 : ver == 2 ? 1 : 2);
+
+	if( layer == 1 ){
+		*spf = 384;
+		return (12 * br / *rate + pad) * 4;
+	}
+
+	if( layer == 2 || ver == 3 ){
+		*spf = 1152;
+		return 144 * br / *rate + pad;
+	}
+
+	*spf = 576;
+	return 72 * br / *rate + pad;
+}
+
+/* offset of the audio data after an ID3v2 tag */
+static long mpa_skiptag( FILE *fh )
+{
+	unsigned char h[10];
+
+	if( 10 != fread( h, 1, 10, fh ) || memcmp( h, "ID3", 3 ))
+		return 0;
+
+	return 10 + ( h[5] & 0x10 ? 10 : 0 )
+		+ ( (h[6] & 0x7f) << 21 | (h[7] & 0x7f) << 14
+		  | (h[8] & 0x7f) << 7 | (h[9] & 0x7f) );
+}
+
+/* find first frame that's followed by another one */
+static long mpa_sync( FILE *fh, long off )
+{
+	unsigned char h[4];
+	int rate, spf, rate2, spf2;
+	long end = off + SEEK_SYNCMAX;
+	int len;
+
+	for( ; off < end; ++off ){
+		if( fseek( fh, off, SEEK_SET ) || 4 != fread( h, 1, 4, fh ))
+			return -1;
+
+		if( 0 == (len = mpa_frame( h, &rate, &spf )))
+			continue;
+
+		if( fseek( fh, off + len, SEEK_SET )
+			|| 4 != fread( h, 1, 4, fh ))
+			return -1;
+
+		if( mpa_frame( h, &rate2, &spf2 )
+			&& rate == rate2 && spf == spf2 )
+			return off;
+	}
+
+	return -1;
+}
+
+static int seekindex_fname( char *buf, int len, const char *path )
+{
+	return snprintf( buf, len, "%s/%08x.idx", opt_seekindex,
+			g_str_hash( path ));
+}
+
+/* returns 1, when fname holds the index for path in its current state */
+static int seekindex_check( FILE *fh, const char *path, struct stat *st,
+		t_seekhead *head )
+{
+	char buf[MAXPATHLEN];
+
+	if( 1 != fread( head, sizeof(t_seekhead), 1, fh ))
+		return 0;
+
+	if( head->magic != SEEK_MAGIC
+		|| head->size != (guint64)st->st_size
+		|| head->mtime != (gint64)st->st_mtime
+		|| head->pathlen != strlen(path)
+		|| head->pathlen >= MAXPATHLEN )
+		return 0;
+
+	if( 1 != fread( buf, head->pathlen, 1, fh )
+		|| memcmp( buf, path, head->pathlen ))
+		return 0;
+
+	return 1;
+}
+
+static int seekindex_save( const char *path, struct stat *st,
+		t_seekhead *head, guint32 *off )
+{
+	char fname[MAXPATHLEN];
+	char tmp[MAXPATHLEN];
+	FILE *fh;
+
+	seekindex_fname( fname, MAXPATHLEN, path );
+	snprintf( tmp, MAXPATHLEN, "%s.tmp", fname );
+
+	if( NULL == (fh = fopen( tmp, "w" ))){
+		syslog( LOG_ERR, "seekindex: %s: %m", tmp );
+		return -1;
+	}
+
+	head->magic = SEEK_MAGIC;
+	head->size = st->st_size;
+	head->mtime = st->st_mtime;
+	head->pathlen = strlen(path);
+	head->pad = 0;
+
+	if( 1 != fwrite( head, sizeof(t_seekhead), 1, fh )
+		|| 1 != fwrite( path, head->pathlen, 1, fh )
+		|| head->num != fwrite( off, sizeof(guint32), head->num, fh )){
+
+		syslog( LOG_ERR, "seekindex: %s: %m", tmp );
+		fclose( fh );
+		unlink( tmp );
+		return -1;
+	}
+
+	if( fclose( fh ) || rename( tmp, fname )){
+		syslog( LOG_ERR, "seekindex: %s: %m", fname );
+		unlink( tmp );
+		return -1;
+	}
+
+	return 0;
+}
+
+int seekindex_build( const char *path )
+{
+	char fname[MAXPATHLEN];
+	unsigned char h[4];
+	t_seekhead head;
+	struct stat st;
+	guint32 *off = NULL;
+	guint32 *tmp;
+	int size = 0;
+	int rate, spf;
+	long pos;
+	int len;
+	int r;
+	FILE *fh;
+
+	if( ! opt_seekindex || ! *opt_seekindex )
+		return -1;
+
+	if( stat( path, &st ) )
+		return -1;
+
+	/* cached already? */
+	seekindex_fname( fname, MAXPATHLEN, path );
+	if( NULL != (fh = fopen( fname, "r" ))){
+		r = seekindex_check( fh, path, &st, &head );
+		fclose( fh );
+		if( r )
+			return 0;
+	}
+
+	if( NULL == (fh = fopen( path, "r" )))
+		return -1;
+
+	head.num = head.rate = head.spf = 0;
+	if( 0 > (pos = mpa_sync( fh, mpa_skiptag( fh ))))
+		goto save;
+
+	while( ! fseek( fh, pos, SEEK_SET ) && 4 == fread( h, 1, 4, fh ) ){
+		if( 0 == (len = mpa_frame( h, &rate, &spf )))
+			break;
+
+		/* format must not change */
+		if( head.num == 0 ){
+			head.rate = rate;
+			head.spf = spf;
+
+		} else if( (guint32)rate != head.rate
+				|| (guint32)spf != head.spf )
+			break;
+
+		if( (int)head.num >= size ){
+			size += SEEK_ALLOC;
+			if( NULL == (tmp = realloc( off,
+					size * sizeof(guint32) ))){
+				syslog( LOG_ERR, "seekindex: out of memory" );
+				free( off );
+				fclose( fh );
+				return -1;
+			}
+			off = tmp;
+		}
+
+		off[head.num++] = pos;
+		pos += len;
+	}
+
+save:
+	fclose( fh );
+
+	/* an empty index remembers we failed */
+	syslog( LOG_DEBUG, "seekindex: %s: %d frames", path, head.num );
+	r = seekindex_save( path, &st, &head, off );
+	free( off );
+
+	return r;
+}
+
+t_seekindex *seekindex_load( const char *path )
+{
+	char fname[MAXPATHLEN];
+	t_seekhead head;
+	t_seekindex *si;
+	struct stat st;
+	FILE *fh;
+
+	if( ! opt_seekindex || ! *opt_seekindex )
+		return NULL;
+
+	if( stat( path, &st ) )
+		return NULL;
+
+	seekindex_fname( fname, MAXPATHLEN, path );
+	if( NULL == (fh = fopen( fname, "r" )))
+		return NULL;
+
+	if( ! seekindex_check( fh, path, &st, &head ) || head.num == 0 )
+		goto clean1;
+
+	if( NULL == (si = malloc(sizeof(t_seekindex))))
+		goto clean1;
+
+	if( NULL == (si->off = malloc( head.num * sizeof(guint32))))
+		goto clean2;
+
+	if( head.num != fread( si->off, sizeof(guint32), head.num, fh ))
+		goto clean3;
+
+	fclose( fh );
+
+	si->rate = head.rate;
+	si->spf = head.spf;
+	si->num = head.num;
+	return si;
+
+clean3:
+	free( si->off );
+clean2:
+	free( si );
+clean1:
+	fclose( fh );
+	return NULL;
+}
+
+void seekindex_free( t_seekindex *si )
+{
+	if( ! si )
+		return;
+
+	free( si->off );
+	free( si );
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _SEEKINDEX_H
+#define _SEEKINDEX_H
+
+#include <glib.h>
+
+/*
+ * byte offsets of all MPEG audio frames in a file. Frame i starts at
+ * sample i * spf.
+ */
+typedef struct {
+	int rate;	/* samples per second */
+	int spf;	/* samples per frame */
+	int num;	/* number of frames */
+	guint32 *off;
+} t_seekindex;
+
+/* scan file and save its index - unless it's cached already */
+int seekindex_build( const char *path );
+
+/* get cached index, NULL when there's none (or it's outdated) */
+t_seekindex *seekindex_load( const char *path );
+void seekindex_free( t_seekindex *si );
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+/*
+ * shared pool of buffers in power of 2 sizes. Connections borrow them
+ * while they have something to do and return them when idle.
+ *
+ * Buffers larger than the largest class bypass the pool.
+ */
+
+#include <stdlib.h>
+
+#include <config.h>
+#include "slab.h"
+
+typedef struct _t_slab {
+	struct _t_slab *next;
+} t_slab;
+
+static t_slab *pool[SLAB_CLASSES];
+static int pool_num[SLAB_CLASSES];
+static int used = 0;
+static int pooled = 0;
+
+/* size class for size bytes, SLAB_CLASSES when it's too large */
+static int slab_class( int size )
+{
+	int c;
+	int csize = SLAB_MIN;
+
+	for( c = 0; c < SLAB_CLASSES; ++c, csize <<= 1 )
+		if( size <= csize )
+			return c;
+
+	return SLAB_CLASSES;
+}
+
+void *slab_get( int *size )
+{
+	t_slab *s;
+	int c;
+
+	if( SLAB_CLASSES <= (c = slab_class( *size ))){
+		if( NULL == (s = malloc( *size )))
+			return NULL;
+
+		used += *size;
+		return s;
+	}
+
+	*size = SLAB_MIN << c;
+	if( NULL != (s = pool[c]) ){
+		pool[c] = s->next;
+		--pool_num[c];
+		pooled -= *size;
+
+	} else if( NULL == (s = malloc( *size )))
+		return NULL;
+
+	used += *size;
+	return s;
+}
+
+void slab_put( void *buf, int size )
+{
+	t_slab *s = buf;
+	int c;
+
+	if( ! buf )
+		return;
+
+	used -= size;
+	if( SLAB_CLASSES <= (c = slab_class( size ))
+			|| pool_num[c] >= SLAB_KEEP ){
+		free( buf );
+		return;
+	}
+
+	s->next = pool[c];
+	pool[c] = s;
+	++pool_num[c];
+	pooled += size;
+}
+
+int slab_used( void )
+{
+	return used;
+}
+
+int slab_pooled( void )
+{
+	return pooled;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+/* smallest slab */
+#define SLAB_MIN	256
+/* number of size classes, each doubling the previous one */
+#define SLAB_CLASSES	10
+/* free slabs kept per class */
+#define SLAB_KEEP	32
+
+/* get a buffer of at least *size bytes, *size is set to the actual size */
+void *slab_get( int *size );
+/* return a buffer obtained by slab_get() */
+void slab_put( void *buf, int size );
+
+/* bytes handed out / kept in the pool */
+int slab_used( void );
+int slab_pooled( void );
+
+#endif
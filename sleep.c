@@ -12,22 +12,28 @@
 #include <syslog.h>
 
 #include <config.h>
+#include "commondb/zone.h"
 #include "player.h"
 #include "sleep.h"
 
 t_sleep_func_set sleep_func_set = NULL;
-time_t sleep_at = 0;
-int sleep_id = 0;
+
+/* per zone */
+static time_t sleep_at[ZONE_MAX];
+static int sleep_id[ZONE_MAX];
 
 static gint sleep_event( gpointer data )
 {
-	(void)data;
+	int zone = zone_cur;
 
-	syslog(LOG_DEBUG, "sleep event");
+	zone_cur = GPOINTER_TO_INT(data);
+	syslog(LOG_DEBUG, "sleep event %d", zone_cur);
 	player_pause();
 
-	sleep_id = 0;
-	sleep_at = 0;
+	sleep_id[zone_cur] = 0;
+	sleep_at[zone_cur] = 0;
+
+	zone_cur = zone;
 	return FALSE;
 }
 
@@ -35,33 +41,34 @@ time_t sleep_remain( void )
 {
 	time_t now;
 
-	if( ! sleep_at )
+	if( ! sleep_at[zone_cur] )
 		return 0;
 
 	now = time(NULL);
-	if( sleep_at <= now )
+	if( sleep_at[zone_cur] <= now )
 		return 0;
 
-	return sleep_at - now;
+	return sleep_at[zone_cur] - now;
 }
 
 void sleep_in( time_t sek )
 {
-	time_t old = sleep_at;
+	time_t old = sleep_at[zone_cur];
 
-	if( sleep_id ){
-		syslog(LOG_DEBUG, "sleep remove: %d", sleep_id);
-		g_source_remove(sleep_id);
+	if( sleep_id[zone_cur] ){
+		syslog(LOG_DEBUG, "sleep remove: %d", sleep_id[zone_cur]);
+		g_source_remove(sleep_id[zone_cur]);
 	}
-	sleep_id = 0;
-	sleep_at = 0;
+	sleep_id[zone_cur] = 0;
+	sleep_at[zone_cur] = 0;
 
 	if( sek > 0 ){
-		sleep_id = g_timeout_add(sek * 1000, sleep_event, NULL );
-		sleep_at = time(NULL) + sek;
-		syslog(LOG_DEBUG, "sleep set: in %u - at %u", (unsigned int)sek, (unsigned int)sleep_at );
+		sleep_id[zone_cur] = g_timeout_add(sek * 1000, sleep_event,
+				GINT_TO_POINTER(zone_cur) );
+		sleep_at[zone_cur] = time(NULL) + sek;
+		syslog(LOG_DEBUG, "sleep set: in %u - at %u", (unsigned int)sek, (unsigned int)sleep_at[zone_cur] );
 	}
 
-	if( old != sleep_at && sleep_func_set )
+	if( old != sleep_at[zone_cur] && sleep_func_set )
 		(*sleep_func_set)();
 }
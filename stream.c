@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+/*
+ * HTTP streaming of the encoded output.
+ *
+ * The player encodes once and pushes the data into a ring buffer.
+ * Listeners are served from this ring by a thread of its own - each
+ * one just keeps its position in the stream. A listener that falls
+ * behind more than the ring holds skips ahead. Nothing waits for a
+ * listener.
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+#include <glib.h>
+
+#include <config.h>
+#include "opt.h"
+#include "stream.h"
+
+#define STREAM_BACKLOG	10
+
+/* max size of a HTTP request */
+#define STREAM_REQMAX	2048
+
+/* max size of stream headers */
+#define STREAM_HDRMAX	65536
+
+typedef enum {
+	ls_request,	/* reading request */
+	ls_reply,	/* sending reply + stream headers */
+	ls_stream,
+} t_lstate;
+
+typedef struct {
+	int sock;
+	t_lstate state;
+	char req[STREAM_REQMAX];
+	int reqlen;
+	char *out;
+	int outlen;
+	int outpos;
+	guint64 pos;
+	struct sockaddr_in sin;
+} t_listener;
+
+static GThread *sthread = NULL;
+static int slisten = -1;
+static int swake[2] = { -1, -1 };
+
+/* ring + headers - protected by slock */
+static GMutex *slock = NULL;
+static char *ring = NULL;
+static size_t ringsize = 0;
+static guint64 wpos = 0;
+static char hdr[STREAM_HDRMAX];
+static int hdrlen = 0;
+static int inhdr = 0;
+static int stop = 0;
+static int woken = 0;
+
+/* only used by stream thread */
+static t_listener **listeners = NULL;
+static int nlisteners = 0;
+
+void stream_push( const char *data, int len, int header )
+{
+	size_t off;
+	size_t n;
+	int wake;
+
+	if( ! sthread || len <= 0 )
+		return;
+
+	g_mutex_lock(slock);
+
+	/* a new header after data starts a new set */
+	if( header ){
+		if( ! inhdr )
+			hdrlen = 0;
+		inhdr = 1;
+
+		if( hdrlen + len <= STREAM_HDRMAX ){
+			memcpy( hdr + hdrlen, data, len );
+			hdrlen += len;
+		}
+	} else
+		inhdr = 0;
+
+	/* only keep what fits */
+	if( (size_t)len > ringsize ){
+		wpos += len - ringsize;
+		data += len - ringsize;
+		len = ringsize;
+	}
+
+	while( len > 0 ){
+		off = wpos % ringsize;
+		n = MIN( (size_t)len, ringsize - off );
+		memcpy( ring + off, data, n );
+		wpos += n;
+		data += n;
+		len -= n;
+	}
+
+	wake = ! woken;
+	woken = 1;
+	g_mutex_unlock(slock);
+
+	if( wake && 1 != write( swake[1], "", 1 ) )
+		syslog( LOG_NOTICE, "stream: wakeup failed: %m" );
+}
+
+static void listener_close( int i )
+{
+	t_listener *l = listeners[i];
+
+	syslog( LOG_INFO, "stream: listener %s:%d disconnected",
+			inet_ntoa(l->sin.sin_addr), ntohs(l->sin.sin_port) );
+
+	close( l->sock );
+	free( l->out );
+	free( l );
+
+	listeners[i] = listeners[--nlisteners];
+}
+
+static void listener_accept( void )
+{
+	t_listener *l;
+	t_listener **tmp;
+	socklen_t len;
+	int sock;
+
+	if( NULL == (l = malloc(sizeof(t_listener))))
+		return;
+	memset( l, 0, sizeof(t_listener) );
+
+	len = sizeof(l->sin);
+	if( 0 > (sock = accept( slisten, (struct sockaddr*)&l->sin, &len ))){
+		free( l );
+		return;
+	}
+
+	if( nlisteners >= opt_stream_clients ){
+		syslog( LOG_NOTICE, "stream: too many listeners, "
+				"rejecting %s", inet_ntoa(l->sin.sin_addr) );
+		close( sock );
+		free( l );
+		return;
+	}
+
+	if( NULL == (tmp = realloc( listeners,
+			(nlisteners +1) * sizeof(t_listener*)))){
+		close( sock );
+		free( l );
+		return;
+	}
+	listeners = tmp;
+
+	/* close on exec, never block */
+	fcntl( sock, F_SETFD, 1 );
+	fcntl( sock, F_SETFL, O_NONBLOCK );
+
+	l->sock = sock;
+	l->state = ls_request;
+	listeners[nlisteners++] = l;
+
+	syslog( LOG_INFO, "stream: listener %s:%d connected",
+			inet_ntoa(l->sin.sin_addr), ntohs(l->sin.sin_port) );
+}
+
+/* returns -1 to close the listener */
+static int listener_read( t_listener *l )
+{
+	char buf[512];
+	int len;
+	int n;
+
+	/* after the request anything sent by the listener is ignored */
+	if( l->state != ls_request ){
+		if( 0 >= recv( l->sock, buf, sizeof(buf), 0 ))
+			return -1;
+		return 0;
+	}
+
+	if( 0 >= (len = recv( l->sock, l->req + l->reqlen,
+			STREAM_REQMAX - l->reqlen -1, 0 )))
+		return -1;
+
+	l->reqlen += len;
+	l->req[l->reqlen] = 0;
+
+	if( NULL == strstr( l->req, "\r\n\r\n" )
+		&& NULL == strstr( l->req, "\n\n" )){
+
+		if( l->reqlen >= STREAM_REQMAX -1 )
+			return -1;
+		return 0;
+	}
+
+	if( strncmp( l->req, "GET ", 4 ))
+		return -1;
+
+	/* reply + current stream headers */
+	g_mutex_lock(slock);
+	if( NULL == (l->out = malloc( 256 + strlen(opt_stream_type)
+			+ hdrlen ))){
+		g_mutex_unlock(slock);
+		return -1;
+	}
+
+	n = sprintf( l->out, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: %s\r\n"
+			"Cache-Control: no-cache\r\n"
+			"Server: dudld\r\n"
+			"\r\n", opt_stream_type );
+	memcpy( l->out + n, hdr, hdrlen );
+	l->outlen = n + hdrlen;
+	l->outpos = 0;
+
+	/* start with live data */
+	l->pos = wpos;
+	g_mutex_unlock(slock);
+
+	l->state = ls_reply;
+	return 0;
+}
+
+/* returns -1 to close the listener */
+static int listener_write( t_listener *l )
+{
+	size_t off;
+	size_t n;
+	int len;
+
+	if( l->state == ls_reply ){
+		len = send( l->sock, l->out + l->outpos,
+				l->outlen - l->outpos, MSG_NOSIGNAL );
+		if( len < 0 )
+			return errno == EAGAIN ? 0 : -1;
+
+		l->outpos += len;
+		if( l->outpos < l->outlen )
+			return 0;
+
+		free( l->out );
+		l->out = NULL;
+		l->state = ls_stream;
+	}
+
+	/* send straight from the ring */
+	g_mutex_lock(slock);
+	if( wpos - l->pos > ringsize ){
+		syslog( LOG_NOTICE, "stream: listener %s too slow, "
+				"skipping %d KB",
+				inet_ntoa(l->sin.sin_addr),
+				(int)((wpos - l->pos) / 1024) );
+		l->pos = wpos;
+	}
+
+	len = 0;
+	if( l->pos < wpos ){
+		off = l->pos % ringsize;
+		n = MIN( wpos - l->pos, ringsize - off );
+		len = send( l->sock, ring + off, n, MSG_NOSIGNAL );
+	}
+	g_mutex_unlock(slock);
+
+	if( len < 0 )
+		return errno == EAGAIN ? 0 : -1;
+
+	l->pos += len;
+	return 0;
+}
+
+static int listener_pending( t_listener *l )
+{
+	int r;
+
+	if( l->state == ls_request )
+		return 0;
+
+	if( l->state == ls_reply )
+		return 1;
+
+	g_mutex_lock(slock);
+	r = l->pos < wpos;
+	g_mutex_unlock(slock);
+
+	return r;
+}
+
+static gpointer stream_server( gpointer data )
+{
+	struct pollfd *pfd = NULL;
+	struct pollfd *tmp;
+	char buf[64];
+	int i;
+
+	(void)data;
+
+	while( 1 ){
+		g_mutex_lock(slock);
+		if( stop ){
+			g_mutex_unlock(slock);
+			break;
+		}
+		g_mutex_unlock(slock);
+
+		if( NULL == (tmp = realloc( pfd,
+				(nlisteners + 2) * sizeof(struct pollfd)))){
+			syslog( LOG_ERR, "stream: out of memory" );
+			sleep( 1 );
+			continue;
+		}
+		pfd = tmp;
+
+		pfd[0].fd = swake[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = slisten;
+		pfd[1].events = POLLIN;
+		for( i = 0; i < nlisteners; ++i ){
+			pfd[i+2].fd = listeners[i]->sock;
+			pfd[i+2].events = POLLIN
+				| (listener_pending(listeners[i]) ? POLLOUT : 0);
+		}
+
+		if( 0 > poll( pfd, nlisteners + 2, -1 )){
+			if( errno != EINTR )
+				syslog( LOG_ERR, "stream: poll: %m" );
+			continue;
+		}
+
+		if( pfd[0].revents ){
+			if( 0 > read( swake[0], buf, sizeof(buf) ))
+				syslog( LOG_ERR, "stream: wakeup: %m" );
+
+			g_mutex_lock(slock);
+			woken = 0;
+			g_mutex_unlock(slock);
+		}
+
+		/* backwards - closing moves the last listener to i */
+		for( i = nlisteners -1; i >= 0; --i ){
+			short ev = pfd[i+2].revents;
+
+			if( ( (ev & (POLLIN | POLLHUP | POLLERR))
+					&& listener_read( listeners[i] ))
+				|| ( (ev & POLLOUT)
+					&& listener_write( listeners[i] ))){
+
+				listener_close( i );
+			}
+		}
+
+		if( pfd[1].revents & POLLIN )
+			listener_accept();
+	}
+
+	while( nlisteners )
+		listener_close( nlisteners -1 );
+	free( pfd );
+
+	return NULL;
+}
+
+int stream_init( void )
+{
+	struct sockaddr_in sin;
+	GError *err = NULL;
+	int reuse = 1;
+
+	if( opt_stream_port <= 0 )
+		return 0;
+
+	ringsize = (size_t)opt_stream_buffer * 1024;
+	if( NULL == (ring = malloc( ringsize ))){
+		syslog( LOG_ERR, "stream: out of memory" );
+		return -1;
+	}
+
+	if( 0 > (slisten = socket( AF_INET, SOCK_STREAM, 0 )))
+		goto clean1;
+
+	setsockopt( slisten, SOL_SOCKET, SO_REUSEADDR,
+			(void *)&reuse, sizeof(reuse) );
+	fcntl( slisten, F_SETFD, 1 );
+
+	memset( &sin, 0, sizeof(sin) );
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(opt_stream_port);
+	sin.sin_addr.s_addr = INADDR_ANY;
+	if( 0 > bind( slisten, (struct sockaddr *) &sin, sizeof(sin)))
+		goto clean2;
+
+	if( 0 > listen( slisten, STREAM_BACKLOG ))
+		goto clean2;
+
+	if( pipe( swake ))
+		goto clean2;
+
+	slock = g_mutex_new();
+	stop = 0;
+
+	if( NULL == (sthread = g_thread_create( stream_server, NULL,
+			TRUE, &err ))){
+
+		syslog( LOG_ERR, "cannot start stream server: %s",
+				err->message );
+		g_error_free( err );
+		goto clean3;
+	}
+
+	syslog( LOG_INFO, "streaming on port %d", opt_stream_port );
+	return 0;
+
+clean3:
+	g_mutex_free( slock );
+	close( swake[0] );
+	close( swake[1] );
+	swake[0] = swake[1] = -1;
+clean2:
+	close( slisten );
+	slisten = -1;
+clean1:
+	syslog( LOG_ERR, "stream: cannot listen on port %d: %m",
+			opt_stream_port );
+	free( ring );
+	ring = NULL;
+	return -1;
+}
+
+void stream_done( void )
+{
+	GThread *t = sthread;
+
+	if( ! sthread )
+		return;
+
+	g_mutex_lock(slock);
+	stop++;
+	g_mutex_unlock(slock);
+
+	if( 1 != write( swake[1], "", 1 ))
+		syslog( LOG_ERR, "stream: cannot stop server: %m" );
+
+	g_thread_join( t );
+	sthread = NULL;
+
+	close( slisten );
+	slisten = -1;
+	close( swake[0] );
+	close( swake[1] );
+	swake[0] = swake[1] = -1;
+	g_mutex_free( slock );
+	free( ring );
+	ring = NULL;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2008 Rainer Clasen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms described in the file LICENSE included in this
+ * distribution.
+ *
+ */
+
+#ifndef _STREAM_H
+#define _STREAM_H
+
+int stream_init( void );
+void stream_done( void );
+
+/*
+ * add encoded data for listeners. header data (like Ogg stream
+ * headers) is additionally sent to each new listener.
+ */
+void stream_push( const char *data, int len, int header );
+
+#endif